@@ -0,0 +1,563 @@
+// condvar_bench.c - condvar micro-benchmarks, glibc vs libmy_pthread
+//
+// Plain pthread_cond_* calls, so the same binary measures glibc when run as
+// is and optimization/pthread/libmy_pthread.so when run with LD_PRELOAD.
+// condvar_bench.sh builds both and runs the whole matrix.
+//
+//   gcc -O2 -pthread -o condvar_bench condvar_bench.c -ldl
+//   condvar_bench SCENARIO [options]
+//
+// Scenarios:
+//   pingpong   1:1 ping-pong between pairs of threads (-t threads, even)
+//   queue      -p producers / -c consumers on a bounded queue (-q capacity)
+//   broadcast  fan-out to -k waiters; latency is broadcast-to-wake per waiter
+//   signal     one signal at a time to -k idle waiters; latency is signal-to-wake
+//   timedwait  -t threads in timedwait(-w usec) that nobody signals;
+//              latency is the overshoot past the deadline
+//   oversub    pingpong with 4 threads per CPU unless -t says otherwise
+//
+// Every run prints one JSON object: ops, ops/s, CPU seconds (user+sys of the
+// whole process) and p50/p99/p99.9/max latency in ns.
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <sys/resource.h>
+
+#define SAMPLES_PER_THREAD (1 << 18)
+
+typedef struct {
+    uint64_t *v;
+    size_t n;
+} samples_t;
+
+typedef struct {
+    int idx;
+    samples_t samples;
+    uint64_t ops;
+    uint64_t wakeups;
+    uint64_t spurious;
+} worker_t;
+
+static struct {
+    const char *scenario;
+    const char *impl;
+    int threads;
+    int producers;
+    int consumers;
+    int waiters;
+    int capacity;
+    long wait_us;
+    double duration;
+    int pin;
+} opt = {
+    .threads = 0, .producers = 1, .consumers = 1, .waiters = 4,
+    .capacity = 64, .wait_us = 100, .duration = 2.0, .pin = 0,
+};
+
+static atomic_int stop;
+static int cpu_list[CPU_SETSIZE];
+static int ncpus;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void record(worker_t *w, uint64_t ns) {
+    if (w->samples.n < SAMPLES_PER_THREAD) {
+        w->samples.v[w->samples.n++] = ns;
+    }
+}
+
+// Thread idx runs on the idx-th allowed CPU (wrapping) when pinned
+static void pin_self(int idx) {
+    if (!opt.pin) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu_list[idx % ncpus], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// ---------------------------------------------------------------------------
+// pingpong / oversub
+// ---------------------------------------------------------------------------
+typedef struct {
+    pthread_mutex_t m;
+    pthread_cond_t c[2];
+    int turn;
+} __attribute__((aligned(64))) pingpong_pair_t;
+
+static pingpong_pair_t *pairs;
+
+static void *pingpong_worker(void *arg) {
+    worker_t *w = arg;
+    pingpong_pair_t *p = &pairs[w->idx / 2];
+    int side = w->idx % 2;
+
+    pin_self(w->idx);
+    pthread_mutex_lock(&p->m);
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        uint64_t t0 = now_ns();
+        if (side == 0) {
+            p->turn = 1;
+            pthread_cond_signal(&p->c[1]);
+        }
+        while (p->turn != side && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+            pthread_cond_wait(&p->c[side], &p->m);
+            w->wakeups++;
+            if (p->turn != side && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+                w->spurious++;
+            }
+        }
+        if (side == 1) {
+            p->turn = 0;
+            pthread_cond_signal(&p->c[0]);
+        } else {
+            record(w, now_ns() - t0); // round trip
+            w->ops++;
+        }
+    }
+    pthread_mutex_unlock(&p->m);
+    return NULL;
+}
+
+static void pingpong_setup(int threads) {
+    pairs = aligned_alloc(64, sizeof(*pairs) * (threads / 2));
+    for (int i = 0; i < threads / 2; i++) {
+        pthread_mutex_init(&pairs[i].m, NULL);
+        pthread_cond_init(&pairs[i].c[0], NULL);
+        pthread_cond_init(&pairs[i].c[1], NULL);
+        pairs[i].turn = 0;
+    }
+}
+
+static void pingpong_stop(int threads) {
+    for (int i = 0; i < threads / 2; i++) {
+        pthread_mutex_lock(&pairs[i].m);
+        pthread_cond_broadcast(&pairs[i].c[0]);
+        pthread_cond_broadcast(&pairs[i].c[1]);
+        pthread_mutex_unlock(&pairs[i].m);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// queue
+// ---------------------------------------------------------------------------
+static struct {
+    pthread_mutex_t m;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint64_t *ring;
+    int head, count;
+} q = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0 };
+
+static void *queue_producer(void *arg) {
+    worker_t *w = arg;
+
+    pin_self(w->idx);
+    pthread_mutex_lock(&q.m);
+    for (;;) {
+        while (q.count == opt.capacity && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+            pthread_cond_wait(&q.not_full, &q.m);
+            w->wakeups++;
+            if (q.count == opt.capacity && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+                w->spurious++;
+            }
+        }
+        if (atomic_load_explicit(&stop, memory_order_relaxed)) {
+            break;
+        }
+        q.ring[(q.head + q.count) % opt.capacity] = now_ns();
+        q.count++;
+        pthread_cond_signal(&q.not_empty);
+        // Let consumers at the mutex between items
+        pthread_mutex_unlock(&q.m);
+        pthread_mutex_lock(&q.m);
+    }
+    pthread_mutex_unlock(&q.m);
+    return NULL;
+}
+
+static void *queue_consumer(void *arg) {
+    worker_t *w = arg;
+
+    pin_self(w->idx);
+    pthread_mutex_lock(&q.m);
+    for (;;) {
+        while (q.count == 0 && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+            pthread_cond_wait(&q.not_empty, &q.m);
+            w->wakeups++;
+            if (q.count == 0 && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+                w->spurious++;
+            }
+        }
+        if (q.count == 0) {
+            break;
+        }
+        uint64_t enqueued = q.ring[q.head];
+        q.head = (q.head + 1) % opt.capacity;
+        q.count--;
+        pthread_cond_signal(&q.not_full);
+        pthread_mutex_unlock(&q.m);
+        record(w, now_ns() - enqueued); // enqueue to dequeue
+        w->ops++;
+        pthread_mutex_lock(&q.m);
+    }
+    pthread_mutex_unlock(&q.m);
+    return NULL;
+}
+
+static void queue_stop(void) {
+    pthread_mutex_lock(&q.m);
+    pthread_cond_broadcast(&q.not_empty);
+    pthread_cond_broadcast(&q.not_full);
+    pthread_mutex_unlock(&q.m);
+}
+
+// ---------------------------------------------------------------------------
+// broadcast / signal: the main thread drives, workers wait
+// ---------------------------------------------------------------------------
+static struct {
+    pthread_mutex_t m;
+    pthread_cond_t go;
+    pthread_cond_t done;
+    uint64_t generation;
+    uint64_t sent_at;
+    int ready;
+    int acked;
+    int tokens;
+} fan = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0, 0 };
+
+static void *broadcast_waiter(void *arg) {
+    worker_t *w = arg;
+
+    pin_self(w->idx);
+    pthread_mutex_lock(&fan.m);
+    uint64_t seen = fan.generation;
+    fan.ready++;
+    pthread_cond_signal(&fan.done);
+    for (;;) {
+        while (fan.generation == seen && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+            pthread_cond_wait(&fan.go, &fan.m);
+            w->wakeups++;
+            if (fan.generation == seen && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+                w->spurious++;
+            }
+        }
+        if (atomic_load_explicit(&stop, memory_order_relaxed)) {
+            break;
+        }
+        seen = fan.generation;
+        record(w, now_ns() - fan.sent_at);
+        w->ops++;
+        if (++fan.acked == opt.waiters) {
+            pthread_cond_signal(&fan.done);
+        }
+    }
+    pthread_mutex_unlock(&fan.m);
+    return NULL;
+}
+
+static uint64_t broadcast_drive(void) {
+    uint64_t rounds = 0;
+
+    pthread_mutex_lock(&fan.m);
+    // A waiter that starts late would take the next generation as its own
+    while (fan.ready < opt.waiters && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+        pthread_cond_wait(&fan.done, &fan.m);
+    }
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        fan.acked = 0;
+        fan.generation++;
+        fan.sent_at = now_ns();
+        pthread_cond_broadcast(&fan.go);
+        while (fan.acked < opt.waiters && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+            pthread_cond_wait(&fan.done, &fan.m);
+        }
+        rounds++;
+    }
+    pthread_mutex_unlock(&fan.m);
+    return rounds;
+}
+
+static void *signal_waiter(void *arg) {
+    worker_t *w = arg;
+
+    pin_self(w->idx);
+    pthread_mutex_lock(&fan.m);
+    for (;;) {
+        while (fan.tokens == 0 && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+            pthread_cond_wait(&fan.go, &fan.m);
+            w->wakeups++;
+            if (fan.tokens == 0 && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+                w->spurious++;
+            }
+        }
+        if (fan.tokens == 0) {
+            break;
+        }
+        fan.tokens--;
+        record(w, now_ns() - fan.sent_at);
+        w->ops++;
+        pthread_cond_signal(&fan.done);
+    }
+    pthread_mutex_unlock(&fan.m);
+    return NULL;
+}
+
+static uint64_t signal_drive(void) {
+    uint64_t rounds = 0;
+
+    pthread_mutex_lock(&fan.m);
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        fan.tokens = 1;
+        fan.sent_at = now_ns();
+        pthread_cond_signal(&fan.go);
+        while (fan.tokens != 0 && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+            pthread_cond_wait(&fan.done, &fan.m);
+        }
+        rounds++;
+    }
+    fan.tokens = 0;
+    pthread_mutex_unlock(&fan.m);
+    return rounds;
+}
+
+static void fan_stop(void) {
+    pthread_mutex_lock(&fan.m);
+    pthread_cond_broadcast(&fan.go);
+    pthread_cond_broadcast(&fan.done);
+    pthread_mutex_unlock(&fan.m);
+}
+
+// ---------------------------------------------------------------------------
+// timedwait
+// ---------------------------------------------------------------------------
+static pthread_mutex_t tw_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tw_cond = PTHREAD_COND_INITIALIZER;
+
+static void *timedwait_worker(void *arg) {
+    worker_t *w = arg;
+    uint64_t timeout_ns = (uint64_t)opt.wait_us * 1000;
+
+    pin_self(w->idx);
+    pthread_mutex_lock(&tw_mutex);
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t t0 = now_ns();
+        deadline.tv_nsec += timeout_ns % 1000000000ULL;
+        deadline.tv_sec += timeout_ns / 1000000000ULL + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        int rc = pthread_cond_timedwait(&tw_cond, &tw_mutex, &deadline);
+        uint64_t elapsed = now_ns() - t0;
+        w->wakeups++;
+        if (rc != ETIMEDOUT) {
+            w->spurious++; // nobody signals: any other return is early
+        } else {
+            record(w, elapsed > timeout_ns ? elapsed - timeout_ns : 0);
+        }
+        w->ops++;
+    }
+    pthread_mutex_unlock(&tw_mutex);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Driver
+// ---------------------------------------------------------------------------
+static void (*wake_all)(void);
+
+static void pingpong_wake_all(void) {
+    pingpong_stop(opt.threads);
+}
+
+// Ends the run after opt.duration and kicks every waiter out
+static void *stopper(void *arg) {
+    struct timespec d = { (time_t)opt.duration, (long)((opt.duration - (time_t)opt.duration) * 1e9) };
+
+    (void)arg;
+    nanosleep(&d, NULL);
+    atomic_store(&stop, 1);
+    if (wake_all != NULL) {
+        wake_all();
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double cpu_seconds(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s pingpong|queue|broadcast|signal|timedwait|oversub [options]\n"
+            "  -t N   threads (pingpong, oversub, timedwait)\n"
+            "  -p N   producers (queue)       -c N  consumers (queue)\n"
+            "  -q N   queue capacity          -k N  waiters (broadcast, signal)\n"
+            "  -w US  timedwait timeout       -d S  seconds to run (default 2)\n"
+            "  -P     pin threads to CPUs     -i NAME  implementation label in the JSON\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int c;
+
+    if (argc < 2 || argv[1][0] == '-') {
+        usage(argv[0]);
+    }
+    opt.scenario = argv[1];
+    optind = 2;
+    while ((c = getopt(argc, argv, "t:p:c:q:k:w:d:Pi:")) != -1) {
+        switch (c) {
+        case 't': opt.threads = atoi(optarg); break;
+        case 'p': opt.producers = atoi(optarg); break;
+        case 'c': opt.consumers = atoi(optarg); break;
+        case 'q': opt.capacity = atoi(optarg); break;
+        case 'k': opt.waiters = atoi(optarg); break;
+        case 'w': opt.wait_us = atol(optarg); break;
+        case 'd': opt.duration = atof(optarg); break;
+        case 'P': opt.pin = 1; break;
+        case 'i': opt.impl = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (opt.impl == NULL) {
+        opt.impl = dlsym(RTLD_DEFAULT, "my_pthread_cond_wait") != NULL ? "libmy_pthread" : "glibc";
+    }
+
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &allowed)) {
+            cpu_list[ncpus++] = i;
+        }
+    }
+
+    // Which workers to start; the main thread drives broadcast/signal
+    void *(*fn_a)(void *) = NULL, *(*fn_b)(void *) = NULL;
+    int n_a = 0, n_b = 0;
+    uint64_t (*drive)(void) = NULL;
+    const char *latency_of;
+
+    if (strcmp(opt.scenario, "pingpong") == 0 || strcmp(opt.scenario, "oversub") == 0) {
+        if (opt.threads <= 0) {
+            opt.threads = strcmp(opt.scenario, "oversub") == 0 ? 4 * ncpus : 2;
+        }
+        opt.threads = opt.threads < 2 ? 2 : opt.threads & ~1;
+        pingpong_setup(opt.threads);
+        wake_all = pingpong_wake_all;
+        fn_a = pingpong_worker;
+        n_a = opt.threads;
+        latency_of = "round trip";
+    } else if (strcmp(opt.scenario, "queue") == 0) {
+        q.ring = calloc(opt.capacity, sizeof(*q.ring));
+        wake_all = queue_stop;
+        fn_a = queue_producer;
+        n_a = opt.producers;
+        fn_b = queue_consumer;
+        n_b = opt.consumers;
+        latency_of = "enqueue to dequeue";
+    } else if (strcmp(opt.scenario, "broadcast") == 0) {
+        fn_a = broadcast_waiter;
+        n_a = opt.waiters;
+        drive = broadcast_drive;
+        wake_all = fan_stop;
+        latency_of = "broadcast to wake";
+    } else if (strcmp(opt.scenario, "signal") == 0) {
+        fn_a = signal_waiter;
+        n_a = opt.waiters;
+        drive = signal_drive;
+        wake_all = fan_stop;
+        latency_of = "signal to wake";
+    } else if (strcmp(opt.scenario, "timedwait") == 0) {
+        fn_a = timedwait_worker;
+        n_a = opt.threads > 0 ? opt.threads : 1;
+        latency_of = "overshoot past deadline";
+    } else {
+        usage(argv[0]);
+    }
+
+    int n = n_a + n_b;
+    worker_t *workers = calloc(n, sizeof(*workers));
+    pthread_t *tids = calloc(n, sizeof(*tids));
+    for (int i = 0; i < n; i++) {
+        workers[i].idx = drive != NULL ? i + 1 : i; // CPU 0 is the driver's
+        workers[i].samples.v = malloc(SAMPLES_PER_THREAD * sizeof(uint64_t));
+    }
+    if (drive != NULL) {
+        pin_self(0);
+    }
+
+    double cpu0 = cpu_seconds();
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        pthread_create(&tids[i], NULL, i < n_a ? fn_a : fn_b, &workers[i]);
+    }
+    pthread_t stop_thread;
+    pthread_create(&stop_thread, NULL, stopper, NULL);
+    uint64_t rounds = drive != NULL ? drive() : 0;
+    for (int i = 0; i < n; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_join(stop_thread, NULL);
+    double elapsed = (now_ns() - t0) / 1e9;
+    double cpu = cpu_seconds() - cpu0;
+
+    uint64_t ops = 0, wakeups = 0, spurious = 0;
+    size_t total = 0;
+    for (int i = 0; i < n; i++) {
+        ops += workers[i].ops;
+        wakeups += workers[i].wakeups;
+        spurious += workers[i].spurious;
+        total += workers[i].samples.n;
+    }
+    if (drive != NULL) {
+        ops = rounds; // fan-outs / handoffs completed by the driver
+    }
+    uint64_t *all = malloc((total + 1) * sizeof(*all));
+    size_t k = 0;
+    for (int i = 0; i < n; i++) {
+        memcpy(all + k, workers[i].samples.v, workers[i].samples.n * sizeof(*all));
+        k += workers[i].samples.n;
+    }
+    qsort(all, total, sizeof(*all), cmp_u64);
+#define PCT(p) (total ? all[(size_t)((total - 1) * (p))] : 0)
+
+    printf("{\"scenario\": \"%s\", \"impl\": \"%s\", \"pinned\": %s, \"cpus\": %d, "
+           "\"threads\": %d, \"producers\": %d, \"consumers\": %d, \"waiters\": %d, "
+           "\"capacity\": %d, \"wait_us\": %ld, "
+           "\"duration_s\": %.3f, \"ops\": %llu, \"ops_per_sec\": %.1f, \"cpu_s\": %.3f, "
+           "\"wakeups\": %llu, \"spurious_wakeups\": %llu, "
+           "\"latency\": {\"of\": \"%s\", \"samples\": %zu, \"p50_ns\": %llu, "
+           "\"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}}\n",
+           opt.scenario, opt.impl, opt.pin ? "true" : "false", ncpus,
+           n + (drive != NULL), opt.producers, opt.consumers, opt.waiters,
+           opt.capacity, opt.wait_us,
+           elapsed, (unsigned long long)ops, ops / elapsed, cpu,
+           (unsigned long long)wakeups, (unsigned long long)spurious,
+           latency_of, total, (unsigned long long)PCT(0.50),
+           (unsigned long long)PCT(0.99), (unsigned long long)PCT(0.999),
+           (unsigned long long)(total ? all[total - 1] : 0));
+    return 0;
+}
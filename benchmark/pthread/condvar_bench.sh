@@ -0,0 +1,103 @@
+#!/bin/bash
+
+# --- Script Usage ---
+# Builds optimization/pthread/libmy_pthread.so and condvar_bench, then runs every
+# condvar scenario against glibc and libmy_pthread, pinned and unpinned, and
+# collects the results into one JSON array.
+#
+# Usage: ./condvar_bench.sh [output.json]
+# Example: DURATION=5 SCENARIOS="pingpong signal" ./condvar_bench.sh /tmp/cv.json
+#
+# Environment overrides:
+#   BUILD_DIR  where the library and benchmark are built (default /tmp/condvar_bench)
+#   DURATION   seconds per run (default 2)
+#   SCENARIOS  subset of: pingpong queue broadcast signal timedwait oversub
+#   IMPLS      subset of: glibc spin spin-queue
+#   PIN_MODES  subset of: unpinned pinned
+#   WAITERS    waiter counts for broadcast/signal (default "2 16 64 128")
+#   QUEUE_MIX  producer:consumer pairs for queue (default "1:1 4:4 8:2")
+#   TIMEDWAIT_US  timedwait timeouts in microseconds (default "50 1000")
+
+# --- Configuration ---
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+LIB_SRC_DIR="$SCRIPT_DIR/../../optimization/pthread"
+BUILD_DIR="${BUILD_DIR:-/tmp/condvar_bench}"
+
+DURATION="${DURATION:-2}"
+SCENARIOS="${SCENARIOS:-pingpong queue broadcast signal timedwait oversub}"
+IMPLS="${IMPLS:-glibc spin spin-queue}"
+PIN_MODES="${PIN_MODES:-unpinned pinned}"
+WAITERS="${WAITERS:-2 16 64 128}"
+QUEUE_MIX="${QUEUE_MIX:-1:1 4:4 8:2}"
+TIMEDWAIT_US="${TIMEDWAIT_US:-50 1000}"
+
+curr_datetime=$(date '+%Y%m%d%H%M%S')
+OUTPUT="${1:-./condvar_bench_${curr_datetime}.json}"
+
+# --- Build ---
+mkdir -p "$BUILD_DIR" || exit 1
+echo "Building into $BUILD_DIR..."
+gcc -O2 -fPIC -shared -o "$BUILD_DIR/libmy_pthread.so" "$LIB_SRC_DIR/libmy_pthread.c" -ldl -lpthread || exit 1
+gcc -O2 -pthread -o "$BUILD_DIR/condvar_bench" "$SCRIPT_DIR/condvar_bench.c" -ldl || exit 1
+
+# --- Run one configuration and append its JSON line ---
+first=1
+run() {
+    local impl="$1" pin="$2"
+    shift 2
+
+    local -a env_args=()
+    case "$impl" in
+        glibc)      ;;
+        spin)       env_args=(LD_PRELOAD="$BUILD_DIR/libmy_pthread.so") ;;
+        spin-queue) env_args=(LD_PRELOAD="$BUILD_DIR/libmy_pthread.so" LIBMY_PTHREAD_QUEUE=1) ;;
+        *)          echo "Unknown implementation: $impl" >&2; return ;;
+    esac
+    local -a pin_args=()
+    [ "$pin" = "pinned" ] && pin_args=(-P)
+
+    echo "  $impl $pin: $*" >&2
+    local result
+    result=$(env "${env_args[@]}" "$BUILD_DIR/condvar_bench" "$@" -d "$DURATION" -i "$impl" "${pin_args[@]}")
+    if [ -z "$result" ]; then
+        echo "    failed" >&2
+        return
+    fi
+    [ $first -eq 1 ] || echo "," >> "$OUTPUT"
+    first=0
+    echo -n "  $result" >> "$OUTPUT"
+}
+
+# --- Script Logic ---
+echo "[" > "$OUTPUT"
+for scenario in $SCENARIOS; do
+    echo "Scenario: $scenario" >&2
+    for pin in $PIN_MODES; do
+        for impl in $IMPLS; do
+            case "$scenario" in
+                queue)
+                    for mix in $QUEUE_MIX; do
+                        run "$impl" "$pin" queue -p "${mix%%:*}" -c "${mix##*:}"
+                    done
+                    ;;
+                broadcast|signal)
+                    for k in $WAITERS; do
+                        run "$impl" "$pin" "$scenario" -k "$k"
+                    done
+                    ;;
+                timedwait)
+                    for us in $TIMEDWAIT_US; do
+                        run "$impl" "$pin" timedwait -w "$us"
+                    done
+                    ;;
+                *)
+                    run "$impl" "$pin" "$scenario"
+                    ;;
+            esac
+        done
+    done
+done
+echo "" >> "$OUTPUT"
+echo "]" >> "$OUTPUT"
+
+echo "Results written to $OUTPUT"
@@ -0,0 +1,258 @@
+// condvar_wakeup_test.c - condvar wakeups counted against signals
+//
+// Plain pthread_cond_* calls, so the same binary checks glibc when run as is
+// and optimization/pthread/libmy_pthread.so when run with LD_PRELOAD.
+// condvar_wakeup_test.sh builds both, runs them and compares.
+//
+//   gcc -O2 -pthread -o condvar_wakeup_test condvar_wakeup_test.c
+//   condvar_wakeup_test [options]
+//
+// Stress phase: -n condvars, each with -k waiters and one signaler. The
+// signaler signals, and every -b'th time broadcasts, under the mutex. When
+// waiters are registered it hands out one token per waiter it may wake;
+// when none are it signals anyway (the case that used to bank credits).
+// Each signal can wake at most one of the registered waiters and each
+// broadcast at most all of them, so their sum bounds the returns from
+// pthread_cond_wait; anything above it is an excess (spurious) wakeup.
+//
+// Probe phase: on every condvar from the stress phase and on a fresh one,
+// -r signals and -r broadcasts with nobody waiting, then a timedwait of -w
+// usec. It must time out, and not before its deadline.
+//
+// Prints one JSON object; exits 1 if any probe returned early. The excess
+// is compared against glibc's by the script, since POSIX allows some.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    pthread_mutex_t m;
+    pthread_cond_t c;
+    int tokens;             // wakeups handed out and not yet consumed
+    int waiting;            // waiters inside pthread_cond_wait
+    uint64_t signals;
+    uint64_t broadcasts;
+    uint64_t idle_signals;  // signals and broadcasts with no waiter registered
+    uint64_t bound;         // most wakeups the signals so far may cause
+    uint64_t wakeups;
+    uint64_t consumed;
+} __attribute__((aligned(64))) group_t;
+
+static struct {
+    const char *impl;
+    int conds;
+    int waiters;
+    int broadcast_every;
+    int repeats;
+    long wait_us;
+    double duration;
+} opt = {
+    .impl = NULL, .conds = 4, .waiters = 8, .broadcast_every = 16,
+    .repeats = 1000, .wait_us = 20000, .duration = 2.0,
+};
+
+static atomic_int stop;
+static group_t *groups;
+
+static uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ---------------------------------------------------------------------------
+// Stress phase
+// ---------------------------------------------------------------------------
+static void *waiter(void *arg) {
+    group_t *g = arg;
+
+    pthread_mutex_lock(&g->m);
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        if (g->tokens > 0) {
+            g->tokens--;
+            g->consumed++;
+            pthread_mutex_unlock(&g->m);
+            sched_yield();
+            pthread_mutex_lock(&g->m);
+            continue;
+        }
+        g->waiting++;
+        pthread_cond_wait(&g->c, &g->m);
+        g->waiting--;
+        g->wakeups++;
+    }
+    pthread_mutex_unlock(&g->m);
+    return NULL;
+}
+
+static void *signaler(void *arg) {
+    group_t *g = arg;
+    uint64_t n = 0;
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        int broadcast = ++n % opt.broadcast_every == 0;
+
+        pthread_mutex_lock(&g->m);
+        if (g->waiting == 0) {
+            g->idle_signals++;
+        } else {
+            int woken = broadcast ? g->waiting : 1;
+            g->tokens += woken;
+            g->bound += woken;
+        }
+        if (broadcast) {
+            g->broadcasts++;
+            pthread_cond_broadcast(&g->c);
+        } else {
+            g->signals++;
+            pthread_cond_signal(&g->c);
+        }
+        pthread_mutex_unlock(&g->m);
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void *stopper(void *arg) {
+    (void)arg;
+    usleep((useconds_t)(opt.duration * 1e6));
+    atomic_store(&stop, 1);
+    // Release everyone still waiting; that broadcast counts too
+    for (int i = 0; i < opt.conds; i++) {
+        pthread_mutex_lock(&groups[i].m);
+        groups[i].bound += groups[i].waiting;
+        groups[i].broadcasts++;
+        pthread_cond_broadcast(&groups[i].c);
+        pthread_mutex_unlock(&groups[i].m);
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Probe phase
+// ---------------------------------------------------------------------------
+
+// Signal and broadcast with no waiter, then wait: 1 if the wait came back
+// before its deadline
+static int probe(pthread_cond_t *c, pthread_mutex_t *m) {
+    for (int i = 0; i < opt.repeats; i++) {
+        pthread_cond_signal(c);
+        pthread_cond_broadcast(c);
+    }
+
+    pthread_mutex_lock(m);
+    uint64_t start = realtime_ns();
+    uint64_t deadline = start + (uint64_t)opt.wait_us * 1000;
+    struct timespec ts = { .tv_sec = deadline / 1000000000ULL, .tv_nsec = deadline % 1000000000ULL };
+    int rc = pthread_cond_timedwait(c, m, &ts);
+    uint64_t end = realtime_ns();
+    pthread_mutex_unlock(m);
+
+    if (rc != ETIMEDOUT || end < deadline) {
+        fprintf(stderr, "probe: timedwait returned %d after %llu of %ld usec\n",
+                rc, (unsigned long long)(end - start) / 1000, opt.wait_us);
+        return 1;
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n N   condvars (default 4)        -k N  waiters per condvar (default 8)\n"
+            "  -b N   broadcast every N-th signal (default 16)\n"
+            "  -r N   idle signals/broadcasts before each probe (default 1000)\n"
+            "  -w N   probe timedwait in usec (default 20000)\n"
+            "  -d S   stress duration in seconds (default 2)\n"
+            "  -i S   implementation label for the output (default from LD_PRELOAD)\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int c;
+
+    while ((c = getopt(argc, argv, "n:k:b:r:w:d:i:")) != -1) {
+        switch (c) {
+        case 'n': opt.conds = atoi(optarg); break;
+        case 'k': opt.waiters = atoi(optarg); break;
+        case 'b': opt.broadcast_every = atoi(optarg); break;
+        case 'r': opt.repeats = atoi(optarg); break;
+        case 'w': opt.wait_us = atol(optarg); break;
+        case 'd': opt.duration = atof(optarg); break;
+        case 'i': opt.impl = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (opt.conds < 1 || opt.waiters < 1 || opt.broadcast_every < 1 || opt.wait_us < 1) {
+        usage(argv[0]);
+    }
+    if (opt.impl == NULL) {
+        opt.impl = getenv("LD_PRELOAD") != NULL ? "libmy_pthread" : "glibc";
+    }
+
+    groups = aligned_alloc(64, sizeof(*groups) * opt.conds);
+    for (int i = 0; i < opt.conds; i++) {
+        group_t *g = &groups[i];
+        *g = (group_t){ 0 };
+        pthread_mutex_init(&g->m, NULL);
+        pthread_cond_init(&g->c, NULL);
+    }
+
+    int n = opt.conds * (opt.waiters + 1);
+    pthread_t *tids = malloc(sizeof(*tids) * n);
+    int t = 0;
+    for (int i = 0; i < opt.conds; i++) {
+        for (int j = 0; j < opt.waiters; j++) {
+            pthread_create(&tids[t++], NULL, waiter, &groups[i]);
+        }
+        pthread_create(&tids[t++], NULL, signaler, &groups[i]);
+    }
+    pthread_t stop_thread;
+    pthread_create(&stop_thread, NULL, stopper, NULL);
+    for (int i = 0; i < n; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_join(stop_thread, NULL);
+
+    uint64_t signals = 0, broadcasts = 0, idle = 0, bound = 0, wakeups = 0, consumed = 0, excess = 0;
+    for (int i = 0; i < opt.conds; i++) {
+        group_t *g = &groups[i];
+        signals += g->signals;
+        broadcasts += g->broadcasts;
+        idle += g->idle_signals;
+        bound += g->bound;
+        wakeups += g->wakeups;
+        consumed += g->consumed;
+        if (g->wakeups > g->bound) {
+            excess += g->wakeups - g->bound;
+        }
+    }
+
+    int early = 0;
+    for (int i = 0; i < opt.conds; i++) {
+        early += probe(&groups[i].c, &groups[i].m);
+    }
+    pthread_mutex_t fresh_m = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t fresh_c;
+    pthread_cond_init(&fresh_c, NULL);
+    early += probe(&fresh_c, &fresh_m);
+    pthread_cond_destroy(&fresh_c);
+
+    printf("{\"impl\": \"%s\", \"conds\": %d, \"waiters\": %d, \"broadcast_every\": %d, "
+           "\"duration_s\": %.3f, \"signals\": %llu, \"broadcasts\": %llu, \"idle_signals\": %llu, "
+           "\"wakeup_bound\": %llu, \"wakeups\": %llu, \"consumed\": %llu, "
+           "\"excess_wakeups\": %llu, \"probes\": %d, \"early_returns\": %d}\n",
+           opt.impl, opt.conds, opt.waiters, opt.broadcast_every, opt.duration,
+           (unsigned long long)signals, (unsigned long long)broadcasts, (unsigned long long)idle,
+           (unsigned long long)bound, (unsigned long long)wakeups, (unsigned long long)consumed,
+           (unsigned long long)excess, opt.conds + 1, early);
+    return early > 0;
+}
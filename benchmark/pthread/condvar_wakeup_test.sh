@@ -0,0 +1,83 @@
+#!/bin/bash
+
+# --- Script Usage ---
+# Builds optimization/pthread/libmy_pthread.so and condvar_wakeup_test, runs
+# the wakeup stress against glibc first and then against libmy_pthread in
+# each of its wake modes. A libmy_pthread run fails if it counts more excess
+# wakeups (returns from pthread_cond_wait beyond what the signals and
+# broadcasts allow) than glibc's run did, or if a wait after signals and
+# broadcasts nobody was waiting for returned early. The exit status is the
+# number of failed runs.
+#
+# Usage: ./condvar_wakeup_test.sh
+# Example: DURATION=5 WAITERS=32 ./condvar_wakeup_test.sh
+#
+# Environment overrides:
+#   BUILD_DIR  where the library and test are built (default /tmp/condvar_wakeup_test)
+#   DURATION   seconds of stress per run (default 2)
+#   CONDS      condvars (default 4)
+#   WAITERS    waiters per condvar (default 8)
+#   IMPLS      subset of: spin spin-queue handoff
+
+# --- Configuration ---
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+LIB_SRC_DIR="$SCRIPT_DIR/../../optimization/pthread"
+BUILD_DIR="${BUILD_DIR:-/tmp/condvar_wakeup_test}"
+
+DURATION="${DURATION:-2}"
+CONDS="${CONDS:-4}"
+WAITERS="${WAITERS:-8}"
+IMPLS="${IMPLS:-spin spin-queue handoff}"
+
+# --- Build ---
+mkdir -p "$BUILD_DIR" || exit 1
+echo "Building into $BUILD_DIR..."
+gcc -O2 -fPIC -shared -o "$BUILD_DIR/libmy_pthread.so" "$LIB_SRC_DIR/libmy_pthread.c" -ldl -lpthread || exit 1
+gcc -O2 -pthread -o "$BUILD_DIR/condvar_wakeup_test" "$SCRIPT_DIR/condvar_wakeup_test.c" || exit 1
+
+# --- Run one implementation, print its JSON line, return the test's status ---
+run() {
+    local impl="$1"
+
+    local -a env_args=()
+    case "$impl" in
+        glibc)      ;;
+        spin)       env_args=(LD_PRELOAD="$BUILD_DIR/libmy_pthread.so") ;;
+        spin-queue) env_args=(LD_PRELOAD="$BUILD_DIR/libmy_pthread.so" LIBMY_PTHREAD_QUEUE=1) ;;
+        handoff)    env_args=(LD_PRELOAD="$BUILD_DIR/libmy_pthread.so" LIBMY_PTHREAD_HANDOFF=1) ;;
+        *)          echo "Unknown implementation: $impl" >&2; return 1 ;;
+    esac
+    env "${env_args[@]}" "$BUILD_DIR/condvar_wakeup_test" \
+        -d "$DURATION" -n "$CONDS" -k "$WAITERS" -i "$impl"
+}
+
+excess_of() {
+    sed -n 's/.*"excess_wakeups": \([0-9]*\).*/\1/p' <<< "$1"
+}
+
+# --- Script Logic ---
+failed=0
+result=$(run glibc)
+if [ $? -ne 0 ] || [ -z "$result" ]; then
+    echo "glibc run failed; nothing to compare against" >&2
+    exit 1
+fi
+echo "$result"
+glibc_excess=$(excess_of "$result")
+
+for impl in $IMPLS; do
+    result=$(run "$impl")
+    status=$?
+    echo "$result"
+    excess=$(excess_of "$result")
+    if [ $status -ne 0 ] || [ -z "$excess" ]; then
+        echo "  FAIL  $impl: wait returned early after signals nobody was waiting for" >&2
+        failed=$((failed + 1))
+    elif [ "$excess" -gt "$glibc_excess" ]; then
+        echo "  FAIL  $impl: $excess excess wakeups, glibc $glibc_excess" >&2
+        failed=$((failed + 1))
+    fi
+done
+
+echo "$failed failed"
+exit $failed
@@ -0,0 +1,55 @@
+// locking_malloc.c - malloc shim that takes a pthread mutex on every call
+//
+// Stands in for allocators that lock with pthread_mutex_lock (jemalloc and
+// tcmalloc arenas, for instance): preloaded next to libmy_pthread.so, every
+// allocation the library makes while it initializes comes straight back into
+// its interposed pthread_mutex_lock. preload_malloc_test.sh runs programs
+// this way and fails if any of them hangs.
+//
+//   gcc -O2 -fPIC -shared -o liblocking_malloc.so locking_malloc.c -lpthread
+//   LD_PRELOAD="libmy_pthread.so liblocking_malloc.so" PROGRAM
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stddef.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *malloc(size_t size) {
+    pthread_mutex_lock(&heap_lock);
+    void *p = __libc_malloc(size);
+    pthread_mutex_unlock(&heap_lock);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    pthread_mutex_lock(&heap_lock);
+    void *p = __libc_calloc(nmemb, size);
+    pthread_mutex_unlock(&heap_lock);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size) {
+    pthread_mutex_lock(&heap_lock);
+    void *p = __libc_realloc(ptr, size);
+    pthread_mutex_unlock(&heap_lock);
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size) {
+    pthread_mutex_lock(&heap_lock);
+    void *p = __libc_memalign(alignment, size);
+    pthread_mutex_unlock(&heap_lock);
+    return p;
+}
+
+void free(void *ptr) {
+    pthread_mutex_lock(&heap_lock);
+    __libc_free(ptr);
+    pthread_mutex_unlock(&heap_lock);
+}
@@ -0,0 +1,65 @@
+#!/bin/bash
+
+# --- Script Usage ---
+# Preloads optimization/pthread/libmy_pthread.so together with an allocator
+# that takes a pthread mutex on every call (locking_malloc.c) and checks that
+# programs still start, run and exit: the library's own initialization
+# allocates, and those allocations come back through its interposed
+# pthread_mutex_lock. Each run is killed after TIMEOUT seconds and counts as
+# a failure; the exit status is the number of failed runs.
+#
+# Usage: ./preload_malloc_test.sh
+# Example: TIMEOUT=30 ./preload_malloc_test.sh
+#
+# Environment overrides:
+#   BUILD_DIR  where the libraries and programs are built (default /tmp/preload_malloc_test)
+#   TIMEOUT    seconds before a run counts as hung (default 10)
+
+# --- Configuration ---
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+LIB_SRC_DIR="$SCRIPT_DIR/../../optimization/pthread"
+BUILD_DIR="${BUILD_DIR:-/tmp/preload_malloc_test}"
+TIMEOUT="${TIMEOUT:-10}"
+
+# --- Build ---
+mkdir -p "$BUILD_DIR" || exit 1
+echo "Building into $BUILD_DIR..."
+gcc -O2 -fPIC -shared -o "$BUILD_DIR/libmy_pthread.so" "$LIB_SRC_DIR/libmy_pthread.c" -ldl -lpthread || exit 1
+gcc -O2 -fPIC -shared -o "$BUILD_DIR/liblocking_malloc.so" "$SCRIPT_DIR/locking_malloc.c" -lpthread || exit 1
+gcc -O2 -pthread -o "$BUILD_DIR/condvar_bench" "$SCRIPT_DIR/condvar_bench.c" -ldl || exit 1
+
+LIB="$BUILD_DIR/libmy_pthread.so"
+MALLOC="$BUILD_DIR/liblocking_malloc.so"
+
+# --- Run one program under one preload order and mutex setting ---
+failed=0
+run() {
+    local preload="$1" mutex="$2"
+    shift 2
+
+    local status
+    timeout -s KILL "$TIMEOUT" env LD_PRELOAD="$preload" LIBMY_PTHREAD_MUTEX="$mutex" "$@" > /dev/null
+    status=$?
+    if [ $status -eq 0 ]; then
+        echo "  ok    LIBMY_PTHREAD_MUTEX=$mutex LD_PRELOAD=\"$preload\" $*"
+        return
+    fi
+    if [ $status -eq 137 ]; then
+        echo "  HUNG  LIBMY_PTHREAD_MUTEX=$mutex LD_PRELOAD=\"$preload\" $*"
+    else
+        echo "  FAIL  ($status) LIBMY_PTHREAD_MUTEX=$mutex LD_PRELOAD=\"$preload\" $*"
+    fi
+    failed=$((failed + 1))
+}
+
+# --- Script Logic ---
+for preload in "$LIB $MALLOC" "$MALLOC $LIB"; do
+    for mutex in 1 0; do
+        run "$preload" "$mutex" /bin/true
+        run "$preload" "$mutex" "$BUILD_DIR/condvar_bench" queue -p 4 -c 4 -d 1
+        run "$preload" "$mutex" "$BUILD_DIR/condvar_bench" pingpong -t 4 -d 1
+    done
+done
+
+echo "$failed failed"
+exit $failed
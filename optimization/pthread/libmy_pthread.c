@@ -1,6 +1,10 @@
 
 // libmy_pthread.c - ULTRA HIGH PERFORMANCE VERSION
+#define _GNU_SOURCE
 #include "libmy_pthread.h"
+#include "libmy_pthread_stats.h"
+#include "libmy_pthread_trace.h"
+#include "libmy_pthread_core.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -13,14 +17,82 @@
 #include <dlfcn.h>
 #include <syslog.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+#include <limits.h>
+#include <fnmatch.h>
+#include <linux/futex.h>
 
 // Ultra-aggressive configuration for minimum latency
 #define SPIN_CHECK_FREQUENCY 1  // Check EVERY iteration for absolute minimum latency
 #define TARGET_SPIN_TIME_US 10  // Reduced to 50μs
-#define MIN_SPIN_ITERATIONS 100
-#define MAX_SPIN_ITERATIONS 50000
+#define TSC_CALIBRATION_NS 2000000ULL   // 2ms per calibration round
+#define TSC_CALIBRATION_TOLERANCE 1000  // rounds must agree within 0.1%
+
+// Spin budget in time-base ticks (TSC cycles, or ns on the clock fallback)
+static uint64_t cached_spin_ticks = 0;
+
+// Wait modes: pure spin (legacy) or spin-then-park on a futex
+#define WAIT_MODE_SPIN   0
+#define WAIT_MODE_HYBRID 1
+static int wait_mode = WAIT_MODE_HYBRID;
+
+// LIBMY_PTHREAD_QUEUE=1: every waiter spins on its own queued node instead
+// of the shared wait_word (see "Per-waiter queue mode" below)
+static int queue_mode = 0;
+
+// LIBMY_PTHREAD_HANDOFF=1: wait morphing - a signal sent with the companion
+// mutex held hands that mutex straight to the woken waiter (implies queue mode)
+static int handoff_mode = 0;
+
+// LIBMY_PTHREAD_MUTEX=0 leaves pthread_mutex_* to glibc when interposing
+static int mutex_mode = 1;
+
+// LIBMY_PTHREAD_SEM=0 / LIBMY_PTHREAD_BARRIER=0 do the same for sem_* and
+// pthread_barrier_*
+static int sem_mode = 1;
+static int barrier_mode = 1;
 
-static uint32_t cached_spin_iterations = 0;
+// LIBMY_PTHREAD_SPINNERS=N caps concurrent spinners at N; unset = sized
+// from the CPUs the process may use (see "Spinner admission")
+static int spinner_override = -1;
+
+// LIBMY_PTHREAD_STATS=0 turns the counters off and keeps /dev/shm out of it
+static int stats_enabled = 1;
+
+// What a spinning waiter does between polls (LIBMY_PTHREAD_WAIT)
+#define WAIT_STRATEGY_BARRIER 0  // compiler barrier only
+#define WAIT_STRATEGY_PAUSE   1  // PAUSE with exponential backoff
+#define WAIT_STRATEGY_UMWAIT  2  // UMONITOR/UMWAIT on the polled line (WAITPKG)
+#define WAIT_STRATEGY_TPAUSE  3  // TPAUSE in short slices (WAITPKG)
+#define WAIT_STRATEGY_YIELD   4  // sched_yield
+#define PAUSE_BACKOFF_MAX     16     // max PAUSEs between polls
+#define PAUSE_BACKOFF_LLC     1      // ... when the signaller shares our LLC
+#define PAUSE_BACKOFF_REMOTE  64     // ... when it is on another socket
+#define TPAUSE_SLICE_NS       500    // TPAUSE re-polls at least this often
+#define WAITPKG_C01           1      // UMWAIT/TPAUSE control: C0.1, fastest wakeup
+static int wait_strategy = WAIT_STRATEGY_PAUSE;
+static uint64_t tpause_slice_ticks = 0;
+
+// Adaptive spin budget (hybrid mode only), see ultra_spin_budget()
+#define ADAPTIVE_MIN_SPIN_US      1    // LIBMY_PTHREAD_SPIN_MIN_US
+#define ADAPTIVE_MAX_SPIN_US      50   // LIBMY_PTHREAD_SPIN_MAX_US
+#define ADAPTIVE_EWMA_SHIFT       3    // moving average weight 1/8
+#define ADAPTIVE_HIT_SHIFT        4    // hit rate weight 1/16
+#define ADAPTIVE_HIT_ONE          65535
+#define ADAPTIVE_SKIP_HIT_RATE    (ADAPTIVE_HIT_ONE / 8) // below this, stop spinning
+#define ADAPTIVE_PROBE_INTERVAL   32   // skipping condvars still spin every Nth wait
+static int adaptive_enabled = 1;       // LIBMY_PTHREAD_ADAPTIVE=0 opts out
+static uint64_t adaptive_min_ticks = 0;
+static uint64_t adaptive_max_ticks = 0;
 
 // Architecture-specific optimizations
 #if defined(__x86_64__) || defined(__i386__)
@@ -39,13 +111,6 @@ static uint32_t cached_spin_iterations = 0;
 static inline void minimal_pause(void) {
 #if defined(__x86_64__) || defined(__i386__)
     // On x86, just a compiler barrier is often enough due to strong memory model
-    // Introduce a few pauses for better back-off and HT fairness
-#if 0
-    for (int i = 0; i < 4; i++) { // e.g., 4 pauses
-        __asm__ __volatile__("pause" ::: "memory");
-    }
-#endif
-    //__asm__ __volatile__("pause" ::: "memory");
     __asm__ __volatile__("" ::: "memory");
 
 #elif defined(__aarch64__)
@@ -55,324 +120,4245 @@ static inline void minimal_pause(void) {
 #endif
 }
 
-// Ultra-fast CPU frequency detection
-static uint64_t get_cpu_frequency_fast(void) {
-#if 0
-    static uint64_t cached_freq = 0;
-    if (cached_freq != 0) {
-        return cached_freq;
+// Waits on another thread's next store (a queue link, a lock word): PAUSE
+// while it is most likely running, then yield in case it was preempted
+// mid-way and needs our CPU to finish.
+#define SHORT_WAIT_SPINS 128
+
+static inline void ultra_short_wait(uint32_t *spins) {
+    if (++*spins < SHORT_WAIT_SPINS) {
+        ultra_core_cpu_relax();
+    } else {
+        *spins = 0;
+        sched_yield();
     }
+}
 
-    // Quick calibration using rdtsc
-    struct timespec start, end;
-    uint64_t tsc_start, tsc_end;
+// Spin time base.
+// With an invariant TSC, spin deadlines are plain rdtsc comparisons; the TSC
+// rate is calibrated against CLOCK_MONOTONIC at load time so that a spin
+// budget in microseconds means the same wall time on every SKU and turbo
+// state. Without one, ticks are CLOCK_MONOTONIC nanoseconds.
+#define TIME_SOURCE_CLOCK      0  // clock_gettime(CLOCK_MONOTONIC), 1 tick = 1ns
+#define TIME_SOURCE_TSC_CAL    1  // invariant TSC, calibrated at load
+#define TIME_SOURCE_TSC_KERNEL 2  // invariant TSC, rate from the kernel's tsc_khz
+#define TIME_SOURCE_CNTVCT     3  // arm64 generic timer
 
-    clock_gettime(CLOCK_MONOTONIC, &start);
-#if defined(__x86_64__) || defined(__i386__)
-    __asm__ __volatile__("rdtsc" : "=A"(tsc_start));
-#else
-    tsc_start = 0;
-#endif
+static int time_source = TIME_SOURCE_CLOCK;
+static uint64_t ticks_per_sec = 1000000000ULL;
+
+// Current time in spin ticks
+static inline uint64_t ultra_now_ticks(void) {
+    if (time_source == TIME_SOURCE_CLOCK) {
+        return ultra_core_monotonic_ns();
+    }
+    return ultra_core_read_tsc();
+}
 
-    usleep(10000); // 10ms calibration
+static inline uint64_t ultra_us_to_ticks(uint64_t us) {
+    return us * ticks_per_sec / 1000000ULL;
+}
 
-    clock_gettime(CLOCK_MONOTONIC, &end);
 #if defined(__x86_64__) || defined(__i386__)
-    __asm__ __volatile__("rdtsc" : "=A"(tsc_end));
-#else
-    tsc_end = 1;
+// TSC rate as exported by the kernel, where it is (tsc_freq_khz is not in
+// every kernel); 0 if unavailable
+static uint64_t kernel_tsc_hz(void) {
+    uint64_t khz = 0;
+    FILE *fp = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "r");
+
+    if (fp != NULL) {
+        if (fscanf(fp, "%lu", &khz) != 1) {
+            khz = 0;
+        }
+        fclose(fp);
+    }
+    return khz * 1000ULL;
+}
 #endif
 
-    if (tsc_end > tsc_start) {
-        uint64_t ns_elapsed = (end.tv_sec - start.tv_sec) * 1000000000ULL +
-                             (end.tv_nsec - start.tv_nsec);
-        uint64_t tsc_elapsed = tsc_end - tsc_start;
-        cached_freq = (tsc_elapsed * 1000000000ULL) / ns_elapsed;
-        fprintf(stderr, "====cached_freq: %d\n", cached_freq);
-    } else {
-        cached_freq = 3600000000ULL; // 3.6GHz fallback
+// Pick the spin time base once at load
+static void init_time_source(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (!ultra_core_invariant_tsc()) {
+        return; // TSC rate may change under us - stay on clock_gettime
+    }
+
+    // Two rounds that must agree: preemption during one shows up as a mismatch
+    uint64_t first = ultra_core_calibrate_tsc(TSC_CALIBRATION_NS);
+    uint64_t second = ultra_core_calibrate_tsc(TSC_CALIBRATION_NS);
+    uint64_t diff = first > second ? first - second : second - first;
+
+    if (first != 0 && second != 0 && diff * TSC_CALIBRATION_TOLERANCE < second) {
+        ticks_per_sec = (first + second) / 2;
+        time_source = TIME_SOURCE_TSC_CAL;
+        return;
+    }
+
+    uint64_t khz_hz = kernel_tsc_hz();
+    if (khz_hz != 0) {
+        ticks_per_sec = khz_hz;
+        time_source = TIME_SOURCE_TSC_KERNEL;
+    }
+    // else: calibration was disturbed and the kernel doesn't say - clock fallback
+#elif defined(__aarch64__)
+    uint64_t freq;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+    if (freq != 0) {
+        ticks_per_sec = freq;
+        time_source = TIME_SOURCE_CNTVCT;
     }
 #endif
-    static uint64_t cached_freq = 3600000000ULL; // 3.6GHz test
+}
+
+static const char *time_source_name(void) {
+    switch (time_source) {
+    case TIME_SOURCE_TSC_CAL:    return "invariant TSC (calibrated)";
+    case TIME_SOURCE_TSC_KERNEL: return "invariant TSC (kernel tsc_khz)";
+    case TIME_SOURCE_CNTVCT:     return "cntvct_el0";
+    default:                     return "CLOCK_MONOTONIC";
+    }
+}
 
-    return cached_freq;
+// Wait strategies.
+// ultra_spin_pause() is called by a spinner after a failed poll of *addr,
+// which it last saw holding `seen`. UMWAIT arms the monitor on that line and
+// sleeps until it is written or the spin deadline passes, so the waiter wakes
+// on the signaller's store instead of polling. UMWAIT/TPAUSE deadlines are TSC
+// values, so both need the invariant TSC time base as well as WAITPKG.
+#if defined(__x86_64__) || defined(__i386__)
+// CPUID.(EAX=7,ECX=0):ECX[5]
+static int cpu_has_waitpkg(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0) {
+        return 0;
+    }
+    return (ecx >> 5) & 1;
 }
 
-// Calculate minimal spin iterations
-static uint32_t calculate_minimal_spin_iterations(void) {
-    static uint32_t cached_iterations = 0;
-    if (cached_iterations != 0) {
-        return cached_iterations;
+__attribute__((target("waitpkg")))
+static void umwait_on(const atomic_uint *addr, uint32_t seen, uint64_t deadline) {
+    _umonitor((void *)addr);
+    // Re-check after arming: a store between the poll and UMONITOR would
+    // otherwise leave us sleeping until the deadline
+    if (atomic_load_explicit(addr, memory_order_relaxed) == seen) {
+        _umwait(WAITPKG_C01, deadline);
     }
+}
 
-    uint64_t cpu_freq = get_cpu_frequency_fast();
+__attribute__((target("waitpkg")))
+static void tpause_until(uint64_t deadline) {
+    uint64_t slice_end = ultra_core_read_tsc() + tpause_slice_ticks;
+    _tpause(WAITPKG_C01, slice_end < deadline ? slice_end : deadline);
+}
+#endif
+
+// One spin phase's strategy and PAUSE backoff. Starts as the process-wide
+// strategy; the condvar waits adjust it to the waiter's topology.
+typedef struct {
+    int strategy;          // WAIT_STRATEGY_*
+    uint32_t backoff;      // PAUSEs before the next poll
+    uint32_t backoff_max;
+} ultra_spin_policy_t;
 
-    // Target: 10μs with minimal overhead
-    // Assume 1 cycle per minimal pause (compiler barrier only)
-    uint64_t target_cycles = (cpu_freq * TARGET_SPIN_TIME_US) / 1000000;
-    cached_iterations = (uint32_t)target_cycles;
+#define ULTRA_SPIN_POLICY_INIT { wait_strategy, 1, PAUSE_BACKOFF_MAX }
 
-    // Bounds checking
-    if (cached_iterations < MIN_SPIN_ITERATIONS) {
-        cached_iterations = MIN_SPIN_ITERATIONS;
+static inline void ultra_spin_pause(const atomic_uint *addr, uint32_t seen, uint64_t deadline,
+                                    ultra_spin_policy_t *policy) {
+    switch (policy->strategy) {
+#if defined(__x86_64__) || defined(__i386__)
+    case WAIT_STRATEGY_PAUSE:
+        for (uint32_t i = 0; i < policy->backoff; i++) {
+            __asm__ __volatile__("pause" ::: "memory");
+        }
+        if (policy->backoff < policy->backoff_max) {
+            policy->backoff <<= 1;
+        }
+        break;
+    case WAIT_STRATEGY_UMWAIT:
+        umwait_on(addr, seen, deadline);
+        break;
+    case WAIT_STRATEGY_TPAUSE:
+        tpause_until(deadline);
+        break;
+#endif
+    case WAIT_STRATEGY_YIELD:
+        sched_yield();
+        break;
+    default:
+        minimal_pause();
+        break;
     }
-    if (cached_iterations > MAX_SPIN_ITERATIONS) {
-        cached_iterations = MAX_SPIN_ITERATIONS;
+    (void)addr;
+    (void)seen;
+    (void)deadline;
+}
+
+static const char *wait_strategy_name(void) {
+    switch (wait_strategy) {
+    case WAIT_STRATEGY_PAUSE:  return "pause";
+    case WAIT_STRATEGY_UMWAIT: return "umwait";
+    case WAIT_STRATEGY_TPAUSE: return "tpause";
+    case WAIT_STRATEGY_YIELD:  return "yield";
+    default:                   return "barrier";
     }
+}
 
-    return cached_iterations;
+// Map LIBMY_PTHREAD_WAIT onto what this CPU and time base can do
+static void select_wait_strategy(const char *name) {
+    if (name == NULL || strcmp(name, "pause") == 0) {
+        wait_strategy = WAIT_STRATEGY_PAUSE;
+    } else if (strcmp(name, "barrier") == 0) {
+        wait_strategy = WAIT_STRATEGY_BARRIER;
+    } else if (strcmp(name, "yield") == 0) {
+        wait_strategy = WAIT_STRATEGY_YIELD;
+    } else if (strcmp(name, "umwait") == 0 || strcmp(name, "tpause") == 0) {
+        wait_strategy = WAIT_STRATEGY_PAUSE;
+#if defined(__x86_64__) || defined(__i386__)
+        int tsc_deadlines = time_source == TIME_SOURCE_TSC_CAL ||
+                            time_source == TIME_SOURCE_TSC_KERNEL;
+        if (cpu_has_waitpkg() && tsc_deadlines) {
+            wait_strategy = strcmp(name, "umwait") == 0 ? WAIT_STRATEGY_UMWAIT
+                                                        : WAIT_STRATEGY_TPAUSE;
+            tpause_slice_ticks = ticks_per_sec * TPAUSE_SLICE_NS / 1000000000ULL;
+        }
+#endif
+    }
+#if !defined(__x86_64__) && !defined(__i386__)
+    if (wait_strategy == WAIT_STRATEGY_PAUSE) {
+        wait_strategy = WAIT_STRATEGY_BARRIER; // minimal_pause already yields on arm64
+    }
+#endif
 }
 
-// Ultra-minimal spinning state - optimized for cache efficiency
-typedef struct {
-    // Pack everything into single cache line (64 bytes)
-    atomic_int signal_count;      // 4 bytes
-    atomic_int waiting_threads;   // 4 bytes
-    atomic_long successful_spins; // 8 bytes
-    atomic_long failed_spins;     // 8 bytes
-    atomic_long total_spins;      // 8 bytes
-    char padding[32];             // Pad to 64 bytes
-} __attribute__((aligned(64))) ultra_spin_state_t;
+// Parse an unsigned environment setting, keeping the default on garbage
+static uint64_t env_u64(const char *name, uint64_t def) {
+    const char *val = getenv(name);
+    char *end;
 
-// Smaller hash table for better cache locality
-#define ULTRA_HASH_SIZE 256
-static ultra_spin_state_t spin_states[ULTRA_HASH_SIZE] __attribute__((aligned(64)));
-static atomic_int initialized = ATOMIC_VAR_INIT(0);
+    if (val == NULL || *val == '\0') {
+        return def;
+    }
+    unsigned long long parsed = strtoull(val, &end, 10);
+    return *end == '\0' ? parsed : def;
+}
 
-// Initialize spinning states
-void my_pthread_init_spin_states(void) {
-    int expected = 0;
+// CPU topology from sysfs, read once at load time.
+// Cores and LLCs are named by their lowest CPU number; sockets are
+// renumbered 0..nr_sockets-1. CPUs sysfs says nothing about are their own
+// core and LLC on socket and node 0.
+#define TOPOLOGY_MAX_CPUS  1024
+#define TOPOLOGY_MAX_NODES 64
+static unsigned short cpu_core[TOPOLOGY_MAX_CPUS];   // SMT siblings share it
+static unsigned short cpu_llc[TOPOLOGY_MAX_CPUS];    // CPUs sharing the last-level cache
+static unsigned short cpu_socket[TOPOLOGY_MAX_CPUS];
+static unsigned char cpu_node[TOPOLOGY_MAX_CPUS];    // NUMA node
+static int nr_sockets = 1;
+static int nr_nodes = 1;
+static int topology_aware = 0;  // LIBMY_PTHREAD_TOPOLOGY, and some SMT or LLC split to act on
 
-    if (atomic_compare_exchange_strong(&initialized, &expected, 1)) {
-        for (int i = 0; i < ULTRA_HASH_SIZE; i++) {
-            atomic_init(&spin_states[i].signal_count, 0);
-            atomic_init(&spin_states[i].waiting_threads, 0);
-            atomic_init(&spin_states[i].successful_spins, 0);
-            atomic_init(&spin_states[i].failed_spins, 0);
-            atomic_init(&spin_states[i].total_spins, 0);
+// First number in a sysfs file: an id, or the lowest CPU of a CPU list
+static int sysfs_first_int(const char *path, int def) {
+    FILE *f = fopen(path, "r");
+    int value = def;
+
+    if (f != NULL) {
+        if (fscanf(f, "%d", &value) != 1) {
+            value = def;
         }
+        fclose(f);
     }
-    cached_spin_iterations = calculate_minimal_spin_iterations();
+    return value;
 }
 
-// Ultra-fast hash function
-static inline int ultra_hash_cond(pthread_cond_t *cond) {
-    uintptr_t addr = (uintptr_t)cond;
-    return (int)((addr >> 6) & (ULTRA_HASH_SIZE - 1)); // Divide by 64 for cache line alignment
+// Lowest CPU sharing cpu's highest-level cache
+static int cpu_llc_leader(long cpu) {
+    char path[128];
+    int best_level = 0;
+    int leader = (int)cpu;
+
+    for (int index = 0; index < 8; index++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/cache/index%d/level", cpu, index);
+        int level = sysfs_first_int(path, -1);
+        if (level < 0) {
+            break;
+        }
+        if (level > best_level) {
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/cache/index%d/shared_cpu_list", cpu, index);
+            best_level = level;
+            leader = sysfs_first_int(path, (int)cpu);
+        }
+    }
+    return leader;
 }
 
-// Get spinning state
-static inline ultra_spin_state_t* get_ultra_spin_state(pthread_cond_t *cond) {
-    my_pthread_init_spin_states();
-    return &spin_states[ultra_hash_cond(cond)];
+// The cpuN directory links the CPU's node as nodeM
+static int cpu_numa_node(long cpu) {
+    char path[64];
+    int node = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1) {
+            break;
+        }
+    }
+    closedir(dir);
+    return node >= 0 && node < TOPOLOGY_MAX_NODES ? node : 0;
 }
 
+static void load_topology(void) {
+    int package_ids[TOPOLOGY_MAX_CPUS];
+    long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    int smt = 0;
+    int llc_split = 0;
 
-// Ultra-fast signal consumption - absolute minimum overhead
-static inline int ultra_fast_consume_signal(atomic_int *signal_count) {
-    int current_val;
+    nr_sockets = 0;
+    for (long cpu = 0; cpu < ncpu && cpu < TOPOLOGY_MAX_CPUS; cpu++) {
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/topology/physical_package_id", cpu);
+        int package = sysfs_first_int(path, 0);
+        int socket = 0;
+        while (socket < nr_sockets && package_ids[socket] != package) {
+            socket++;
+        }
+        if (socket == nr_sockets) {
+            package_ids[nr_sockets++] = package;
+        }
+        cpu_socket[cpu] = (unsigned short)socket;
 
-    // Use a CAS loop to atomically decrement the count only if it is positive.
-    do {
-        // 1. Load the current value (ACQUIRE ensures visibility of the signal)
-        current_val = atomic_load_explicit(signal_count, MEMORY_ORDER_ACQUIRE);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/topology/thread_siblings_list", cpu);
+        int core = sysfs_first_int(path, (int)cpu);
+        int llc = cpu_llc_leader(cpu);
+        cpu_core[cpu] = (unsigned short)(core >= 0 && core < TOPOLOGY_MAX_CPUS ? core : cpu);
+        cpu_llc[cpu] = (unsigned short)(llc >= 0 && llc < TOPOLOGY_MAX_CPUS ? llc : cpu);
+        smt |= cpu_core[cpu] != cpu;
+        llc_split |= cpu_llc[cpu] != cpu_llc[0];
 
-        // 2. Check the value
-        if (current_val <= 0) {
-            return 0; // No signal, exit loop
+        cpu_node[cpu] = (unsigned char)cpu_numa_node(cpu);
+        if (cpu_node[cpu] >= nr_nodes) {
+            nr_nodes = cpu_node[cpu] + 1;
         }
+    }
+    if (nr_sockets == 0) {
+        nr_sockets = 1;
+    }
+    topology_aware = env_u64("LIBMY_PTHREAD_TOPOLOGY", 1) != 0 && (smt || llc_split);
+}
 
-        // 3. Try to decrement the count using CAS
-        // If successful, we consume the signal and exit the loop.
-        // If failed (another thread modified it), we loop and try again.
-    } while (!atomic_compare_exchange_weak_explicit(
-        signal_count,              // Pointer to the atomic variable
-        &current_val,              // Expected value (is updated on failure)
-        current_val - 1,           // New value
-        MEMORY_ORDER_ACQ_REL,      // Success ordering (Consume + Release)
-        MEMORY_ORDER_RELAXED));    // Failure ordering (Relaxed retry)
+// Where a waiter runs relative to the thread that last signalled it
+#define CPU_REL_UNKNOWN 0  // no signal seen yet, or topology awareness off
+#define CPU_REL_CORE    1  // same CPU or an SMT sibling
+#define CPU_REL_LLC     2  // other core sharing the last-level cache
+#define CPU_REL_SOCKET  3  // same socket, other LLC
+#define CPU_REL_REMOTE  4  // other socket
+
+static inline int ultra_cpu_relation(int a, int b) {
+    if ((unsigned int)a >= TOPOLOGY_MAX_CPUS || (unsigned int)b >= TOPOLOGY_MAX_CPUS) {
+        return CPU_REL_UNKNOWN;
+    }
+    if (cpu_core[a] == cpu_core[b]) {
+        return CPU_REL_CORE;
+    }
+    if (cpu_llc[a] == cpu_llc[b]) {
+        return CPU_REL_LLC;
+    }
+    return cpu_socket[a] == cpu_socket[b] ? CPU_REL_SOCKET : CPU_REL_REMOTE;
+}
 
-    return 1; // Successfully consumed a signal
+static inline int ultra_current_socket(void) {
+    int cpu = sched_getcpu();
+    return cpu >= 0 && cpu < TOPOLOGY_MAX_CPUS ? cpu_socket[cpu] : 0;
 }
 
+static inline int ultra_current_node(void) {
+    int cpu = sched_getcpu();
+    return cpu >= 0 && cpu < TOPOLOGY_MAX_CPUS ? cpu_node[cpu] : 0;
+}
 
-// Ultra-minimal spinning wait - absolute minimum latency
-static int ultra_minimal_spin_wait(pthread_cond_t *cond, int *signal_consumed) {
-    ultra_spin_state_t *state = get_ultra_spin_state(cond);
+static void load_interpose_config(void);
+static void load_trace_config(void);
+static void ultra_stats_open(void);
+static void ultra_trace_open(void);
+static void ultra_spin_pool_refresh(void);
 
-    // Register as waiting (minimal overhead)
-    atomic_fetch_add_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELAXED);
+// Read tunables from the environment. Called once from the constructor.
+static void load_config(void) {
+    // LIBMY_PTHREAD_MODE=spin restores the pure spinning behaviour
+    const char *mode = getenv("LIBMY_PTHREAD_MODE");
+    if (mode != NULL && strcmp(mode, "spin") == 0) {
+        wait_mode = WAIT_MODE_SPIN;
+    }
 
-    //uint32_t spin_iterations = calculate_minimal_spin_iterations();
-    int got_signal = 0;
-    //volatile uint32_t *signal_ptr = &state->signal_count;
-    // ULTRA-TIGHT spinning loop - check EVERY iteration
-    //old
-    //for (uint32_t i = 0; i < cached_spin_iterations; i++) {
-    for (uint32_t i = cached_spin_iterations; i > 0; i--) {
-            if (ultra_fast_consume_signal(&state->signal_count)) {
-                    got_signal = 1;
-                    *signal_consumed = 1;
-                    break;
-            }
-            //_mm_monitor(signal_ptr, 0, 0);
-#if 0
-            if ((cached_spin_iterations & 32) == 0) {  // Faster than modulo
-                    // Check for signal EVERY iteration for absolute minimum latency
-                    if (ultra_fast_consume_signal(&state->signal_count)) {
-                            got_signal = 1;
-                            *signal_consumed = 1;
-                            break;
-                    }
-            }
-#endif
-            // Minimal pause - just compiler barrier on x86
-            minimal_pause();
+    adaptive_enabled = env_u64("LIBMY_PTHREAD_ADAPTIVE", 1) != 0;
+    queue_mode = env_u64("LIBMY_PTHREAD_QUEUE", 0) != 0;
+    handoff_mode = env_u64("LIBMY_PTHREAD_HANDOFF", 0) != 0;
+    mutex_mode = env_u64("LIBMY_PTHREAD_MUTEX", 1) != 0;
+    sem_mode = env_u64("LIBMY_PTHREAD_SEM", 1) != 0;
+    barrier_mode = env_u64("LIBMY_PTHREAD_BARRIER", 1) != 0;
+    if (handoff_mode) {
+        queue_mode = 1; // handoff needs a named waiter to hand to
+    }
+    uint64_t min_us = env_u64("LIBMY_PTHREAD_SPIN_MIN_US", ADAPTIVE_MIN_SPIN_US);
+    uint64_t max_us = env_u64("LIBMY_PTHREAD_SPIN_MAX_US", ADAPTIVE_MAX_SPIN_US);
+    if (max_us < min_us) {
+        max_us = min_us;
+    }
+    adaptive_min_ticks = ultra_us_to_ticks(min_us);
+    adaptive_max_ticks = ultra_us_to_ticks(max_us);
+    // spin_budget is a 32-bit tick count
+    if (adaptive_max_ticks > UINT32_MAX / 2) {
+        adaptive_max_ticks = UINT32_MAX / 2;
+    }
+    if (adaptive_min_ticks > adaptive_max_ticks) {
+        adaptive_min_ticks = adaptive_max_ticks;
     }
 
-    // Update statistics (minimal overhead)
-    atomic_fetch_sub_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELAXED);
-    if (got_signal) {
-        atomic_fetch_add_explicit(&state->successful_spins, 1, MEMORY_ORDER_RELAXED);
-    } else {
-        atomic_fetch_add_explicit(&state->failed_spins, 1, MEMORY_ORDER_RELAXED);
+    select_wait_strategy(getenv("LIBMY_PTHREAD_WAIT"));
+    load_topology();
+    load_interpose_config();
+    load_trace_config();
+    stats_enabled = env_u64("LIBMY_PTHREAD_STATS", 1) != 0;
+    const char *spinners = getenv("LIBMY_PTHREAD_SPINNERS");
+    if (spinners != NULL && *spinners != '\0' && strcmp(spinners, "auto") != 0) {
+        spinner_override = (int)env_u64("LIBMY_PTHREAD_SPINNERS", INT_MAX);
     }
+}
 
-    atomic_fetch_add(&state->total_spins, cached_spin_iterations);
+// Nonzero while this thread runs the library's own initialization. Anything
+// that allocates there (fopen, strdup, calloc, dlsym) comes back through the
+// interposed mutex when the allocator locks one - jemalloc, tcmalloc - and
+// those calls must go straight to glibc, not into half-built state or a wait
+// on the initialization this thread is itself running.
+static __thread int init_depth = 0;
 
-    //fprintf(stderr, "libmy_pthread: pure_spin_wait: tid: %ld, cond: %p, state->successful_spins: %ld, state->failed_spins: %ld, state->total_spins: %ld\n", pthread_self(), cond, state->successful_spins, state->failed_spins, state->total_spins);
+static void resolve_real_pthread(void);
 
-    return got_signal ? 0 : ETIMEDOUT;
+// Spin budget in ticks for TARGET_SPIN_TIME_US
+static uint64_t calculate_spin_ticks(void) {
+    static atomic_int time_source_ready = ATOMIC_VAR_INIT(0);
+    int expected = 0;
+
+    if (atomic_compare_exchange_strong(&time_source_ready, &expected, 1)) {
+        init_depth++;
+        resolve_real_pthread();
+        init_time_source();
+        load_config();
+        ultra_stats_open();
+        ultra_trace_open();
+        ultra_spin_pool_refresh();
+        init_depth--;
+        atomic_store(&time_source_ready, 2);
+    } else if (init_depth > 0 && atomic_load(&time_source_ready) != 2) {
+        // Re-entered from our own initialization: waiting would never end
+        return ultra_us_to_ticks(TARGET_SPIN_TIME_US);
+    }
+    while (atomic_load(&time_source_ready) != 2) {
+        sched_yield();
+    }
+
+    return ultra_us_to_ticks(TARGET_SPIN_TIME_US);
 }
 
-// Ultra-fast pthread_cond_wait
-int my_pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
-    // Release mutex
-    int unlock_result = pthread_mutex_unlock(mutex);
-    if (unlock_result != 0) {
-        return unlock_result;
+// ---------------------------------------------------------------------------
+// Event tracing (LIBMY_PTHREAD_TRACE).
+// Every thread appends fixed-size events (libmy_pthread_trace.h) to a ring
+// of its own: a clock read and a 32-byte store, published by one release
+// store of the head. The object and caller pc come from the entry point via
+// thread-locals, so the wait and signal paths only name the event.
+// The rings go to a file at exit and on LIBMY_PTHREAD_TRACE_SIGNAL. That
+// flush runs in a signal handler, so it sticks to open/read/write and copies
+// rings whose owners keep writing; the head re-read after each copy tells the
+// reader which events may have been overwritten meanwhile.
+// ---------------------------------------------------------------------------
+#define TRACE_DEFAULT_EVENTS 16384   // per thread, 512 KiB
+#define TRACE_MIN_EVENTS     256
+
+typedef struct ultra_trace_ring {
+    struct ultra_trace_ring *next;   // every ring ever made; rings are never freed
+    atomic_int tid;                  // owner, 0 = free for the next new thread
+    int last_tid;                    // reported for a free ring
+    atomic_ullong head;              // events written so far
+    char padding[40];
+    ultra_trace_event_t events[];
+} ultra_trace_ring_t;
+
+static int trace_enabled = 0;
+static uint32_t trace_capacity = TRACE_DEFAULT_EVENTS;  // power of two
+static int trace_signal = SIGUSR2;
+static char trace_dir[PATH_MAX - 64] = "/tmp";
+static _Atomic(ultra_trace_ring_t *) trace_rings = NULL;
+static atomic_flag trace_flushing = ATOMIC_FLAG_INIT;
+static atomic_uint trace_flush_seq = ATOMIC_VAR_INIT(0);
+static pthread_key_t trace_key;
+static __thread ultra_trace_ring_t *trace_ring = NULL;
+static __thread uintptr_t trace_object = 0;
+static __thread uintptr_t trace_pc = 0;
+
+// LIBMY_PTHREAD_TRACE=1 traces to /tmp, any other non-"0" value names the
+// directory; LIBMY_PTHREAD_TRACE_EVENTS sizes the rings and
+// LIBMY_PTHREAD_TRACE_SIGNAL picks the flush signal (0 = only at exit)
+static void load_trace_config(void) {
+    const char *dir = getenv("LIBMY_PTHREAD_TRACE");
+
+    if (dir == NULL || *dir == '\0' || strcmp(dir, "0") == 0) {
+        return;
+    }
+    if (strcmp(dir, "1") != 0) {
+        snprintf(trace_dir, sizeof(trace_dir), "%s", dir);
     }
+    uint64_t events = env_u64("LIBMY_PTHREAD_TRACE_EVENTS", TRACE_DEFAULT_EVENTS);
+    trace_capacity = TRACE_MIN_EVENTS;
+    while (trace_capacity < events && trace_capacity < (1U << 30)) {
+        trace_capacity <<= 1;
+    }
+    trace_signal = (int)env_u64("LIBMY_PTHREAD_TRACE_SIGNAL", SIGUSR2);
+    trace_enabled = 1;
+}
 
-    // Minimal memory barrier
-#if !defined(__x86_64__) && !defined(__i386__)
-    atomic_thread_fence(memory_order_release);
-#endif
+static void ultra_trace_ring_release(void *ring) {
+    atomic_store_explicit(&((ultra_trace_ring_t *)ring)->tid, 0, memory_order_release);
+}
 
-    int signal_consumed = 0;
-    ultra_minimal_spin_wait(cond, &signal_consumed);
-#if 0
-    if (!signal_consumed) {
-        // If we timed out (didn't get a signal), yield the CPU
-        // for better scheduling before attempting to re-lock.
-        sched_yield();
+// First event on this thread: adopt a ring left by an exited thread, or map a new one
+static ultra_trace_ring_t *ultra_trace_ring_claim(void) {
+    int tid = (int)syscall(SYS_gettid);
+    ultra_trace_ring_t *ring;
+
+    for (ring = atomic_load_explicit(&trace_rings, memory_order_acquire); ring != NULL; ring = ring->next) {
+        int expected = 0;
+        if (atomic_load_explicit(&ring->tid, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_strong_explicit(&ring->tid, &expected, tid,
+                                                    memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
     }
-#endif
+    if (ring == NULL) {
+        ring = mmap(NULL, sizeof(*ring) + (size_t)trace_capacity * sizeof(ultra_trace_event_t),
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) {
+            return NULL;
+        }
+        atomic_init(&ring->tid, tid);
+        atomic_init(&ring->head, 0);
+        ring->next = atomic_load_explicit(&trace_rings, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&trace_rings, &ring->next, ring,
+                                                      memory_order_release, memory_order_relaxed)) {
+        }
+    }
+    ring->last_tid = tid;
+    pthread_setspecific(trace_key, ring);
+    return ring;
+}
 
-    // Minimal memory barrier
-#if !defined(__x86_64__) && !defined(__i386__)
-    atomic_thread_fence(memory_order_acquire);
-#endif
+static void ultra_trace_append(ultra_trace_ring_t *ring, int type, uint32_t arg) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ultra_trace_event_t *event = &ring->events[head & (trace_capacity - 1)];
 
-    // Reacquire mutex
-    pthread_mutex_lock(mutex);
+    event->ticks = ultra_now_ticks();
+    event->object = trace_object;
+    event->pc = trace_pc;
+    event->arg = arg;
+    event->type = (uint16_t)type;
+    event->reserved = 0;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
 
-    // Always return 0 for POSIX compliance
+__attribute__((noinline))
+static void ultra_trace_emit(int type, uint32_t arg) {
+    if (__builtin_expect(trace_ring == NULL, 0)) {
+        trace_ring = ultra_trace_ring_claim();
+        if (trace_ring == NULL) {
+            return;
+        }
+        ultra_trace_append(trace_ring, TRACE_THREAD, (uint32_t)trace_ring->last_tid);
+    }
+    ultra_trace_append(trace_ring, type, arg);
+}
+
+// Entry points name the object and call site the next events belong to
+static inline void ultra_trace_enter(const void *object, const void *pc) {
+    if (__builtin_expect(trace_enabled, 0)) {
+        trace_object = (uintptr_t)object;
+        trace_pc = (uintptr_t)pc;
+    }
+}
+
+static inline void ultra_trace_event(int type, uint64_t arg) {
+    if (__builtin_expect(trace_enabled, 0)) {
+        ultra_trace_emit(type, arg > UINT32_MAX ? UINT32_MAX : (uint32_t)arg);
+    }
+}
+
+static int trace_write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
     return 0;
 }
 
-// Ultra-fast pthread_cond_timedwait
-int my_pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime) {
-    struct timespec start_time;
-    if (clock_gettime(CLOCK_REALTIME, &start_time) != 0) {
-        return errno;
+// snprintf is not async-signal-safe
+static char *trace_put_uint(char *p, unsigned long value) {
+    char digits[24];
+    int n = 0;
+
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        *p++ = digits[--n];
     }
+    return p;
+}
 
-    // Check if already timed out
-    if (start_time.tv_sec > abstime->tv_sec ||
-        (start_time.tv_sec == abstime->tv_sec && start_time.tv_nsec >= abstime->tv_nsec)) {
-        return ETIMEDOUT;
+// Write every ring to <trace_dir>/libmy_pthread.<pid>.<n>.trace.
+// Async-signal-safe; a flush that finds another one running gives up.
+static void ultra_trace_flush(void) {
+    if (!trace_enabled || atomic_flag_test_and_set_explicit(&trace_flushing, memory_order_acquire)) {
+        return;
     }
 
-    // Release mutex
-    int unlock_result = pthread_mutex_unlock(mutex);
-    if (unlock_result != 0) {
-        return unlock_result;
+    char path[PATH_MAX];
+    size_t dir_len = strlen(trace_dir);
+    memcpy(path, trace_dir, dir_len);
+    char *p = path + dir_len;
+    *p++ = '/';
+    memcpy(p, TRACE_FILE_NAME, sizeof(TRACE_FILE_NAME) - 1);
+    p += sizeof(TRACE_FILE_NAME) - 1;
+    p = trace_put_uint(p, (unsigned long)getpid());
+    *p++ = '.';
+    p = trace_put_uint(p, atomic_fetch_add_explicit(&trace_flush_seq, 1, memory_order_relaxed));
+    memcpy(p, ".trace", sizeof(".trace"));
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        atomic_flag_clear_explicit(&trace_flushing, memory_order_release);
+        return;
     }
 
-#if !defined(__x86_64__) && !defined(__i386__)
-    atomic_thread_fence(memory_order_release);
-#endif
+    ultra_trace_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.pid = (int32_t)getpid();
+    header.ticks_per_sec = ticks_per_sec;
+    header.flush_ticks = ultra_now_ticks();
+    strncpy(header.time_source, time_source_name(), sizeof(header.time_source) - 1);
+    int failed = trace_write_all(fd, &header, sizeof(header));
+    off_t offset = sizeof(header);
 
-    // Calculate timeout in microseconds for faster comparison
-    long long timeout_us = ((long long)(abstime->tv_sec - start_time.tv_sec)) * 1000000LL +
-                          ((abstime->tv_nsec - start_time.tv_nsec) / 1000);
+    // The mappings let the converter turn pcs into object+offset
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps >= 0) {
+        char chunk[4096];
+        ssize_t n;
+        while (!failed && ((n = read(maps, chunk, sizeof(chunk))) > 0 || (n < 0 && errno == EINTR))) {
+            if (n < 0) {
+                continue;
+            }
+            ultra_trace_record_t rec = { TRACE_REC_MAPS, 0, (uint64_t)n };
+            failed = trace_write_all(fd, &rec, sizeof(rec)) || trace_write_all(fd, chunk, (size_t)n);
+            offset += (off_t)(sizeof(rec) + (size_t)n);
+        }
+        close(maps);
+    }
 
-    // Spin with timeout checking
-    while (timeout_us > 0) {
-        int signal_consumed = 0;
-        if (ultra_minimal_spin_wait(cond, &signal_consumed) == 0 && signal_consumed) {
-#if !defined(__x86_64__) && !defined(__i386__)
-            atomic_thread_fence(memory_order_acquire);
-#endif
-            pthread_mutex_lock(mutex);
-            return 0;
+    for (ultra_trace_ring_t *ring = atomic_load_explicit(&trace_rings, memory_order_acquire);
+         ring != NULL && !failed; ring = ring->next) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t first = head > trace_capacity ? head - trace_capacity : 0;
+        int tid = atomic_load_explicit(&ring->tid, memory_order_relaxed);
+        ultra_trace_ring_hdr_t ring_hdr = { tid != 0 ? tid : ring->last_tid, trace_capacity,
+                                            first, head - first, first };
+        ultra_trace_record_t rec = { TRACE_REC_RING, 0, sizeof(ring_hdr) + (head - first) * sizeof(ultra_trace_event_t) };
+        off_t hdr_offset = offset + (off_t)sizeof(rec);
+
+        failed = trace_write_all(fd, &rec, sizeof(rec)) || trace_write_all(fd, &ring_hdr, sizeof(ring_hdr));
+        // Oldest first: the part after the wrap point, then the part before it
+        uint32_t start = (uint32_t)(first & (trace_capacity - 1));
+        uint64_t tail = trace_capacity - start < head - first ? trace_capacity - start : head - first;
+        if (!failed) {
+            failed = trace_write_all(fd, &ring->events[start], tail * sizeof(ultra_trace_event_t)) ||
+                     trace_write_all(fd, &ring->events[0], (head - first - tail) * sizeof(ultra_trace_event_t));
         }
+        offset += (off_t)(sizeof(rec) + rec.bytes);
 
-        // Quick timeout check (every 10μs)
-        timeout_us -= TARGET_SPIN_TIME_US;
+        // The owner may have lapped part of what we copied; the slot it is
+        // filling right now belongs to index head_now - capacity
+        uint64_t head_now = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head_now + 1 > first + trace_capacity) {
+            ring_hdr.valid_from = head_now + 1 - trace_capacity;
+            if (!failed && pwrite(fd, &ring_hdr.valid_from, sizeof(ring_hdr.valid_from),
+                                  hdr_offset + (off_t)offsetof(ultra_trace_ring_hdr_t, valid_from)) < 0) {
+                failed = 1;
+            }
+        }
     }
+    close(fd);
+    atomic_flag_clear_explicit(&trace_flushing, memory_order_release);
+}
 
-#if !defined(__x86_64__) && !defined(__i386__)
-    atomic_thread_fence(memory_order_acquire);
-#endif
-    pthread_mutex_lock(mutex);
-    return ETIMEDOUT;
+static void ultra_trace_on_signal(int sig) {
+    int saved_errno = errno;
+
+    (void)sig;
+    ultra_trace_flush();
+    errno = saved_errno;
 }
 
-// Ultra-fast pthread_cond_broadcast
-int my_pthread_cond_broadcast(pthread_cond_t *cond) {
-    ultra_spin_state_t *state = get_ultra_spin_state(cond);
-    // Add MAX_SIGNAL_COUNT to ensure all waiters are woken.
-    atomic_fetch_add_explicit(&state->signal_count, MAX_SIGNAL_COUNT, MEMORY_ORDER_RELEASE);
-    return 0;
+// A forked child starts with empty rings, all free except its own
+static void ultra_trace_atfork_child(void) {
+    for (ultra_trace_ring_t *ring = atomic_load_explicit(&trace_rings, memory_order_relaxed);
+         ring != NULL; ring = ring->next) {
+        atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+        if (ring != trace_ring) {
+            atomic_store_explicit(&ring->tid, 0, memory_order_relaxed);
+        }
+    }
+    if (trace_ring != NULL) {
+        trace_ring->last_tid = (int)syscall(SYS_gettid);
+        atomic_store_explicit(&trace_ring->tid, trace_ring->last_tid, memory_order_relaxed);
+        ultra_trace_append(trace_ring, TRACE_THREAD, (uint32_t)trace_ring->last_tid);
+    }
+    atomic_store_explicit(&trace_flush_seq, 0, memory_order_relaxed);
 }
 
-// Ultra-fast pthread_cond_signal
-int my_pthread_cond_signal(pthread_cond_t *cond) {
-    ultra_spin_state_t *state = get_ultra_spin_state(cond);
-    // Just add one signal, regardless of the waiter count.
-    atomic_fetch_add_explicit(&state->signal_count, 1, MEMORY_ORDER_RELEASE);
-    return 0;
+// Leaves a flush signal the application already handles alone
+static void ultra_trace_open(void) {
+    if (!trace_enabled) {
+        return;
+    }
+    if (pthread_key_create(&trace_key, ultra_trace_ring_release) != 0) {
+        trace_enabled = 0;
+        return;
+    }
+    pthread_atfork(NULL, NULL, ultra_trace_atfork_child);
+    if (trace_signal > 0) {
+        struct sigaction old;
+        if (sigaction(trace_signal, NULL, &old) == 0 && old.sa_handler == SIG_DFL) {
+            struct sigaction sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = ultra_trace_on_signal;
+            sa.sa_flags = SA_RESTART;
+            sigemptyset(&sa.sa_mask);
+            sigaction(trace_signal, &sa, NULL);
+        } else {
+            trace_signal = 0;
+        }
+    }
 }
 
-// Library constructor
-__attribute__((constructor))
-static void library_init(void) {
-    openlog("libmy_pthread", LOG_PID, LOG_USER);
+// ---------------------------------------------------------------------------
+// Live statistics.
+// Counters go to a segment in /dev/shm (layout in libmy_pthread_stats.h) so
+// libmy_pthread_stat can watch a running process. Process-wide counters and
+// histograms are sharded per thread. Each condvar also gets a slot of its
+// own, but every waiter and signaller of it writing there would bounce the
+// line between them, so threads collect per-condvar deltas locally and fold
+// them into the slot every STATS_FOLD_US, on eviction, on destroy and at
+// thread exit. Without /dev/shm the same layout lives in anonymous memory;
+// with LIBMY_PTHREAD_STATS=0 no counter is touched at all. The spin, park,
+// wait and signal counters double as the trace points.
+// ---------------------------------------------------------------------------
+static ultra_stats_region_t *stats_region = NULL;
+static char stats_shm_name[32];
+static __thread int stats_shard = -1;
 
-    uint64_t cpu_freq = get_cpu_frequency_fast();
-    cached_spin_iterations = calculate_minimal_spin_iterations();
+static int stats_shm_fd = -1;   // holds the segment's flock while we live
 
-    syslog(LOG_INFO, "libmy_pthread: ULTRA HIGH PERFORMANCE library loaded");
-    syslog(LOG_INFO, "libmy_pthread: CPU frequency: %.2f GHz", cpu_freq / 1000000000.0);
-    syslog(LOG_INFO, "libmy_pthread: Spin iterations: %u (target: %dμs)", cached_spin_iterations, TARGET_SPIN_TIME_US);
-    syslog(LOG_INFO, "libmy_pthread: Check frequency: EVERY iteration (minimum latency)");
+// Open our segment, locked for the lifetime of the process. A segment of the
+// same name may be left over from a dead process, or belong to a live one in
+// another PID namespace sharing /dev/shm: the lock tells them apart.
+static int ultra_stats_shm_open(const char *name) {
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0 && errno == EEXIST) {
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || ftruncate(fd, 0) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static ultra_stats_region_t *ultra_stats_map(pid_t pid) {
+    ultra_stats_region_t *region = MAP_FAILED;
+
+    stats_shm_name[0] = '\0';
+    if (stats_enabled) {
+        char name[sizeof(stats_shm_name)];
+        snprintf(name, sizeof(name), STATS_SHM_NAME, (int)pid);
+        int fd = ultra_stats_shm_open(name);
+        if (fd >= 0) {
+            if (ftruncate(fd, sizeof(*region)) == 0) {
+                region = mmap(NULL, sizeof(*region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            if (region != MAP_FAILED) {
+                strcpy(stats_shm_name, name);
+                stats_shm_fd = fd;
+            } else {
+                shm_unlink(name);
+                close(fd);
+            }
+        }
+    }
+    if (region == MAP_FAILED) {
+        region = mmap(NULL, sizeof(*region), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            abort(); // every counter update assumes the region exists
+        }
+    }
+    return region;
+}
+
+static void ultra_stats_fill_header(ultra_stats_region_t *region, pid_t pid) {
+    region->version = STATS_VERSION;
+    region->pid = (int32_t)pid;
+    region->ticks_per_sec = ticks_per_sec;
+    snprintf(region->time_source, sizeof(region->time_source), "%s", time_source_name());
+    // Readers check the magic last
+    atomic_thread_fence(memory_order_release);
+    region->magic = STATS_MAGIC;
+}
+
+static void ultra_spin_pool_atfork_child(void);
+
+// A forked child gets its own segment, starting from the parent's counters
+static void ultra_stats_atfork_child(void) {
+    ultra_stats_region_t *parent = stats_region;
+
+    // The parent still holds the lock through its own descriptor
+    if (stats_shm_fd >= 0) {
+        close(stats_shm_fd);
+        stats_shm_fd = -1;
+    }
+    ultra_stats_region_t *region = ultra_stats_map(getpid());
+
+    memcpy(region, parent, sizeof(*region));
+    ultra_stats_fill_header(region, getpid());
+    stats_region = region;
+    munmap(parent, sizeof(*parent));
+    ultra_spin_pool_atfork_child();
+}
+
+// Remove segments left behind by processes that died without unloading us
+// (killed, _exit, exec). A live owner holds the segment's flock, whatever
+// PID namespace it runs in; only our own segments that carry the header of
+// the pid in their name are candidates.
+static void ultra_stats_reap(void) {
+    DIR *dir = opendir("/dev/shm");
+    struct dirent *entry;
+
+    if (dir == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        int pid;
+        char name[sizeof(stats_shm_name) + 1];
+        if (sscanf(entry->d_name, STATS_SHM_NAME + 1, &pid) != 1) {
+            continue;
+        }
+        snprintf(name, sizeof(name), STATS_SHM_NAME, pid);
+        if (strcmp(name + 1, entry->d_name) != 0) {
+            continue;
+        }
+        int fd = shm_open(name, O_RDONLY | O_NOFOLLOW, 0);
+        if (fd < 0) {
+            continue;
+        }
+        struct stat st;
+        uint64_t magic = 0;
+        int32_t owner = 0;
+        if (fstat(fd, &st) == 0 && st.st_uid == geteuid() &&
+            pread(fd, &magic, sizeof(magic), offsetof(ultra_stats_region_t, magic)) == sizeof(magic) &&
+            pread(fd, &owner, sizeof(owner), offsetof(ultra_stats_region_t, pid)) == sizeof(owner) &&
+            magic == STATS_MAGIC && owner == pid && flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            shm_unlink(name);
+        }
+        close(fd);
+    }
+    closedir(dir);
+}
+
+static pthread_key_t stats_fold_key;
+static void ultra_stats_thread_exit(void *arg);
+
+static void ultra_stats_open(void) {
+    if (stats_enabled) {
+        ultra_stats_reap();
+    }
+    stats_region = ultra_stats_map(getpid());
+    strcpy(stats_region->conds[0].label, "(condvars beyond the slot table)");
+    ultra_stats_fill_header(stats_region, getpid());
+    pthread_key_create(&stats_fold_key, ultra_stats_thread_exit);
+    pthread_atfork(NULL, NULL, ultra_stats_atfork_child);
+}
+
+static void ultra_stats_close(void) {
+    if (stats_shm_name[0] != '\0') {
+        shm_unlink(stats_shm_name);
+    }
+}
+
+static inline ultra_stats_shard_t *ultra_stats_shard(void) {
+    if (__builtin_expect(stats_shard < 0, 0)) {
+        stats_shard = (int)(atomic_fetch_add_explicit(&stats_region->next_shard, 1, memory_order_relaxed) %
+                            STATS_MAX_SHARDS);
+    }
+    return &stats_region->shards[stats_shard];
+}
+
+static inline void stats_add(atomic_ullong *counter, unsigned long long n) {
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static inline int stats_bucket(uint64_t ticks) {
+    int bucket = 63 - __builtin_clzll(ticks | 1);
+    return bucket < STATS_HIST_BUCKETS ? bucket : STATS_HIST_BUCKETS - 1;
+}
+
+// Claim a per-condvar slot, falling back to the shared overflow slot 0.
+// Caller holds registry_lock.
+static uint32_t ultra_stats_claim(pthread_cond_t *cond, const void *site) {
+    static uint32_t hint = 1;
+
+    for (uint32_t n = 1; n < STATS_MAX_CONDVARS; n++) {
+        uint32_t i = hint;
+        hint = hint + 1 < STATS_MAX_CONDVARS ? hint + 1 : 1;
+        ultra_stats_cond_t *slot = &stats_region->conds[i];
+        if (atomic_load_explicit(&slot->cond, memory_order_relaxed) != 0) {
+            continue;
+        }
+        atomic_store_explicit(&slot->waits, 0, memory_order_relaxed);
+        atomic_store_explicit(&slot->spin_hits, 0, memory_order_relaxed);
+        atomic_store_explicit(&slot->spin_misses, 0, memory_order_relaxed);
+        atomic_store_explicit(&slot->parks, 0, memory_order_relaxed);
+        atomic_store_explicit(&slot->signals, 0, memory_order_relaxed);
+        atomic_store_explicit(&slot->empty_signals, 0, memory_order_relaxed);
+        atomic_store_explicit(&slot->spin_ticks, 0, memory_order_relaxed);
+        Dl_info info;
+        if (site == NULL || !dladdr(site, &info) || info.dli_fname == NULL) {
+            snprintf(slot->label, sizeof(slot->label), "%p", site);
+        } else if (info.dli_sname != NULL) {
+            snprintf(slot->label, sizeof(slot->label), "%s", info.dli_sname);
+        } else {
+            const char *base = strrchr(info.dli_fname, '/');
+            snprintf(slot->label, sizeof(slot->label), "%s+0x%lx", base != NULL ? base + 1 : info.dli_fname,
+                     (unsigned long)((uintptr_t)site - (uintptr_t)info.dli_fbase));
+        }
+        atomic_store_explicit(&slot->cond, (uintptr_t)cond, memory_order_release);
+        return i;
+    }
+    atomic_fetch_add_explicit(&stats_region->overflow_condvars, 1, memory_order_relaxed);
+    return 0;
+}
+
+// Index for waits that only go into the thread's shard, see ultra_stats_episode()
+#define STATS_SLOT_NONE UINT32_MAX
+
+// Per-condvar deltas of one thread, direct-mapped by slot index
+#define STATS_DELTA_SLOTS 16
+#define STATS_FOLD_US     10000
+
+typedef struct {
+    uint32_t index;                // STATS_SLOT_NONE = empty
+    uintptr_t cond;                // slot owner when the deltas were taken
+    uint64_t waits;
+    uint64_t spin_hits;
+    uint64_t spin_misses;
+    uint64_t parks;
+    uint64_t signals;
+    uint64_t empty_signals;
+    uint64_t spin_ticks;
+} ultra_stats_delta_t;
+
+static __thread ultra_stats_delta_t stats_delta[STATS_DELTA_SLOTS];
+static __thread uint64_t stats_fold_at = 0;
+
+// Add one thread's deltas to the shared slot. Deltas taken while the slot
+// belonged to a condvar since destroyed are dropped.
+static void ultra_stats_fold(ultra_stats_delta_t *d) {
+    if (d->index == STATS_SLOT_NONE) {
+        return;
+    }
+    ultra_stats_cond_t *slot = &stats_region->conds[d->index];
+    if (atomic_load_explicit(&slot->cond, memory_order_relaxed) == d->cond) {
+        if (d->waits != 0) {
+            stats_add(&slot->waits, d->waits);
+        }
+        if (d->spin_hits != 0) {
+            stats_add(&slot->spin_hits, d->spin_hits);
+        }
+        if (d->spin_misses != 0) {
+            stats_add(&slot->spin_misses, d->spin_misses);
+        }
+        if (d->parks != 0) {
+            stats_add(&slot->parks, d->parks);
+        }
+        if (d->signals != 0) {
+            stats_add(&slot->signals, d->signals);
+        }
+        if (d->empty_signals != 0) {
+            stats_add(&slot->empty_signals, d->empty_signals);
+        }
+        if (d->spin_ticks != 0) {
+            stats_add(&slot->spin_ticks, d->spin_ticks);
+        }
+    }
+    memset(d, 0, sizeof(*d));
+    d->index = STATS_SLOT_NONE;
+}
+
+static void ultra_stats_fold_all(void) {
+    for (int i = 0; i < STATS_DELTA_SLOTS; i++) {
+        ultra_stats_fold(&stats_delta[i]);
+    }
+}
+
+static void ultra_stats_thread_exit(void *arg) {
+    (void)arg;
+    ultra_stats_fold_all();
+}
+
+// This thread's deltas for slot index; folds the whole set when it is due
+static ultra_stats_delta_t *ultra_stats_delta(uint32_t index) {
+    ultra_stats_delta_t *d = &stats_delta[index & (STATS_DELTA_SLOTS - 1)];
+    uint64_t now = ultra_now_ticks();
+
+    if (__builtin_expect(stats_fold_at == 0, 0)) {
+        for (int i = 0; i < STATS_DELTA_SLOTS; i++) {
+            stats_delta[i].index = STATS_SLOT_NONE;
+        }
+        pthread_setspecific(stats_fold_key, stats_delta);
+        stats_fold_at = now + ultra_us_to_ticks(STATS_FOLD_US);
+    } else if (__builtin_expect(now >= stats_fold_at, 0)) {
+        ultra_stats_fold_all();
+        stats_fold_at = now + ultra_us_to_ticks(STATS_FOLD_US);
+    }
+    if (d->index != index) {
+        ultra_stats_fold(d);
+        d->index = index;
+        d->cond = atomic_load_explicit(&stats_region->conds[index].cond, memory_order_relaxed);
+    }
+    return d;
+}
+
+static void ultra_stats_release(uint32_t index) {
+    if (index != 0) {
+        if (stats_enabled) {
+            ultra_stats_fold(&stats_delta[index & (STATS_DELTA_SLOTS - 1)]);
+        }
+        atomic_store_explicit(&stats_region->conds[index].cond, 0, memory_order_release);
+    }
+}
+
+// End of one spin phase
+static inline void ultra_stats_spin(uint32_t index, int hit, uint64_t ticks, long iterations) {
+    if (stats_enabled) {
+        ultra_stats_shard_t *shard = ultra_stats_shard();
+        stats_add(hit ? &shard->spin_hits : &shard->spin_misses, 1);
+        stats_add(&shard->spin_ticks, ticks);
+        stats_add(&shard->spin_iterations, (unsigned long long)iterations);
+        stats_add(&shard->spin_hist[stats_bucket(ticks)], 1);
+        if (index != STATS_SLOT_NONE) {
+            ultra_stats_delta_t *d = ultra_stats_delta(index);
+            (*(hit ? &d->spin_hits : &d->spin_misses))++;
+            d->spin_ticks += ticks;
+        }
+    }
+    ultra_trace_event(hit ? TRACE_SPIN_HIT : TRACE_SPIN_MISS, ticks);
+}
+
+static inline void ultra_stats_park(uint32_t index) {
+    if (stats_enabled) {
+        stats_add(&ultra_stats_shard()->parks, 1);
+        if (index != STATS_SLOT_NONE) {
+            ultra_stats_delta(index)->parks++;
+        }
+    }
+    ultra_trace_event(TRACE_PARK, 0);
+}
+
+// End of one wait call; waited is only meaningful when woken
+static inline void ultra_stats_wait(uint32_t index, int woken, uint64_t waited) {
+    if (stats_enabled) {
+        ultra_stats_shard_t *shard = ultra_stats_shard();
+        stats_add(&shard->waits, 1);
+        if (woken) {
+            stats_add(&shard->wake_hist[stats_bucket(waited)], 1);
+        } else {
+            stats_add(&shard->timeouts, 1);
+        }
+        if (index != STATS_SLOT_NONE) {
+            ultra_stats_delta(index)->waits++;
+        }
+    }
+    ultra_trace_event(TRACE_WAKE, woken);
+}
+
+// A spin phase skipped because the spinner pool was exhausted
+static inline void ultra_stats_spin_denied(void) {
+    if (stats_enabled) {
+        stats_add(&ultra_stats_shard()->spin_denied, 1);
+    }
+}
+
+static inline void ultra_stats_topology(int relation) {
+    if (stats_enabled && relation != CPU_REL_UNKNOWN) {
+        stats_add(&ultra_stats_shard()->topology_waits[relation - 1], 1);
+    }
+}
+
+static inline void ultra_stats_signal(uint32_t index, int broadcast, int empty) {
+    if (stats_enabled) {
+        ultra_stats_shard_t *shard = ultra_stats_shard();
+        ultra_stats_delta_t *d = ultra_stats_delta(index);
+        stats_add(broadcast ? &shard->broadcasts : &shard->signals, 1);
+        d->signals++;
+        if (empty) {
+            stats_add(&shard->empty_signals, 1);
+            d->empty_signals++;
+        }
+    }
+    ultra_trace_event(broadcast ? TRACE_BROADCAST : TRACE_SIGNAL, !empty);
+}
+
+// One barrier episode, counted once by the thread that completed it. The
+// waiters record into their shards only (STATS_SLOT_NONE), so the episode
+// carries their waits into the barrier's slot.
+static inline void ultra_stats_episode(uint32_t index, uint32_t waiters) {
+    if (stats_enabled) {
+        ultra_stats_delta(index)->waits += waiters;
+    }
+    ultra_stats_signal(index, 1, waiters == 0);
+}
+
+
+// ---------------------------------------------------------------------------
+// Spinner admission.
+// Spinning only pays while a CPU is free to run the thread that will wake
+// the spinner; with more spinners than CPUs they preempt their own wakers.
+// Every spin phase (condvar waits and mutex acquisition alike) therefore
+// takes a token from one process-wide pool, and a waiter that finds the
+// pool empty parks right away. The pool holds one token per CPU the process
+// may use - its affinity mask, capped by the cgroup CPU quota - minus one
+// kept for the waker, and is re-sized every SPIN_POOL_REFRESH_MS so taskset
+// and quota changes take effect. The re-size reads /proc and cgroupfs, so
+// it is done by a thread on its way to park, never by one about to spin.
+// LIBMY_PTHREAD_SPINNERS=N pins the size; pure spin mode has nowhere to park
+// and is not limited.
+// ---------------------------------------------------------------------------
+#define SPIN_POOL_REFRESH_MS 1000
+
+static struct {
+    atomic_int active;             // spin phases in progress
+    atomic_int limit;              // tokens
+    atomic_ullong refresh_at;      // tick count of the next re-size
+} __attribute__((aligned(64))) spin_pool = { 0, INT_MAX, 0 };
+
+// cpu.max (v2) or cpu.cfs_quota_us/cpu.cfs_period_us (v1) of one cgroup
+// directory, rounded up to whole CPUs; 0 = no quota
+static int cgroup_dir_quota(const char *dir) {
+    char path[PATH_MAX], quota[32] = "max";
+    unsigned long long period = 0, cfs_quota = 0;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/cpu.max", dir);
+    if ((f = fopen(path, "r")) != NULL) {
+        int n = fscanf(f, "%31s %llu", quota, &period);
+        fclose(f);
+        if (n != 2 || strcmp(quota, "max") == 0 || period == 0) {
+            return 0;
+        }
+        cfs_quota = strtoull(quota, NULL, 10);
+    } else {
+        snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", dir);
+        if ((f = fopen(path, "r")) == NULL) {
+            return 0;
+        }
+        long long v1_quota = -1;
+        int n = fscanf(f, "%lld", &v1_quota);
+        fclose(f);
+        snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", dir);
+        if (n != 1 || v1_quota <= 0 || (f = fopen(path, "r")) == NULL) {
+            return 0;
+        }
+        n = fscanf(f, "%llu", &period);
+        fclose(f);
+        if (n != 1 || period == 0) {
+            return 0;
+        }
+        cfs_quota = (unsigned long long)v1_quota;
+    }
+    unsigned long long cpus = (cfs_quota + period - 1) / period;
+    return cpus > INT_MAX ? INT_MAX : (int)(cpus != 0 ? cpus : 1);
+}
+
+// Tightest CPU quota on our cgroup's path to the root (limits nest); 0 = none
+static int cgroup_cpu_quota(void) {
+    char line[PATH_MAX], dir[PATH_MAX - 32];
+    const char *base = NULL;
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    int best = 0;
+
+    if (f == NULL) {
+        return 0;
+    }
+    // "0::/path" on the v2 unified hierarchy, "N:cpu,cpuacct:/path" on v1
+    int unified = access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0;
+    while (base == NULL && fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        char *controllers = strchr(line, ':');
+        char *cgroup = controllers != NULL ? strchr(controllers + 1, ':') : NULL;
+        if (cgroup == NULL) {
+            continue;
+        }
+        *cgroup++ = '\0';
+        controllers++;
+        if (unified && *controllers == '\0') {
+            base = "/sys/fs/cgroup";
+        } else if (!unified && (strcmp(controllers, "cpu") == 0 || strcmp(controllers, "cpu,cpuacct") == 0 ||
+                                strcmp(controllers, "cpuacct,cpu") == 0)) {
+            base = access("/sys/fs/cgroup/cpu", F_OK) == 0 ? "/sys/fs/cgroup/cpu" : "/sys/fs/cgroup/cpu,cpuacct";
+        } else {
+            continue;
+        }
+        snprintf(dir, sizeof(dir), "%s%s", base, strcmp(cgroup, "/") == 0 ? "" : cgroup);
+    }
+    fclose(f);
+    if (base == NULL) {
+        return 0;
+    }
+    // Walk up to the mount point; each level may carry its own limit
+    size_t root_len = strlen(base);
+    for (;;) {
+        int quota = cgroup_dir_quota(dir);
+        if (quota != 0 && (best == 0 || quota < best)) {
+            best = quota;
+        }
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL || (size_t)(slash - dir) < root_len) {
+            break;
+        }
+        *slash = '\0';
+    }
+    return best;
+}
+
+// CPUs the process may run on: the union of its threads' affinity masks.
+// sched_getaffinity(0) is the calling thread's mask alone, and one pinned
+// thread would size the pool for all of them.
+static int process_cpu_count(void) {
+    int online = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    DIR *dir = opendir("/proc/self/task");
+    cpu_set_t all, set;
+    struct dirent *entry;
+
+    CPU_ZERO(&all);
+    if (dir != NULL) {
+        while ((entry = readdir(dir)) != NULL && CPU_COUNT(&all) < online) {
+            pid_t tid = (pid_t)strtol(entry->d_name, NULL, 10);
+            if (tid > 0 && sched_getaffinity(tid, sizeof(set), &set) == 0) {
+                CPU_OR(&all, &all, &set);
+            }
+        }
+        closedir(dir);
+    }
+    if (CPU_COUNT(&all) == 0 && sched_getaffinity(getpid(), sizeof(all), &all) != 0) {
+        return online;
+    }
+    return CPU_COUNT(&all);
+}
+
+// Re-size the pool from the current affinity masks and quota
+static void ultra_spin_pool_refresh(void) {
+    int limit, cpus = 0, quota = 0;
+
+    if (wait_mode != WAIT_MODE_HYBRID) {
+        limit = INT_MAX;
+    } else if (spinner_override >= 0) {
+        limit = spinner_override;
+    } else {
+        cpus = process_cpu_count();
+        quota = cgroup_cpu_quota();
+        int usable = quota != 0 && quota < cpus ? quota : cpus;
+        limit = usable > 1 ? usable - 1 : 0;
+    }
+    atomic_store_explicit(&spin_pool.limit, limit, memory_order_relaxed);
+    atomic_store_explicit(&spin_pool.refresh_at,
+                          ultra_now_ticks() + ultra_us_to_ticks(SPIN_POOL_REFRESH_MS * 1000ULL),
+                          memory_order_relaxed);
+    stats_region->spinner_limit = limit == INT_MAX ? -1 : limit;
+    stats_region->spinner_cpus = cpus;
+    stats_region->spinner_quota = quota;
+}
+
+// The forking thread was not spinning, and nobody else came along
+static void ultra_spin_pool_atfork_child(void) {
+    atomic_store_explicit(&spin_pool.active, 0, memory_order_relaxed);
+}
+
+// Called on the way to park: the re-size costs this thread nothing it was
+// not about to give up anyway
+static inline void ultra_spin_pool_check(void) {
+    uint64_t due = atomic_load_explicit(&spin_pool.refresh_at, memory_order_relaxed);
+    if (__builtin_expect(ultra_now_ticks() >= due, 0) &&
+        atomic_compare_exchange_strong_explicit(&spin_pool.refresh_at, &due, UINT64_MAX,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        ultra_spin_pool_refresh();
+    }
+}
+
+// Take a spin token. 0 = pool exhausted, park instead of spinning.
+static inline int ultra_spin_admit(void) {
+    int active = atomic_load_explicit(&spin_pool.active, memory_order_relaxed);
+    do {
+        if (active >= atomic_load_explicit(&spin_pool.limit, memory_order_relaxed)) {
+            ultra_stats_spin_denied();
+            return 0;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&spin_pool.active, &active, active + 1,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    return 1;
+}
+
+static inline void ultra_spin_retire(void) {
+    atomic_fetch_sub_explicit(&spin_pool.active, 1, memory_order_relaxed);
+}
+
+// Admission without a token, for barrier waiters: up to count - 1 of them
+// spin at once, and taking and returning tokens would put every one of them
+// on the pool's line twice an episode. Instead they spin only while all of
+// them fit in the pool next to the spinners holding tokens.
+static inline int ultra_spin_room(uint32_t spinners) {
+    if ((int64_t)atomic_load_explicit(&spin_pool.active, memory_order_relaxed) + spinners >
+        atomic_load_explicit(&spin_pool.limit, memory_order_relaxed)) {
+        ultra_stats_spin_denied();
+        return 0;
+    }
+    return 1;
+}
+
+
+// Ultra-minimal spinning state - optimized for cache efficiency
+// One state per live condvar, owned by the registry below. The first cache
+// line holds what signallers and waiters synchronize on; the second holds
+// per-waiter bookkeeping so those writes don't bounce the hot line.
+//
+// wait_word packs the wake protocol into one CAS-able word; the protocol
+// itself (WW_*, ultra_core_ww_*) is in libmy_pthread_core.h.
+
+// Intrusive queue link; first member of every queued waiter node
+typedef struct ultra_qlink {
+    _Atomic(struct ultra_qlink *) next;
+} ultra_qlink_t;
+
+typedef struct {
+    // Line 0: wake protocol
+    atomic_ullong wait_word;      // 8 bytes - see above
+    atomic_uint futex_seq;        // 4 bytes - futex word, bumped on every wake
+    atomic_int parked_waiters;    // 4 bytes - waiters blocked in FUTEX_WAIT
+    atomic_int waiting_threads;   // 4 bytes - threads inside a wait call
+    atomic_uint generation;       // 4 bytes - bumped on every init/destroy
+    _Atomic(pthread_cond_t *) owner; // 8 bytes - condvar this state serves
+    // Per-waiter queue (queue mode only)
+    _Atomic(ultra_qlink_t *) q_tail; // 8 bytes - producers (waiters) swap themselves in here
+    _Atomic(ultra_qlink_t *) q_head; // 8 bytes - consumer (signaller) side, under q_lock
+    ultra_qlink_t q_stub;         // 8 bytes - queue stub node
+    atomic_uint q_lock;           // 4 bytes - serializes signallers
+    atomic_int signal_cpu;        // 4 bytes - CPU of the last signal that woke someone, -1 = none
+    // Line 1: adaptive spin history and bookkeeping
+    atomic_uint spin_budget;      // 4 bytes - adaptive budget in ticks, 0 = park at once
+    atomic_uint avg_wake_ticks;   // 4 bytes - EWMA of wait-to-wake time
+    atomic_ushort hit_rate;       // 2 bytes - EWMA of spin hits, 0..ADAPTIVE_HIT_ONE
+    atomic_ushort skipped_waits;  // 2 bytes - waits since the last probing spin
+    clockid_t clock_id;           // 4 bytes - pthread_condattr_setclock() clock for timedwait
+    uint32_t stats_slot;          // 4 bytes - per-condvar slot in the stats segment
+    uint16_t home_node;           // 2 bytes - NUMA node of the arena the state came from
+    char cold_padding[42];        // Pad to 128 bytes
+} __attribute__((aligned(64))) ultra_spin_state_t;
+
+_Static_assert(sizeof(ultra_spin_state_t) == 128, "spin state must be two cache lines");
+_Static_assert(offsetof(ultra_spin_state_t, spin_budget) == 64, "adaptive state starts on line 1");
+
+// Exact condvar registry.
+// Open-addressed table keyed by the full condvar address. Lookups are
+// lock-free; registration, destroy and growth are rare and serialized on
+// registry_lock. Growth rehashes into a bigger table which is published
+// with a single store - retired tables and states are never freed, so a
+// racing lookup always dereferences valid memory.
+#define REGISTRY_INITIAL_SLOTS 1024
+#define REGISTRY_ADDR_MASK     ((1ULL << 48) - 1)
+#define REGISTRY_GEN_SHIFT     48
+#define COND_CACHE_SIZE        8
+
+typedef struct {
+    atomic_ullong tag;                    // (generation << 48) | address, 0 = empty
+    _Atomic(ultra_spin_state_t *) state;  // NULL once the condvar is destroyed
+} ultra_cond_slot_t;
+
+typedef struct ultra_cond_table {
+    struct ultra_cond_table *retired_next; // older tables, kept for racing readers
+    uint32_t mask;
+    uint32_t used;                         // slots with a tag (live or destroyed)
+    ultra_cond_slot_t slots[];
+} ultra_cond_table_t;
+
+// Per-thread lookup cache, validated against the state's generation
+typedef struct {
+    pthread_cond_t *cond;
+    ultra_spin_state_t *state;
+    uint32_t generation;
+} ultra_cond_cache_entry_t;
+
+static _Atomic(ultra_cond_table_t *) registry_table = NULL;
+static atomic_flag registry_lock = ATOMIC_FLAG_INIT;
+static atomic_int initialized = ATOMIC_VAR_INIT(0);
+static __thread ultra_cond_cache_entry_t cond_cache[COND_CACHE_SIZE];
+
+// Condvars routed to glibc still get a registry state so every entry point
+// agrees on the route; the low bit of owner marks them.
+#define OWNER_PASSTHROUGH ((uintptr_t)1)
+
+static inline int state_is_passthrough(ultra_spin_state_t *state) {
+    return ((uintptr_t)atomic_load_explicit(&state->owner, memory_order_relaxed) & OWNER_PASSTHROUGH) != 0;
+}
+
+static inline void registry_acquire(void) {
+    while (atomic_flag_test_and_set_explicit(&registry_lock, memory_order_acquire)) {
+        sched_yield();
+    }
+}
+
+static inline void registry_release(void) {
+    atomic_flag_clear_explicit(&registry_lock, memory_order_release);
+}
+
+static inline uint32_t registry_hash(uintptr_t addr) {
+    return (uint32_t)(((uint64_t)addr * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static ultra_cond_table_t *registry_alloc_table(uint32_t nslots) {
+    ultra_cond_table_t *table = calloc(1, sizeof(*table) + nslots * sizeof(ultra_cond_slot_t));
+    if (table != NULL) {
+        table->mask = nslots - 1;
+    }
+    return table;
+}
+
+// Find the slot holding addr, or the empty slot that ends its probe chain
+static ultra_cond_slot_t *registry_probe(ultra_cond_table_t *table, uintptr_t addr) {
+    for (uint32_t i = registry_hash(addr); ; i++) {
+        ultra_cond_slot_t *slot = &table->slots[i & table->mask];
+        unsigned long long tag = atomic_load_explicit(&slot->tag, memory_order_acquire);
+        if (tag == 0 || (tag & REGISTRY_ADDR_MASK) == addr) {
+            return slot;
+        }
+    }
+}
+
+// Rehash live entries into a table sized for them; destroyed slots are dropped.
+// Caller holds registry_lock.
+static ultra_cond_table_t *registry_grow(ultra_cond_table_t *old) {
+    uint32_t live = 0;
+    for (uint32_t i = 0; i <= old->mask; i++) {
+        if (atomic_load_explicit(&old->slots[i].state, memory_order_relaxed) != NULL) {
+            live++;
+        }
+    }
+
+    uint32_t nslots = REGISTRY_INITIAL_SLOTS;
+    while (nslots < live * 4) {
+        nslots <<= 1;
+    }
+
+    ultra_cond_table_t *table = registry_alloc_table(nslots);
+    if (table == NULL) {
+        return old;
+    }
+    for (uint32_t i = 0; i <= old->mask; i++) {
+        ultra_spin_state_t *state = atomic_load_explicit(&old->slots[i].state, memory_order_relaxed);
+        if (state == NULL) {
+            continue;
+        }
+        unsigned long long tag = atomic_load_explicit(&old->slots[i].tag, memory_order_relaxed);
+        ultra_cond_slot_t *slot = registry_probe(table, (uintptr_t)(tag & REGISTRY_ADDR_MASK));
+        atomic_store_explicit(&slot->state, state, memory_order_relaxed);
+        atomic_store_explicit(&slot->tag, tag, memory_order_relaxed);
+        table->used++;
+    }
+    table->retired_next = old;
+    atomic_store_explicit(&registry_table, table, memory_order_release);
+
+    return table;
+}
+
+// NUMA-local spin states.
+// States are carved from per-node arenas whose chunks are bound to their node
+// with mbind(MPOL_PREFERRED) before first touch, so a condvar's state lives on
+// the node of the thread that registered it whatever the process memory
+// policy says. Retired states go back on their home node's free list; nothing
+// is returned to the system. Everything here runs under registry_lock.
+#define STATE_ARENA_BYTES     (64 * 1024)
+#define STATE_MPOL_PREFERRED  1   // MPOL_PREFERRED from <numaif.h>, without libnuma
+
+typedef struct {
+    char *next;                   // unused part of the current chunk
+    char *end;
+    ultra_spin_state_t *free;     // recycled states, linked through owner
+} ultra_state_arena_t;
+
+static ultra_state_arena_t state_arenas[TOPOLOGY_MAX_NODES];
+
+static ultra_spin_state_t *state_arena_carve(ultra_state_arena_t *arena, int node) {
+    if (arena->next == arena->end) {
+        char *chunk = mmap(NULL, STATE_ARENA_BYTES, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED) {
+            return NULL;
+        }
+        if (nr_nodes > 1) {
+            unsigned long mask[TOPOLOGY_MAX_NODES / (8 * sizeof(unsigned long))] = { 0 };
+            mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+            // Best effort: without it, the registering thread still touches first
+            syscall(SYS_mbind, chunk, STATE_ARENA_BYTES, STATE_MPOL_PREFERRED, mask,
+                    TOPOLOGY_MAX_NODES + 1, 0);
+        }
+        arena->next = chunk;
+        arena->end = chunk + STATE_ARENA_BYTES;
+    }
+    ultra_spin_state_t *state = (ultra_spin_state_t *)arena->next;
+    arena->next += sizeof(*state);
+    return state;
+}
+
+// Take a zeroed state from the local node's free list or arena. Caller holds registry_lock.
+static ultra_spin_state_t *registry_alloc_state(pthread_cond_t *cond, int passthrough, clockid_t clock_id,
+                                               const void *site) {
+    int node = nr_nodes > 1 ? ultra_current_node() : 0;
+    ultra_state_arena_t *arena = &state_arenas[node];
+    ultra_spin_state_t *state = arena->free;
+    uint32_t generation = 0;
+
+    if (state != NULL) {
+        arena->free = (ultra_spin_state_t *)atomic_load_explicit(&state->owner, memory_order_relaxed);
+        generation = atomic_load_explicit(&state->generation, memory_order_relaxed);
+    } else {
+        state = state_arena_carve(arena, node);
+        if (state == NULL) {
+            return NULL;
+        }
+    }
+
+    memset(state, 0, sizeof(*state));
+    state->home_node = (uint16_t)node;
+    atomic_init(&state->signal_cpu, -1);
+    atomic_init(&state->generation, generation + 1);
+    atomic_init(&state->owner, (pthread_cond_t *)((uintptr_t)cond | (passthrough ? OWNER_PASSTHROUGH : 0)));
+    state->clock_id = clock_id;
+    state->stats_slot = ultra_stats_claim(cond, site);
+    // Start from the static budget and a neutral history
+    atomic_init(&state->spin_budget, (uint32_t)cached_spin_ticks);
+    atomic_init(&state->avg_wake_ticks, (uint32_t)(cached_spin_ticks / 2));
+    atomic_init(&state->hit_rate, ADAPTIVE_HIT_ONE / 2);
+    atomic_init(&state->q_head, &state->q_stub);
+    atomic_init(&state->q_tail, &state->q_stub);
+
+    return state;
+}
+
+// Detach state from its condvar and recycle it. Caller holds registry_lock.
+static void registry_retire_state(ultra_spin_state_t *state) {
+    ultra_stats_release(state->stats_slot);
+    // Invalidate every thread's cached lookup before the state is reused
+    atomic_fetch_add_explicit(&state->generation, 1, memory_order_release);
+    ultra_state_arena_t *arena = &state_arenas[state->home_node];
+    atomic_store_explicit(&state->owner, (pthread_cond_t *)arena->free, memory_order_relaxed);
+    arena->free = state;
+}
+
+// Attach a fresh state to cond, replacing any previous one (re-init of a
+// reused address). Returns NULL only on allocation failure.
+static ultra_spin_state_t *registry_register(pthread_cond_t *cond, int replace, int passthrough,
+                                             clockid_t clock_id, const void *site) {
+    uintptr_t addr = (uintptr_t)cond;
+    ultra_spin_state_t *state = NULL;
+
+    registry_acquire();
+
+    ultra_cond_table_t *table = atomic_load_explicit(&registry_table, memory_order_relaxed);
+    ultra_cond_slot_t *slot = registry_probe(table, addr);
+    unsigned long long tag = atomic_load_explicit(&slot->tag, memory_order_relaxed);
+    ultra_spin_state_t *old = atomic_load_explicit(&slot->state, memory_order_relaxed);
+
+    if (old != NULL && !replace) {
+        // Lost a lazy-registration race; somebody else registered it first
+        registry_release();
+        return old;
+    }
+
+    if (tag == 0 && (table->used + 1) * 4 > (table->mask + 1) * 3) {
+        table = registry_grow(table);
+        slot = registry_probe(table, addr);
+        tag = atomic_load_explicit(&slot->tag, memory_order_relaxed);
+    }
+
+    state = registry_alloc_state(cond, passthrough, clock_id, site);
+    if (state != NULL) {
+        unsigned long long generation = (tag >> REGISTRY_GEN_SHIFT) + 1;
+        if (tag == 0) {
+            table->used++;
+        }
+        atomic_store_explicit(&slot->state, state, memory_order_release);
+        atomic_store_explicit(&slot->tag, (generation << REGISTRY_GEN_SHIFT) | addr,
+                              memory_order_release);
+        if (old != NULL) {
+            registry_retire_state(old);
+        }
+    }
+
+    registry_release();
+    return state;
+}
+
+// Drop cond's state. Waits for threads still leaving a wait call, as
+// pthread_cond_destroy may legally race with woken waiters returning.
+static void registry_unregister(pthread_cond_t *cond) {
+    uintptr_t addr = (uintptr_t)cond;
+
+    registry_acquire();
+
+    ultra_cond_table_t *table = atomic_load_explicit(&registry_table, memory_order_relaxed);
+    ultra_cond_slot_t *slot = registry_probe(table, addr);
+    ultra_spin_state_t *state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+
+    if (state != NULL) {
+        while (atomic_load_explicit(&state->waiting_threads, memory_order_acquire) > 0) {
+            sched_yield();
+        }
+        unsigned long long tag = atomic_load_explicit(&slot->tag, memory_order_relaxed);
+        atomic_store_explicit(&slot->state, NULL, memory_order_release);
+        atomic_store_explicit(&slot->tag, tag + (1ULL << REGISTRY_GEN_SHIFT), memory_order_release);
+        registry_retire_state(state);
+    }
+
+    registry_release();
+}
+
+static pthread_key_t waiter_pool_key;
+static void ultra_waiter_pool_release(void *pool);
+
+// Initialize spinning states
+void my_pthread_init_spin_states(void) {
+    int expected = 0;
+
+    if (atomic_compare_exchange_strong(&initialized, &expected, 1)) {
+        init_depth++;
+        resolve_real_pthread();
+        registry_acquire();
+        if (atomic_load_explicit(&registry_table, memory_order_relaxed) == NULL) {
+            atomic_store_explicit(&registry_table, registry_alloc_table(REGISTRY_INITIAL_SLOTS),
+                                  memory_order_release);
+        }
+        pthread_key_create(&waiter_pool_key, ultra_waiter_pool_release);
+        registry_release();
+        init_depth--;
+    } else if (init_depth > 0) {
+        // Re-entered from our own initialization (see init_depth)
+        return;
+    }
+    // Lost the race above: wait for the winner to publish the table
+    while (atomic_load_explicit(&registry_table, memory_order_acquire) == NULL) {
+        sched_yield();
+    }
+    cached_spin_ticks = calculate_spin_ticks();
+}
+
+static int route_to_glibc(const pthread_condattr_t *attr, void *site);
+
+// Get spinning state - per-thread cache first, then the shared table, then
+// lazy registration for statically initialized condvars (routed by the call
+// site that touches them first)
+static inline ultra_spin_state_t* get_ultra_spin_state(pthread_cond_t *cond, void *site) {
+    uintptr_t addr = (uintptr_t)cond;
+    ultra_cond_cache_entry_t *entry = &cond_cache[(addr >> 6) & (COND_CACHE_SIZE - 1)];
+
+    if (entry->cond == cond &&
+        atomic_load_explicit(&entry->state->generation, memory_order_acquire) == entry->generation) {
+        return entry->state;
+    }
+
+    ultra_cond_table_t *table = atomic_load_explicit(&registry_table, memory_order_acquire);
+    if (__builtin_expect(table == NULL, 0)) {
+        my_pthread_init_spin_states();
+        table = atomic_load_explicit(&registry_table, memory_order_acquire);
+    }
+
+    ultra_spin_state_t *state = atomic_load_explicit(&registry_probe(table, addr)->state,
+                                                     memory_order_acquire);
+    if (state == NULL) {
+        state = registry_register(cond, 0, route_to_glibc(NULL, site), CLOCK_REALTIME, site);
+        if (state == NULL) {
+            abort(); // out of memory for a cache line - nothing sane left to do
+        }
+    }
+
+    entry->cond = cond;
+    entry->state = state;
+    entry->generation = atomic_load_explicit(&state->generation, memory_order_acquire);
+    // The slot may have been re-initialized between the probe and the
+    // generation load; only cache what still belongs to cond
+    if (((uintptr_t)atomic_load_explicit(&state->owner, memory_order_relaxed) & ~OWNER_PASSTHROUGH) !=
+        (uintptr_t)cond) {
+        entry->cond = NULL;
+    }
+
+    return state;
+}
+
+// Wait word operations on a condvar's state; see libmy_pthread_core.h.
+// Registration must happen while the caller still holds the mutex, so a
+// signal issued after the unlock is guaranteed to find it.
+static inline uint32_t ultra_register_waiter(ultra_spin_state_t *state) {
+    return ultra_core_ww_register((uint64_t *)&state->wait_word);
+}
+
+// Ultra-fast wake check - absolute minimum overhead
+static inline int ultra_try_wake(ultra_spin_state_t *state, uint32_t gen) {
+    return ultra_core_ww_try_wake((uint64_t *)&state->wait_word, gen);
+}
+
+// Deregister after a timeout or an unsuccessful pure spin; 1 = woken after all
+static inline int ultra_cancel_wait(ultra_spin_state_t *state, uint32_t gen) {
+    return ultra_core_ww_cancel((uint64_t *)&state->wait_word, gen);
+}
+
+// Futex wrappers for the C11 atomics used throughout this file
+static inline long ultra_futex_wait(atomic_uint *uaddr, uint32_t expected,
+                                    const struct timespec *abstime, int realtime) {
+    ultra_spin_pool_check();
+    return ultra_core_futex_wait((uint32_t *)uaddr, expected, abstime, realtime);
+}
+
+static inline void ultra_futex_wake(atomic_uint *uaddr, int count) {
+    ultra_core_futex_wake((uint32_t *)uaddr, count);
+}
+
+// Park on the condvar's futex until we are woken. Returns 0 once woken,
+// ETIMEDOUT if the absolute deadline on clock_id passed first (abstime ==
+// NULL blocks indefinitely); the caller still owns the waiter registration
+// in that case.
+static int ultra_park_wait(ultra_spin_state_t *state, uint32_t gen, clockid_t clock_id,
+                           const struct timespec *abstime) {
+    return ultra_core_park((uint64_t *)&state->wait_word, (uint32_t *)&state->futex_seq,
+                           (int32_t *)&state->parked_waiters, gen, abstime, clock_id == CLOCK_REALTIME);
+}
+
+static inline void ultra_wake_parked(ultra_spin_state_t *state, int count) {
+    ultra_core_wake_parked((uint32_t *)&state->futex_seq, (int32_t *)&state->parked_waiters, count);
+}
+
+// Spin budget for the next wait on this condvar.
+// Pure spin mode and LIBMY_PTHREAD_ADAPTIVE=0 use the static budget. Otherwise
+// a condvar that is rarely signalled within the maximum budget parks at once,
+// except for an occasional probing spin so it can recover if its pattern
+// changes.
+static inline uint64_t ultra_spin_budget(ultra_spin_state_t *state) {
+    if (!adaptive_enabled || wait_mode != WAIT_MODE_HYBRID) {
+        return cached_spin_ticks;
+    }
+
+    uint32_t budget = atomic_load_explicit(&state->spin_budget, memory_order_relaxed);
+    if (budget == 0) {
+        unsigned short skipped = atomic_load_explicit(&state->skipped_waits, memory_order_relaxed);
+        if (skipped + 1 >= ADAPTIVE_PROBE_INTERVAL) {
+            atomic_store_explicit(&state->skipped_waits, 0, memory_order_relaxed);
+            return adaptive_max_ticks;
+        }
+        atomic_store_explicit(&state->skipped_waits, skipped + 1, memory_order_relaxed);
+    }
+    return budget;
+}
+
+// Feed one completed wait into the condvar's history and recompute its budget.
+// waited is the time from wait start to wakeup (spin or park), spin_hit says
+// whether the spin phase caught the signal. The updates are plain
+// load/store pairs: a lost update between racing waiters only delays
+// convergence, and the hot path stays free of extra atomics.
+static inline void ultra_adapt_spin_budget(ultra_spin_state_t *state, uint64_t waited, int spin_hit) {
+    if (!adaptive_enabled || wait_mode != WAIT_MODE_HYBRID) {
+        return;
+    }
+
+    // Waits beyond twice the maximum budget all mean "too long to spin for"
+    if (waited > adaptive_max_ticks * 2) {
+        waited = adaptive_max_ticks * 2;
+    }
+
+    int64_t avg = atomic_load_explicit(&state->avg_wake_ticks, memory_order_relaxed);
+    avg += ((int64_t)waited - avg) >> ADAPTIVE_EWMA_SHIFT;
+    atomic_store_explicit(&state->avg_wake_ticks, (uint32_t)avg, memory_order_relaxed);
+
+    int32_t hit = atomic_load_explicit(&state->hit_rate, memory_order_relaxed);
+    hit += ((spin_hit ? ADAPTIVE_HIT_ONE : 0) - hit) >> ADAPTIVE_HIT_SHIFT;
+    atomic_store_explicit(&state->hit_rate, (unsigned short)hit, memory_order_relaxed);
+
+    uint64_t budget;
+    if (hit < ADAPTIVE_SKIP_HIT_RATE && (uint64_t)avg > adaptive_max_ticks) {
+        budget = 0; // signals almost never arrive while we spin - block at once
+    } else {
+        // Cover the typical wait with 2x headroom
+        budget = (uint64_t)avg * 2;
+        if (budget < adaptive_min_ticks) {
+            budget = adaptive_min_ticks;
+        }
+        if (budget > adaptive_max_ticks) {
+            budget = adaptive_max_ticks;
+        }
+    }
+    atomic_store_explicit(&state->spin_budget, (uint32_t)budget, memory_order_relaxed);
+}
+
+// Record where wakeups come from, for the next waiter's spin policy. Stores
+// only when the CPU changed, so a signaller that stays put keeps the line clean.
+static inline void ultra_note_signaller(ultra_spin_state_t *state) {
+    if (topology_aware) {
+        int cpu = sched_getcpu();
+        if (atomic_load_explicit(&state->signal_cpu, memory_order_relaxed) != cpu) {
+            atomic_store_explicit(&state->signal_cpu, cpu, memory_order_relaxed);
+        }
+    }
+}
+
+// Topology-aware spin policy: fit the spin to where the waiter runs relative
+// to the condvar's last signaller.
+//   same core   - spinning takes the issue slots (or the very CPU) the
+//                 signaller needs: park at once, or yield between polls in
+//                 pure spin mode. UMWAIT/TPAUSE already idle the hyperthread,
+//                 so those keep spinning.
+//   same LLC    - tight spin, the wakeup store is an LLC hit away
+//   same socket - the usual PAUSE backoff
+//   remote      - long backoff, every poll of a freshly written line is a
+//                 cross-socket transfer
+// Returns 1 if this wait should not spin at all. Such waits say nothing
+// about the condvar's wake timing and stay out of its adaptive history.
+static inline int ultra_topology_policy(ultra_spin_state_t *state, ultra_spin_policy_t *policy) {
+    if (!topology_aware) {
+        return 0;
+    }
+
+    int relation = ultra_cpu_relation(sched_getcpu(),
+                                      atomic_load_explicit(&state->signal_cpu, memory_order_relaxed));
+    ultra_stats_topology(relation);
+    switch (relation) {
+    case CPU_REL_CORE:
+        if (policy->strategy == WAIT_STRATEGY_UMWAIT || policy->strategy == WAIT_STRATEGY_TPAUSE) {
+            break;
+        }
+        if (wait_mode == WAIT_MODE_HYBRID) {
+            return 1;
+        }
+        policy->strategy = WAIT_STRATEGY_YIELD;
+        break;
+    case CPU_REL_LLC:
+        policy->backoff_max = PAUSE_BACKOFF_LLC;
+        break;
+    case CPU_REL_REMOTE:
+        policy->backoff_max = PAUSE_BACKOFF_REMOTE;
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+// Ultra-minimal spinning wait - absolute minimum latency
+static int ultra_minimal_spin_wait(ultra_spin_state_t *state, uint32_t gen, uint64_t start,
+                                   uint64_t budget, ultra_spin_policy_t *policy, int *signal_consumed) {
+    int got_signal = 0;
+    long iterations = 0;
+    uint64_t deadline = start + budget;
+    // ULTRA-TIGHT spinning loop - check EVERY iteration, bounded by wall time
+    do {
+            iterations++;
+            if (ultra_try_wake(state, gen)) {
+                    got_signal = 1;
+                    *signal_consumed = 1;
+                    break;
+            }
+            // Any store to wait_word (signal, broadcast, waiter arrival) is
+            // worth re-polling for; the low half changes on each of them
+            ultra_spin_pause((const atomic_uint *)&state->wait_word,
+                             (uint32_t)atomic_load_explicit(&state->wait_word, memory_order_relaxed),
+                             deadline, policy);
+    } while (ultra_now_ticks() < deadline);
+
+    // Update statistics (minimal overhead)
+    ultra_stats_spin(state->stats_slot, got_signal, ultra_now_ticks() - start, iterations);
+
+    return got_signal ? 0 : ETIMEDOUT;
+}
+
+// Map an absolute deadline on clock_id onto the spin time base: one clock
+// read now, plain tick comparisons afterwards. Returns the ticks left, 0 if
+// the deadline has passed.
+static uint64_t ultra_deadline_ticks(clockid_t clock_id, const struct timespec *abstime) {
+    struct timespec now;
+
+    clock_gettime(clock_id, &now);
+    int64_t left_ns = (int64_t)(abstime->tv_sec - now.tv_sec) * 1000000000LL +
+                      (abstime->tv_nsec - now.tv_nsec);
+    if (left_ns <= 0) {
+        return 0;
+    }
+    return (uint64_t)((double)left_ns * (double)ticks_per_sec / 1e9);
+}
+
+// ---------------------------------------------------------------------------
+// Per-waiter queue mode.
+// With many waiters, polling the shared wait_word bounces its cache line
+// between every spinner and the signaller. In queue mode each waiter instead
+// enqueues its own cache-line-aligned node and spins (then parks) on that
+// node's flag alone. Signal dequeues exactly one live node and flips its
+// flag; broadcast drains the nodes queued when it started.
+//
+// The queue is Vyukov's intrusive MPSC queue: enqueue is a single exchange
+// on q_tail and never blocks, dequeue is serialized among signallers by
+// q_lock. A timed-out waiter marks its node cancelled and leaves it queued;
+// signallers skip such nodes, and the waiter purges them from the front
+// itself so an idle condvar doesn't collect them. Nodes are never freed -
+// a signaller may still be touching one after its owner returned - and are
+// recycled through per-thread pools.
+// ---------------------------------------------------------------------------
+#define WAITER_WAITING   0  // queued, owner spinning
+#define WAITER_PARKED    1  // queued, owner in FUTEX_WAIT on flag
+#define WAITER_WOKEN     2  // dequeued by a signal or broadcast
+#define WAITER_CANCELLED 3  // owner timed out; signallers skip it
+#define WAITER_HEIR      4  // dequeued, will receive the mutex on the signaller's unlock
+#define WAITER_HEIR_PARKED 5 // as HEIR, owner in FUTEX_WAIT on flag
+#define WAITER_OWNER     6  // mutex handed over; owner returns holding it
+
+typedef struct ultra_waiter {
+    ultra_qlink_t link;             // must stay first
+    atomic_uint flag;               // WAITER_*, also the futex word
+    atomic_int in_queue;            // owner may reuse the node once 0
+    struct ultra_waiter *pool_next; // owner thread's pool
+    struct ultra_waiter *wake_next; // broadcast's private wake list
+    uint32_t woken_from;            // flag value broadcast replaced
+    pthread_mutex_t *mutex;         // mutex the owner waits with (handoff)
+} __attribute__((aligned(64))) ultra_waiter_t;
+
+static __thread ultra_waiter_t *waiter_pool = NULL;
+static ultra_waiter_t *free_waiters = NULL; // pools of exited threads, under registry_lock
+
+// Thread exit: hand our nodes to the global list for other threads
+static void ultra_waiter_pool_release(void *pool) {
+    ultra_waiter_t *last = pool;
+
+    while (last->pool_next != NULL) {
+        last = last->pool_next;
+    }
+    registry_acquire();
+    last->pool_next = free_waiters;
+    free_waiters = pool;
+    registry_release();
+}
+
+// A node of ours that no queue references any more. Nodes of exited threads
+// are adopted wholesale, since some may still sit cancelled in a queue.
+static ultra_waiter_t *ultra_waiter_get(void) {
+    for (int adopted = 0; ; adopted = 1) {
+        for (ultra_waiter_t *w = waiter_pool; w != NULL; w = w->pool_next) {
+            if (atomic_load_explicit(&w->in_queue, memory_order_acquire) == 0) {
+                return w;
+            }
+        }
+        if (adopted) {
+            break;
+        }
+        registry_acquire();
+        ultra_waiter_t *orphans = free_waiters;
+        free_waiters = NULL;
+        registry_release();
+        if (orphans == NULL) {
+            break;
+        }
+        ultra_waiter_t *last = orphans;
+        while (last->pool_next != NULL) {
+            last = last->pool_next;
+        }
+        last->pool_next = waiter_pool;
+        waiter_pool = orphans;
+        pthread_setspecific(waiter_pool_key, waiter_pool);
+    }
+
+    ultra_waiter_t *w = aligned_alloc(64, sizeof(*w));
+    if (w == NULL) {
+        abort(); // out of memory for a cache line - nothing sane left to do
+    }
+    memset(w, 0, sizeof(*w));
+    w->pool_next = waiter_pool;
+    waiter_pool = w;
+    pthread_setspecific(waiter_pool_key, waiter_pool);
+    return w;
+}
+
+// ---------------------------------------------------------------------------
+// Companion mutex and wait morphing.
+// Without help, a waiter woken by a signal sent under the mutex runs straight
+// into that mutex, still held by the signaller, and blocks a second time. The
+// companion mutex (my_pthread_mutex_lock/trylock/unlock) lets the signal
+// pick its waiter as heir instead: the signaller's next unlock of that mutex
+// doesn't release it but passes it to the heir, whose wait then returns
+// already holding it.
+//
+// The companion mutex works directly on glibc's pthread_mutex_t for the
+// plain kinds (default/normal and adaptive, process-private), using the
+// same __lock protocol as glibc (0 free, 1 locked, 2 locked with waiters)
+// and the same __owner/__nusers bookkeeping, so glibc and companion calls
+// may be mixed on one mutex. Other kinds go to glibc unchanged.
+//
+// Handoff is only armed for mutexes this thread locked through the
+// companion (tracked per thread), since only the companion unlock knows to
+// pass the mutex on; a mutex locked with my_pthread_mutex_lock must be
+// unlocked with my_pthread_mutex_unlock. Each thread has one handoff in
+// flight at most; further signals under the same mutex wake normally.
+// ---------------------------------------------------------------------------
+#define COMPANION_HELD_MAX 8
+#define COMPANION_KIND_MASK 0x7f   // kind plus robust/PI/PP bits, without pshared/elision
+#define COMPANION_PSHARED_BIT 0x80
+
+static __thread pthread_mutex_t *companion_held[COMPANION_HELD_MAX];
+static __thread int companion_held_count = 0;
+static __thread pid_t companion_tid = 0;
+static __thread struct {
+    pthread_mutex_t *mutex;
+    ultra_waiter_t *heir;
+} handoff = { NULL, NULL };
+
+static inline pid_t ultra_gettid(void) {
+    if (__builtin_expect(companion_tid == 0, 0)) {
+        companion_tid = (pid_t)syscall(SYS_gettid);
+    }
+    return companion_tid;
+}
+
+static inline int companion_kind_ok(pthread_mutex_t *mutex) {
+    int kind = atomic_load_explicit((_Atomic int *)&mutex->__data.__kind, memory_order_relaxed);
+    int base = kind & COMPANION_KIND_MASK;
+    return (kind & COMPANION_PSHARED_BIT) == 0 &&
+           (base == PTHREAD_MUTEX_TIMED_NP || base == PTHREAD_MUTEX_ADAPTIVE_NP);
+}
+
+static inline atomic_int *companion_word(pthread_mutex_t *mutex) {
+    return (atomic_int *)&mutex->__data.__lock;
+}
+
+static inline void companion_track(pthread_mutex_t *mutex) {
+    if (!handoff_mode) {
+        return; // only handoff needs to know
+    }
+    if (companion_held_count < COMPANION_HELD_MAX) {
+        companion_held[companion_held_count] = mutex;
+    }
+    companion_held_count++;
+}
+
+static inline void companion_untrack(pthread_mutex_t *mutex) {
+    if (!handoff_mode) {
+        return;
+    }
+    int top = companion_held_count < COMPANION_HELD_MAX ? companion_held_count : COMPANION_HELD_MAX;
+
+    for (int i = top - 1; i >= 0; i--) {
+        if (companion_held[i] == mutex) {
+            companion_held[i] = companion_held[top - 1];
+            companion_held_count--;
+            return;
+        }
+    }
+    if (companion_held_count > COMPANION_HELD_MAX) {
+        companion_held_count--; // one of the untracked overflow locks
+    }
+}
+
+// Did this thread lock mutex through the companion, and does it still own it?
+static inline int companion_owns(pthread_mutex_t *mutex) {
+    int top = companion_held_count < COMPANION_HELD_MAX ? companion_held_count : COMPANION_HELD_MAX;
+
+    for (int i = 0; i < top; i++) {
+        if (companion_held[i] == mutex) {
+            return mutex->__data.__owner == ultra_gettid();
+        }
+    }
+    return 0;
+}
+
+static inline void companion_acquired(pthread_mutex_t *mutex) {
+    mutex->__data.__owner = ultra_gettid();
+    mutex->__data.__nusers++;
+    companion_track(mutex);
+}
+
+static int companion_trylock(pthread_mutex_t *mutex) {
+    int expected = 0;
+
+    if (!atomic_compare_exchange_strong_explicit(companion_word(mutex), &expected, 1,
+                                                 memory_order_acquire, memory_order_relaxed)) {
+        return EBUSY;
+    }
+    companion_acquired(mutex);
+    return 0;
+}
+
+// Lock slow path: adaptive spin -> NUMA-aware queue -> futex.
+//
+// 1. Spin on the lock word for a budget learned per mutex: the EWMA of how
+//    long successful spins took, kept in glibc's __spins field (which only
+//    glibc's adaptive kind uses, for the same purpose) in MUTEX_SPIN_UNIT
+//    ticks. Failed spins decay it, so mutexes held for long stop spinning.
+// 2. Queue in a CNA lock (compact NUMA-aware MCS, Dice & Kogan) whose tail
+//    lives in the __list field, unused by non-robust mutexes (64-bit only). Only the queue head goes
+//    after the lock word; the rest spin on their own node, then park on it.
+//    On taking the lock word the head passes its role on, preferring a
+//    waiter from its own socket: waiters skipped over move to a secondary
+//    queue, which is flushed back when no local waiter is left and every
+//    CNA_FAIRNESS_PERIOD handoffs so remote sockets can't starve.
+// 3. The head spins on the word once more, then sleeps on it glibc-style.
+//
+// Threads that lock through glibc (timedlock, glibc's own condvar relock)
+// skip the queue and compete for the word directly, which stays correct:
+// the queue only decides which of our waiters competes.
+#define MUTEX_SPIN_UNIT      64     // ticks per __spins unit
+#define MUTEX_SPIN_SHIFT     3      // EWMA weight 1/8
+#define CNA_SCAN_LIMIT       16     // waiters examined for a same-socket successor
+#define CNA_FAIRNESS_PERIOD  256    // handoffs between forced secondary flushes
+
+static inline uint64_t mutex_spin_budget(pthread_mutex_t *mutex) {
+    uint64_t avg = (uint16_t)mutex->__data.__spins * (uint64_t)MUTEX_SPIN_UNIT;
+    uint64_t budget = avg * 2;
+
+    if (budget < adaptive_min_ticks) {
+        budget = adaptive_min_ticks;
+    }
+    return budget > adaptive_max_ticks ? adaptive_max_ticks : budget;
+}
+
+// Racy read-modify-write by design: it's a hint, like glibc's own __spins
+static inline void mutex_adapt_spin(pthread_mutex_t *mutex, int hit, uint64_t waited) {
+    int64_t avg = (uint16_t)mutex->__data.__spins;
+    int64_t sample = hit ? (int64_t)(waited / MUTEX_SPIN_UNIT) : 0;
+
+    avg += (sample - avg) >> MUTEX_SPIN_SHIFT;
+    mutex->__data.__spins = (short)(avg > INT16_MAX ? INT16_MAX : avg);
+}
+
+// Spin for the lock word for budget ticks, if the spinner pool lets us.
+// Returns 1 once it is ours, 0 if the budget ran out, -1 if we didn't spin.
+static inline int mutex_spin_acquire(atomic_int *word, uint64_t budget) {
+    uint64_t deadline = ultra_now_ticks() + budget;
+    ultra_spin_policy_t policy = ULTRA_SPIN_POLICY_INIT;
+    int acquired = 0;
+
+    if (budget == 0 || !ultra_spin_admit()) {
+        return -1;
+    }
+    do {
+        int expected = 0;
+        if (atomic_load_explicit(word, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_weak_explicit(word, &expected, 1,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+            acquired = 1;
+            break;
+        }
+        ultra_spin_pause((const atomic_uint *)word, (uint32_t)expected, deadline, &policy);
+    } while (ultra_now_ticks() < deadline);
+    ultra_spin_retire();
+    return acquired;
+}
+
+#if __SIZEOF_POINTER__ == 8
+typedef struct cna_node {
+    _Atomic(struct cna_node *) next;
+    atomic_uintptr_t spin;          // 0 waiting, 1 head, else head + secondary queue
+    atomic_uint wake;               // futex word: 0 waiting, 1 granted, 2 parked
+    int socket;
+    struct cna_node *sec_tail;      // valid on the first secondary node
+} cna_node_t;
+
+static __thread unsigned int cna_handoffs = 0;
+
+static inline _Atomic(cna_node_t *) *cna_tail(pthread_mutex_t *mutex) {
+    return (_Atomic(cna_node_t *) *)&mutex->__data.__list.__next;
+}
+
+// Make node the queue head, carrying the secondary queue along
+static inline void cna_grant(cna_node_t *node, uintptr_t spin) {
+    atomic_store_explicit(&node->spin, spin, memory_order_release);
+    if (atomic_exchange_explicit(&node->wake, 1, memory_order_seq_cst) == 2) {
+        ultra_futex_wake(&node->wake, 1);
+    }
+}
+
+// Wait to become the queue head: spin on our own node, then park on it
+static uintptr_t cna_wait_head(cna_node_t *node, uint64_t budget) {
+    int spinning = budget != 0 && ultra_spin_admit();
+    uint64_t deadline = ultra_now_ticks() + (spinning ? budget : 0);
+    ultra_spin_policy_t policy = ULTRA_SPIN_POLICY_INIT;
+    uintptr_t spin;
+
+    while ((spin = atomic_load_explicit(&node->spin, memory_order_acquire)) == 0) {
+        if (ultra_now_ticks() >= deadline) {
+            if (spinning) {
+                ultra_spin_retire();
+                spinning = 0;
+            }
+            unsigned int expected = 0;
+            if (atomic_compare_exchange_strong_explicit(&node->wake, &expected, 2,
+                                                        memory_order_seq_cst, memory_order_relaxed)) {
+                ultra_futex_wait(&node->wake, 2, NULL, 0);
+            }
+            continue;
+        }
+        ultra_spin_pause(&node->wake, 0, deadline, &policy);
+    }
+    if (spinning) {
+        ultra_spin_retire();
+    }
+    return spin;
+}
+
+// First waiter after me on my socket, moving the ones skipped over to the
+// secondary queue in *spin. NULL if none within reach.
+static cna_node_t *cna_find_successor(cna_node_t *me, uintptr_t *spin) {
+    cna_node_t *first = atomic_load_explicit(&me->next, memory_order_acquire);
+    cna_node_t *last_skipped = first;
+    cna_node_t *node = first;
+
+    if (first->socket == me->socket) {
+        return first;
+    }
+    for (int scanned = 0; scanned < CNA_SCAN_LIMIT; scanned++) {
+        node = atomic_load_explicit(&last_skipped->next, memory_order_acquire);
+        if (node == NULL) {
+            return NULL; // don't cut at the tail, an arriving waiter may be linking
+        }
+        if (node->socket == me->socket) {
+            // Detach first..last_skipped and append it to the secondary queue
+            atomic_store_explicit(&last_skipped->next, NULL, memory_order_relaxed);
+            if (*spin > 1) {
+                cna_node_t *sec_head = (cna_node_t *)*spin;
+                atomic_store_explicit(&sec_head->sec_tail->next, first, memory_order_relaxed);
+                sec_head->sec_tail = last_skipped;
+            } else {
+                first->sec_tail = last_skipped;
+                *spin = (uintptr_t)first;
+            }
+            return node;
+        }
+        last_skipped = node;
+    }
+    return NULL;
+}
+
+// Pass the queue head role on; called once we own the lock word
+static void cna_pass_head(_Atomic(cna_node_t *) *tail, cna_node_t *me) {
+    uintptr_t spin = atomic_load_explicit(&me->spin, memory_order_relaxed);
+    cna_node_t *next = atomic_load_explicit(&me->next, memory_order_acquire);
+
+    if (next == NULL) {
+        cna_node_t *expected = me;
+        if (spin > 1) {
+            // Main queue empty: the secondary queue becomes the queue
+            cna_node_t *sec_head = (cna_node_t *)spin;
+            if (atomic_compare_exchange_strong_explicit(tail, &expected, sec_head->sec_tail,
+                                                        memory_order_acq_rel, memory_order_relaxed)) {
+                cna_grant(sec_head, 1);
+                return;
+            }
+        } else if (atomic_compare_exchange_strong_explicit(tail, &expected, NULL,
+                                                           memory_order_acq_rel, memory_order_relaxed)) {
+            return;
+        }
+        uint32_t spins = 0;
+        while ((next = atomic_load_explicit(&me->next, memory_order_acquire)) == NULL) {
+            ultra_short_wait(&spins);
+        }
+    }
+
+    cna_node_t *succ = NULL;
+    if (nr_sockets > 1 && (++cna_handoffs % CNA_FAIRNESS_PERIOD != 0 || spin <= 1)) {
+        succ = cna_find_successor(me, &spin);
+    }
+    if (succ != NULL) {
+        cna_grant(succ, spin);
+    } else if (spin > 1) {
+        // No local waiter (or time to be fair): remote waiters go first
+        cna_node_t *sec_head = (cna_node_t *)spin;
+        atomic_store_explicit(&sec_head->sec_tail->next, atomic_load_explicit(&me->next, memory_order_acquire),
+                              memory_order_relaxed);
+        cna_grant(sec_head, 1);
+    } else {
+        cna_grant(next, 1);
+    }
+}
+
+#endif
+
+static int companion_lock(pthread_mutex_t *mutex) {
+    atomic_int *word = companion_word(mutex);
+    int expected = 0;
+
+    if (atomic_compare_exchange_strong_explicit(word, &expected, 1,
+                                                memory_order_acquire, memory_order_relaxed)) {
+        companion_acquired(mutex);
+        return 0;
+    }
+
+    uint64_t budget = mutex_spin_budget(mutex);
+    uint64_t start = ultra_now_ticks();
+    int spun = mutex_spin_acquire(word, budget);
+    if (spun > 0) {
+        mutex_adapt_spin(mutex, 1, ultra_now_ticks() - start);
+        companion_acquired(mutex);
+        return 0;
+    }
+    if (spun == 0) {
+        mutex_adapt_spin(mutex, 0, 0);
+    }
+
+#if __SIZEOF_POINTER__ == 8
+    cna_node_t node;
+    atomic_init(&node.next, NULL);
+    atomic_init(&node.spin, 0);
+    atomic_init(&node.wake, 0);
+    node.socket = nr_sockets > 1 ? ultra_current_socket() : 0;
+    node.sec_tail = NULL;
+
+    _Atomic(cna_node_t *) *tail = cna_tail(mutex);
+    cna_node_t *prev = atomic_exchange_explicit(tail, &node, memory_order_acq_rel);
+    if (prev != NULL) {
+        atomic_store_explicit(&prev->next, &node, memory_order_release);
+        cna_wait_head(&node, budget);
+    } else {
+        atomic_store_explicit(&node.spin, 1, memory_order_relaxed);
+    }
+
+    // Queue head: one more spin, then sleep on the word as glibc does
+    if (mutex_spin_acquire(word, budget) <= 0) {
+        ultra_core_lock_park((uint32_t *)word);
+    }
+    cna_pass_head(tail, &node);
+#else
+    // 32-bit layouts overlay __list with __spins: no room for the queue
+    ultra_core_lock_park((uint32_t *)word);
+#endif
+    companion_acquired(mutex);
+    return 0;
+}
+
+// Pass the mutex to the heir picked by our last signal. The lock word stays
+// held throughout; only the ownership bookkeeping moves.
+static void companion_grant(void) {
+    ultra_waiter_t *heir = handoff.heir;
+
+    handoff.mutex = NULL;
+    handoff.heir = NULL;
+    if (atomic_exchange_explicit(&heir->flag, WAITER_OWNER, memory_order_seq_cst) == WAITER_HEIR_PARKED) {
+        ultra_futex_wake(&heir->flag, 1);
+    }
+    atomic_store_explicit(&heir->in_queue, 0, memory_order_release);
+}
+
+// Turn a pending handoff on mutex into a plain wakeup, for paths that
+// release mutex outside the companion
+static void companion_forget(pthread_mutex_t *mutex) {
+    if (handoff.mutex == mutex) {
+        ultra_waiter_t *heir = handoff.heir;
+        handoff.mutex = NULL;
+        handoff.heir = NULL;
+        if (atomic_exchange_explicit(&heir->flag, WAITER_WOKEN, memory_order_seq_cst) == WAITER_HEIR_PARKED) {
+            ultra_futex_wake(&heir->flag, 1);
+        }
+        atomic_store_explicit(&heir->in_queue, 0, memory_order_release);
+    }
+    companion_untrack(mutex);
+}
+
+static int companion_unlock(pthread_mutex_t *mutex) {
+    companion_untrack(mutex);
+    mutex->__data.__owner = 0;
+    mutex->__data.__nusers--;
+    if (handoff.mutex == mutex) {
+        companion_grant();
+        return 0;
+    }
+    ultra_core_unlock((uint32_t *)companion_word(mutex));
+    return 0;
+}
+
+// Release mutex for a condvar wait, through the companion if it holds it.
+// Returns whether the companion was used, so the wait relocks the same way.
+static inline int ultra_wait_unlock(pthread_mutex_t *mutex, int *result) {
+    if (companion_owns(mutex)) {
+        *result = companion_unlock(mutex);
+        return 1;
+    }
+    if (handoff_mode) {
+        companion_forget(mutex);
+    }
+    *result = pthread_mutex_unlock(mutex);
+    return 0;
+}
+
+static inline void ultra_wait_relock(pthread_mutex_t *mutex, int companion) {
+    if (companion) {
+        companion_lock(mutex);
+    } else {
+        pthread_mutex_lock(mutex);
+    }
+}
+
+static inline void ultra_queue_push(ultra_spin_state_t *state, ultra_qlink_t *node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    ultra_qlink_t *prev = atomic_exchange_explicit(&state->q_tail, node, memory_order_seq_cst);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+// Wait out a producer that swapped q_tail but hasn't linked its node yet
+static inline ultra_qlink_t *ultra_queue_next(ultra_qlink_t *node) {
+    ultra_qlink_t *next;
+    uint32_t spins = 0;
+    while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) == NULL) {
+        ultra_short_wait(&spins);
+    }
+    return next;
+}
+
+// Front node without removing it, NULL if empty. Caller holds q_lock.
+static ultra_qlink_t *ultra_queue_peek(ultra_spin_state_t *state) {
+    ultra_qlink_t *head = atomic_load_explicit(&state->q_head, memory_order_relaxed);
+
+    if (head != &state->q_stub) {
+        return head;
+    }
+    if (atomic_load_explicit(&state->q_tail, memory_order_seq_cst) == head) {
+        return NULL;
+    }
+    return ultra_queue_next(head);
+}
+
+// Remove the front node, NULL if empty. Caller holds q_lock.
+static ultra_qlink_t *ultra_queue_pop(ultra_spin_state_t *state) {
+    ultra_qlink_t *stub = &state->q_stub;
+    ultra_qlink_t *head = atomic_load_explicit(&state->q_head, memory_order_relaxed);
+
+    if (head == stub) {
+        if (atomic_load_explicit(&state->q_tail, memory_order_seq_cst) == stub) {
+            return NULL;
+        }
+        head = ultra_queue_next(stub);
+        atomic_store_explicit(&state->q_head, head, memory_order_relaxed);
+    }
+    // Never hand out the last node while it is the tail: re-queue the stub
+    // behind it first so producers always have something to link onto
+    if (atomic_load_explicit(&head->next, memory_order_acquire) == NULL &&
+        atomic_load_explicit(&state->q_tail, memory_order_seq_cst) == head) {
+        ultra_queue_push(state, stub);
+    }
+    atomic_store_explicit(&state->q_head, ultra_queue_next(head), memory_order_relaxed);
+    return head;
+}
+
+static inline void ultra_queue_lock(ultra_spin_state_t *state) {
+    uint32_t spins = 0;
+    while (atomic_exchange_explicit(&state->q_lock, 1, memory_order_acquire) != 0) {
+        while (atomic_load_explicit(&state->q_lock, memory_order_relaxed) != 0) {
+            ultra_short_wait(&spins);
+        }
+    }
+}
+
+static inline void ultra_queue_unlock(ultra_spin_state_t *state) {
+    atomic_store_explicit(&state->q_lock, 0, memory_order_release);
+}
+
+static inline int ultra_queue_empty(ultra_spin_state_t *state) {
+    return atomic_load_explicit(&state->q_tail, memory_order_seq_cst) == &state->q_stub &&
+           atomic_load_explicit(&state->q_head, memory_order_relaxed) == &state->q_stub;
+}
+
+// Claim a dequeued node for waking, or as heir to the mutex we hold.
+// Returns 0 if its owner already cancelled.
+static inline int ultra_waiter_claim(ultra_waiter_t *w, uint32_t *was, int heir) {
+    uint32_t flag = atomic_load_explicit(&w->flag, memory_order_relaxed);
+    uint32_t next;
+
+    do {
+        if (flag == WAITER_CANCELLED) {
+            return 0;
+        }
+        next = !heir ? WAITER_WOKEN : flag == WAITER_PARKED ? WAITER_HEIR_PARKED : WAITER_HEIR;
+    } while (!atomic_compare_exchange_weak_explicit(&w->flag, &flag, next,
+                                                    memory_order_seq_cst, memory_order_relaxed));
+    *was = flag;
+    return 1;
+}
+
+// Should a signal make w the heir of its mutex?
+static inline int ultra_handoff_possible(ultra_waiter_t *w) {
+    return handoff_mode && handoff.heir == NULL && companion_owns(w->mutex);
+}
+
+// Wake a claimed node and give it back to its owner
+static inline void ultra_waiter_release(ultra_waiter_t *w, uint32_t was) {
+    if (was == WAITER_PARKED) {
+        ultra_futex_wake(&w->flag, 1);
+    }
+    atomic_store_explicit(&w->in_queue, 0, memory_order_release);
+}
+
+// Drop cancelled nodes from the front of the queue
+static void ultra_queue_purge(ultra_spin_state_t *state) {
+    ultra_queue_lock(state);
+    for (;;) {
+        ultra_waiter_t *w = (ultra_waiter_t *)ultra_queue_peek(state);
+        if (w == NULL || atomic_load_explicit(&w->flag, memory_order_acquire) != WAITER_CANCELLED) {
+            break;
+        }
+        ultra_queue_pop(state);
+        atomic_store_explicit(&w->in_queue, 0, memory_order_release);
+    }
+    ultra_queue_unlock(state);
+}
+
+static int ultra_queue_signal(ultra_spin_state_t *state) {
+    ultra_waiter_t *w = NULL;
+    uint32_t was = WAITER_WAITING;
+
+    if (ultra_queue_empty(state)) {
+        ultra_stats_signal(state->stats_slot, 0, 1);
+        return 0;
+    }
+    ultra_queue_lock(state);
+    ultra_qlink_t *link;
+    int heir = 0;
+    while ((link = ultra_queue_pop(state)) != NULL) {
+        heir = ultra_handoff_possible((ultra_waiter_t *)link);
+        if (ultra_waiter_claim((ultra_waiter_t *)link, &was, heir)) {
+            w = (ultra_waiter_t *)link;
+            break;
+        }
+        atomic_store_explicit(&((ultra_waiter_t *)link)->in_queue, 0, memory_order_release);
+    }
+    ultra_queue_unlock(state);
+
+    ultra_stats_signal(state->stats_slot, 0, w == NULL);
+    if (w != NULL) {
+        ultra_note_signaller(state);
+    }
+    if (w != NULL && heir) {
+        // Woken by our unlock instead
+        handoff.mutex = w->mutex;
+        handoff.heir = w;
+    } else if (w != NULL) {
+        // The futex syscall happens outside q_lock
+        ultra_waiter_release(w, was);
+    }
+    return 0;
+}
+
+static int ultra_queue_broadcast(ultra_spin_state_t *state) {
+    ultra_waiter_t *woken = NULL;
+
+    if (ultra_queue_empty(state)) {
+        ultra_stats_signal(state->stats_slot, 1, 1);
+        return 0;
+    }
+    ultra_queue_lock(state);
+    // The waiters queued when the broadcast started. If the stub is the tail
+    // this drains to empty, which can only add permitted spurious wakeups.
+    ultra_qlink_t *last = atomic_load_explicit(&state->q_tail, memory_order_seq_cst);
+    ultra_qlink_t *link;
+    while ((link = ultra_queue_pop(state)) != NULL) {
+        ultra_waiter_t *w = (ultra_waiter_t *)link;
+        uint32_t was;
+        // The first waiter may inherit the mutex; the rest have to fight for it
+        int heir = ultra_handoff_possible(w);
+        if (ultra_waiter_claim(w, &was, heir)) {
+            if (heir) {
+                handoff.mutex = w->mutex;
+                handoff.heir = w;
+            } else {
+                w->woken_from = was;
+                w->wake_next = woken;
+                woken = w;
+            }
+        } else {
+            atomic_store_explicit(&w->in_queue, 0, memory_order_release);
+        }
+        if (link == last) {
+            break;
+        }
+    }
+    ultra_queue_unlock(state);
+
+    ultra_stats_signal(state->stats_slot, 1, woken == NULL && handoff.heir == NULL);
+    if (woken != NULL || handoff.heir != NULL) {
+        ultra_note_signaller(state);
+    }
+    while (woken != NULL) {
+        ultra_waiter_t *next = woken->wake_next;
+        ultra_waiter_release(woken, woken->woken_from);
+        woken = next;
+    }
+    return 0;
+}
+
+// Heir to a mutex: nothing to do but wait for the signaller's unlock
+static void ultra_waiter_await_grant(ultra_waiter_t *w) {
+    for (;;) {
+        uint32_t flag = atomic_load_explicit(&w->flag, memory_order_acquire);
+        if (flag == WAITER_OWNER || flag == WAITER_WOKEN) {
+            return;
+        }
+        if (flag == WAITER_HEIR &&
+            !atomic_compare_exchange_strong_explicit(&w->flag, &flag, WAITER_HEIR_PARKED,
+                                                     memory_order_seq_cst, memory_order_relaxed)) {
+            continue;
+        }
+        ultra_futex_wait(&w->flag, WAITER_HEIR_PARKED, NULL, 0);
+    }
+}
+
+// Withdraw a timed-out waiter. Returns 1 if a signaller claimed the node
+// first, i.e. the wakeup is ours after all.
+static int ultra_waiter_cancel(ultra_spin_state_t *state, ultra_waiter_t *w) {
+    uint32_t flag = atomic_load_explicit(&w->flag, memory_order_relaxed);
+
+    do {
+        if (flag == WAITER_WOKEN || flag == WAITER_OWNER) {
+            return 1;
+        }
+        if (flag == WAITER_HEIR || flag == WAITER_HEIR_PARKED) {
+            ultra_waiter_await_grant(w);
+            return 1;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&w->flag, &flag, WAITER_CANCELLED,
+                                                    memory_order_seq_cst, memory_order_relaxed));
+    ultra_queue_purge(state);
+    return 0;
+}
+
+// Spin on our node for the state's budget, then park on it. Returns 1 once
+// a signaller has claimed the node (for a mutex heir: once the mutex is
+// ours), 0 when abstime passes - or, in pure spin mode, the budget runs out.
+// left is the time to abstime in ticks, non-zero.
+static int ultra_waiter_block(ultra_spin_state_t *state, ultra_waiter_t *w, clockid_t clock_id,
+                              const struct timespec *abstime, uint64_t start, uint64_t left) {
+    int woken = 0;
+
+    uint64_t budget = ultra_spin_budget(state);
+    if (budget > left) {
+        budget = left;
+    }
+    ultra_spin_policy_t policy = ULTRA_SPIN_POLICY_INIT;
+    int shared_core = budget != 0 && ultra_topology_policy(state, &policy);
+    if (budget != 0 && !shared_core && ultra_spin_admit()) {
+        long iterations = 0;
+        uint64_t deadline = start + budget;
+        do {
+            iterations++;
+            uint32_t flag = atomic_load_explicit(&w->flag, memory_order_acquire);
+            if (flag == WAITER_WOKEN || flag == WAITER_OWNER) {
+                woken = 1;
+                break;
+            }
+            ultra_spin_pause(&w->flag, flag, deadline, &policy);
+        } while (ultra_now_ticks() < deadline);
+
+        ultra_spin_retire();
+        ultra_stats_spin(state->stats_slot, woken, ultra_now_ticks() - start, iterations);
+    }
+    if (woken) {
+        ultra_adapt_spin_budget(state, ultra_now_ticks() - start, 1);
+    } else if (wait_mode == WAIT_MODE_HYBRID) {
+        // The signaller's claim CAS sees PARKED and issues the FUTEX_WAKE
+        uint32_t expected = WAITER_WAITING;
+        if (atomic_compare_exchange_strong_explicit(&w->flag, &expected, WAITER_PARKED,
+                                                    memory_order_seq_cst, memory_order_acquire)) {
+            ultra_stats_park(state->stats_slot);
+            for (;;) {
+                long rc = ultra_futex_wait(&w->flag, WAITER_PARKED, abstime, clock_id == CLOCK_REALTIME);
+                uint32_t flag = atomic_load_explicit(&w->flag, memory_order_acquire);
+                if (flag == WAITER_WOKEN || flag == WAITER_OWNER) {
+                    woken = 1;
+                    break;
+                }
+                if (flag == WAITER_HEIR_PARKED) {
+                    ultra_waiter_await_grant(w);
+                    woken = 1;
+                    break;
+                }
+                if (rc == -1 && errno == ETIMEDOUT) {
+                    break;
+                }
+            }
+        } else if (expected == WAITER_HEIR) {
+            ultra_waiter_await_grant(w);
+            woken = 1;
+        } else {
+            woken = 1; // claimed between the last poll and the CAS
+        }
+        if (woken && !shared_core) {
+            ultra_adapt_spin_budget(state, ultra_now_ticks() - start, 0);
+        }
+    }
+    return woken;
+}
+
+// Queue-mode wait and timedwait (abstime == NULL waits without a deadline).
+// Same shape as ultra_cond_wait/ultra_cond_timedwait, but every poll and the
+// futex word are on our own node.
+static int ultra_queue_wait(ultra_spin_state_t *state, pthread_mutex_t *mutex,
+                            clockid_t clock_id, const struct timespec *abstime) {
+    if (abstime != NULL && (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000L)) {
+        return EINVAL;
+    }
+
+    ultra_waiter_t *w = ultra_waiter_get();
+    atomic_store_explicit(&w->flag, WAITER_WAITING, memory_order_relaxed);
+    atomic_store_explicit(&w->in_queue, 1, memory_order_relaxed);
+    w->mutex = mutex;
+    atomic_fetch_add_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELAXED);
+    // Queued before the unlock, so a signal sent under the mutex finds us
+    ultra_queue_push(state, &w->link);
+
+    int unlock_result;
+    int companion = ultra_wait_unlock(mutex, &unlock_result);
+    if (unlock_result != 0) {
+        ultra_waiter_cancel(state, w);
+        atomic_fetch_sub_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELEASE);
+        return unlock_result;
+    }
+
+    int woken = 0;
+    uint64_t start = ultra_now_ticks();
+    uint64_t left = abstime != NULL ? ultra_deadline_ticks(clock_id, abstime) : UINT64_MAX;
+
+    if (left != 0) {
+        woken = ultra_waiter_block(state, w, clock_id, abstime, start, left);
+    }
+    if (!woken && ultra_waiter_cancel(state, w)) {
+        woken = 1;
+    }
+    ultra_stats_wait(state->stats_slot, woken, ultra_now_ticks() - start);
+
+    int result = ETIMEDOUT;
+    if (woken || abstime == NULL ||
+        (wait_mode != WAIT_MODE_HYBRID && ultra_now_ticks() - start < left)) {
+        result = 0;
+    }
+    atomic_fetch_sub_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELEASE);
+
+#if !defined(__x86_64__) && !defined(__i386__)
+    atomic_thread_fence(memory_order_acquire);
+#endif
+    if (atomic_load_explicit(&w->flag, memory_order_acquire) == WAITER_OWNER) {
+        // Handed over by the signaller's unlock: the lock word is already ours
+        mutex->__data.__owner = ultra_gettid();
+        mutex->__data.__nusers++;
+        if (companion) {
+            companion_track(mutex);
+        }
+    } else {
+        ultra_wait_relock(mutex, companion);
+    }
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Eventcount.
+// Blocking for lock-free structures, no mutex involved. A consumer that
+// finds the structure empty announces itself with prepare_wait, checks
+// again, and then either cancels or commits to sleeping; a producer
+// notifies after publishing. The waiter is a queue-mode node, so commit
+// spins and parks on its own cache line exactly like a queue-mode condvar
+// wait, and notify_one/notify_all are the queue-mode signal and broadcast.
+//
+// No lost wakeups: prepare's enqueue is a seq_cst exchange on q_tail, and
+// notify puts a seq_cst fence between the caller's publishing store and its
+// look at q_tail. Either the consumer's re-check sees the data, or notify
+// sees the queued node (or both). With nobody queued q_tail is the stub,
+// so that look is all a notify costs.
+// ---------------------------------------------------------------------------
+_Static_assert(sizeof(ultra_spin_state_t) <= sizeof(my_pthread_eventcount_t),
+               "eventcount must hold a spin state");
+_Static_assert(_Alignof(ultra_spin_state_t) <= _Alignof(my_pthread_eventcount_t),
+               "eventcount must be aligned like a spin state");
+
+static inline ultra_spin_state_t *ultra_ec_state(my_pthread_eventcount_t *ec) {
+    return (ultra_spin_state_t *)ec;
+}
+
+// A spin state kept in the object it serves rather than in the registry
+// (eventcounts, barrier trees); its stats slot is labelled with site
+static void ultra_detached_state_init(ultra_spin_state_t *state, const void *object, const void *site) {
+    memset(state, 0, sizeof(*state));
+    atomic_init(&state->spin_budget, (uint32_t)cached_spin_ticks);
+    atomic_init(&state->avg_wake_ticks, (uint32_t)(cached_spin_ticks / 2));
+    atomic_init(&state->hit_rate, ADAPTIVE_HIT_ONE / 2);
+    atomic_init(&state->q_head, &state->q_stub);
+    atomic_init(&state->q_tail, &state->q_stub);
+    state->clock_id = CLOCK_MONOTONIC;
+    atomic_init(&state->signal_cpu, -1);
+    registry_acquire();
+    state->stats_slot = ultra_stats_claim((pthread_cond_t *)object, site);
+    registry_release();
+}
+
+static ultra_waiter_t *ultra_ec_prepare(ultra_spin_state_t *state) {
+    ultra_waiter_t *w = ultra_waiter_get();
+
+    atomic_store_explicit(&w->flag, WAITER_WAITING, memory_order_relaxed);
+    atomic_store_explicit(&w->in_queue, 1, memory_order_relaxed);
+    w->mutex = NULL; // never an heir
+    atomic_fetch_add_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELAXED);
+    ultra_queue_push(state, &w->link);
+    return w;
+}
+
+static void ultra_ec_cancel(ultra_spin_state_t *state, ultra_waiter_t *w) {
+    if (ultra_waiter_cancel(state, w)) {
+        // A notify picked us before we withdrew. We are leaving anyway, so
+        // pass it on rather than swallow it.
+        ultra_queue_signal(state);
+    }
+    atomic_fetch_sub_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELEASE);
+}
+
+static void ultra_ec_commit(ultra_spin_state_t *state, ultra_waiter_t *w) {
+    uint64_t start = ultra_now_ticks();
+    int woken = ultra_waiter_block(state, w, CLOCK_MONOTONIC, NULL, start, UINT64_MAX);
+
+    // Pure spin mode gives up after the budget: a spurious return, which
+    // the caller's re-check absorbs
+    if (!woken && ultra_waiter_cancel(state, w)) {
+        woken = 1;
+    }
+    ultra_stats_wait(state->stats_slot, woken, ultra_now_ticks() - start);
+    atomic_fetch_sub_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELEASE);
+}
+
+static inline int ultra_ec_idle(ultra_spin_state_t *state) {
+    atomic_thread_fence(memory_order_seq_cst);
+    return atomic_load_explicit(&state->q_tail, memory_order_relaxed) == &state->q_stub;
+}
+
+// Ultra-fast pthread_cond_wait
+static int ultra_cond_wait(ultra_spin_state_t *state, pthread_mutex_t *mutex) {
+    if (queue_mode) {
+        return ultra_queue_wait(state, mutex, CLOCK_MONOTONIC, NULL);
+    }
+
+    // Register as waiting (minimal overhead) - keeps destroy from recycling
+    // the state until we are out
+    atomic_fetch_add_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELAXED);
+    uint32_t gen = ultra_register_waiter(state);
+
+    // Release mutex
+    int unlock_result;
+    int companion = ultra_wait_unlock(mutex, &unlock_result);
+    if (unlock_result != 0) {
+        ultra_cancel_wait(state, gen);
+        atomic_fetch_sub_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELEASE);
+        return unlock_result;
+    }
+
+    // Minimal memory barrier
+#if !defined(__x86_64__) && !defined(__i386__)
+    atomic_thread_fence(memory_order_release);
+#endif
+
+    int signal_consumed = 0;
+    uint64_t start = ultra_now_ticks();
+    uint64_t budget = ultra_spin_budget(state);
+    ultra_spin_policy_t policy = ULTRA_SPIN_POLICY_INIT;
+    int shared_core = budget != 0 && ultra_topology_policy(state, &policy);
+    if (budget != 0 && !shared_core && ultra_spin_admit()) {
+        ultra_minimal_spin_wait(state, gen, start, budget, &policy, &signal_consumed);
+        ultra_spin_retire();
+    }
+    int woken = signal_consumed;
+    if (!signal_consumed) {
+        if (wait_mode == WAIT_MODE_HYBRID) {
+            // Spin budget exhausted - block until signalled instead of
+            // returning and letting the caller's predicate loop spin again
+            ultra_stats_park(state->stats_slot);
+            woken = ultra_park_wait(state, gen, CLOCK_MONOTONIC, NULL) == 0;
+        } else {
+            // Pure spin: give up our registration and wake spuriously
+            woken = ultra_cancel_wait(state, gen);
+        }
+    }
+    uint64_t waited = ultra_now_ticks() - start;
+    if (!shared_core) {
+        ultra_adapt_spin_budget(state, waited, signal_consumed);
+    }
+    ultra_stats_wait(state->stats_slot, woken, waited);
+    atomic_fetch_sub_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELEASE);
+#if 0
+    if (!signal_consumed) {
+        // If we timed out (didn't get a signal), yield the CPU
+        // for better scheduling before attempting to re-lock.
+        sched_yield();
+    }
+#endif
+
+    // Minimal memory barrier
+#if !defined(__x86_64__) && !defined(__i386__)
+    atomic_thread_fence(memory_order_acquire);
+#endif
+
+    // Reacquire mutex
+    ultra_wait_relock(mutex, companion);
+
+    // Always return 0 for POSIX compliance
+    return 0;
+}
+
+// Ultra-fast pthread_cond_timedwait against an absolute deadline on clock_id.
+// The spin phase is capped by the deadline, mapped to ticks once up front;
+// the rest of a long timeout is spent in FUTEX_WAIT_BITSET on the caller's
+// deadline, so neither spin length nor preemption skews the timeout.
+static int ultra_cond_timedwait(ultra_spin_state_t *state, pthread_mutex_t *mutex,
+                                clockid_t clock_id, const struct timespec *abstime) {
+    if (queue_mode) {
+        return ultra_queue_wait(state, mutex, clock_id, abstime);
+    }
+    if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000L) {
+        return EINVAL;
+    }
+
+    atomic_fetch_add_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELAXED);
+    uint32_t gen = ultra_register_waiter(state);
+
+    // Release mutex
+    int unlock_result;
+    int companion = ultra_wait_unlock(mutex, &unlock_result);
+    if (unlock_result != 0) {
+        ultra_cancel_wait(state, gen);
+        atomic_fetch_sub_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELEASE);
+        return unlock_result;
+    }
+
+#if !defined(__x86_64__) && !defined(__i386__)
+    atomic_thread_fence(memory_order_release);
+#endif
+
+    int woken = 0;
+    uint64_t start = ultra_now_ticks();
+    uint64_t left = ultra_deadline_ticks(clock_id, abstime);
+
+    if (left != 0) {
+        // Spin for the condvar's budget, never past the deadline
+        int signal_consumed = 0;
+        uint64_t budget = ultra_spin_budget(state);
+        if (budget > left) {
+            budget = left;
+        }
+        ultra_spin_policy_t policy = ULTRA_SPIN_POLICY_INIT;
+        int shared_core = budget != 0 && ultra_topology_policy(state, &policy);
+        if (budget != 0 && !shared_core && ultra_spin_admit()) {
+            ultra_minimal_spin_wait(state, gen, start, budget, &policy, &signal_consumed);
+            ultra_spin_retire();
+        }
+        if (signal_consumed) {
+            woken = 1;
+            ultra_adapt_spin_budget(state, ultra_now_ticks() - start, 1);
+        } else if (wait_mode == WAIT_MODE_HYBRID) {
+            // Sleep in the kernel for whatever is left
+            ultra_stats_park(state->stats_slot);
+            if (ultra_park_wait(state, gen, clock_id, abstime) == 0) {
+                woken = 1;
+                if (!shared_core) {
+                    ultra_adapt_spin_budget(state, ultra_now_ticks() - start, 0);
+                }
+            }
+        }
+    }
+    if (!woken && ultra_cancel_wait(state, gen)) {
+        woken = 1; // woken between the last check and deregistration
+    }
+    ultra_stats_wait(state->stats_slot, woken, ultra_now_ticks() - start);
+
+    int result = ETIMEDOUT;
+    if (woken || (wait_mode != WAIT_MODE_HYBRID && ultra_now_ticks() - start < left)) {
+        result = 0; // pure spin gives up after its budget with a spurious wakeup, like wait
+    }
+    atomic_fetch_sub_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELEASE);
+
+#if !defined(__x86_64__) && !defined(__i386__)
+    atomic_thread_fence(memory_order_acquire);
+#endif
+    ultra_wait_relock(mutex, companion);
+    return result;
+}
+
+// Ultra-fast pthread_cond_broadcast
+// Wakes exactly the waiters registered so far: bumping the generation
+// retires all of them at once and clears their credits, so nothing is left
+// over for later arrivals.
+static int ultra_cond_broadcast(ultra_spin_state_t *state) {
+    if (queue_mode) {
+        return ultra_queue_broadcast(state);
+    }
+    if (!ultra_core_ww_broadcast((uint64_t *)&state->wait_word)) {
+        ultra_stats_signal(state->stats_slot, 1, 1);
+        return 0; // nobody to wake
+    }
+    ultra_stats_signal(state->stats_slot, 1, 0);
+    ultra_note_signaller(state);
+    ultra_wake_parked(state, INT_MAX);
+    return 0;
+}
+
+// Ultra-fast pthread_cond_signal
+// Adds one credit only if some registered waiter is not already owed one.
+static int ultra_cond_signal(ultra_spin_state_t *state) {
+    if (queue_mode) {
+        return ultra_queue_signal(state);
+    }
+    if (!ultra_core_ww_signal((uint64_t *)&state->wait_word)) {
+        ultra_stats_signal(state->stats_slot, 0, 1);
+        return 0; // every waiter already has a wakeup coming
+    }
+    ultra_stats_signal(state->stats_slot, 0, 0);
+    ultra_note_signaller(state);
+    ultra_wake_parked(state, 1);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Semaphores.
+// sem_t keeps glibc's layout and protocol: the value in the low half of one
+// 64-bit word, the threads blocked in the kernel in the high half, FUTEX_WAIT
+// on the value. So glibc's sem_trywait/sem_getvalue, and glibc itself for
+// semaphores routed there, can be mixed with ours on one object. What changes
+// is the slow path. When the value is 0, glibc's sem_wait goes straight to
+// the futex; ours first spins on the value with the usual budget, admission
+// and topology policy. Spinners don't count as blocked, so a post that a
+// spinner picks up costs no FUTEX_WAKE.
+// Budget, history and stats slot are a registry state keyed by the
+// semaphore's address, as for a condvar. Process-shared semaphores (named
+// ones always are) stay with glibc, and so does the 32-bit layout, which
+// keeps the waiter count elsewhere.
+// ---------------------------------------------------------------------------
+#define SEM_PRIVATE          0           // glibc's new_sem.private for a process-private semaphore
+#define SEM_NWAITERS_SHIFT   32
+#define SEM_VALUE_MASK       0xffffffffULL
+#define SEM_WAITER           (1ULL << SEM_NWAITERS_SHIFT)
+
+// glibc's struct new_sem with 64-bit atomics
+typedef struct {
+    atomic_ullong data;            // value | blocked threads << 32
+    int private;                   // SEM_PRIVATE, or FUTEX_PRIVATE_FLAG when shared
+    int pad;
+} ultra_sem_t;
+
+_Static_assert(sizeof(ultra_sem_t) <= sizeof(sem_t), "sem_t must hold glibc's new_sem");
+
+static inline int ultra_sem_private(sem_t *sem) {
+    return ((ultra_sem_t *)sem)->private == SEM_PRIVATE;
+}
+
+// The futex word: the value half of data
+static inline atomic_uint *ultra_sem_futex(ultra_sem_t *s) {
+    return (atomic_uint *)&s->data + (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+}
+
+// Take a unit if there is one
+static inline int ultra_sem_trydec(ultra_sem_t *s) {
+    uint64_t data = atomic_load_explicit(&s->data, memory_order_relaxed);
+
+    while ((data & SEM_VALUE_MASK) != 0) {
+        if (atomic_compare_exchange_weak_explicit(&s->data, &data, data - 1,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// One spin phase on the value. Returns 1 once a unit is ours.
+static int ultra_sem_spin(ultra_spin_state_t *state, ultra_sem_t *s, uint64_t start, uint64_t budget,
+                          ultra_spin_policy_t *policy) {
+    int got = 0;
+    long iterations = 0;
+    uint64_t deadline = start + budget;
+
+    do {
+        iterations++;
+        if (ultra_sem_trydec(s)) {
+            got = 1;
+            break;
+        }
+        ultra_spin_pause(ultra_sem_futex(s), 0, deadline, policy);
+    } while (ultra_now_ticks() < deadline);
+
+    ultra_stats_spin(state->stats_slot, got, ultra_now_ticks() - start, iterations);
+    return got;
+}
+
+// Block the way glibc does: count ourselves in the high half, FUTEX_WAIT while
+// the value is 0, then take a unit and uncount ourselves in one CAS. Returns
+// 0, ETIMEDOUT or EINTR (sem_wait is interruptible, as in glibc).
+static int ultra_sem_park(ultra_sem_t *s, clockid_t clock_id, const struct timespec *abstime) {
+    uint64_t data = atomic_fetch_add_explicit(&s->data, SEM_WAITER, memory_order_relaxed) + SEM_WAITER;
+
+    for (;;) {
+        if ((data & SEM_VALUE_MASK) == 0) {
+            if (ultra_futex_wait(ultra_sem_futex(s), 0, abstime, clock_id == CLOCK_REALTIME) == -1 &&
+                (errno == ETIMEDOUT || errno == EINTR)) {
+                int err = errno;
+                atomic_fetch_sub_explicit(&s->data, SEM_WAITER, memory_order_relaxed);
+                return err;
+            }
+            data = atomic_load_explicit(&s->data, memory_order_relaxed);
+        } else if (atomic_compare_exchange_weak_explicit(&s->data, &data, data - 1 - SEM_WAITER,
+                                                         memory_order_acquire, memory_order_relaxed)) {
+            return 0;
+        }
+    }
+}
+
+// sem_wait/sem_timedwait/sem_clockwait once the value was found to be 0
+// (abstime == NULL waits without a deadline). Returns 0 or an errno value.
+static int ultra_sem_wait(ultra_spin_state_t *state, ultra_sem_t *s, clockid_t clock_id,
+                          const struct timespec *abstime) {
+    int result = ETIMEDOUT;
+
+    // Keeps destroy from recycling the state until we are out
+    atomic_fetch_add_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELAXED);
+    uint64_t start = ultra_now_ticks();
+    uint64_t left = abstime != NULL ? ultra_deadline_ticks(clock_id, abstime) : UINT64_MAX;
+
+    if (left != 0) {
+        int got = 0;
+        uint64_t budget = ultra_spin_budget(state);
+        if (budget > left) {
+            budget = left;
+        }
+        ultra_spin_policy_t policy = ULTRA_SPIN_POLICY_INIT;
+        int shared_core = budget != 0 && ultra_topology_policy(state, &policy);
+        if (budget != 0 && !shared_core && ultra_spin_admit()) {
+            got = ultra_sem_spin(state, s, start, budget, &policy);
+            ultra_spin_retire();
+        }
+        if (got) {
+            result = 0;
+            ultra_adapt_spin_budget(state, ultra_now_ticks() - start, 1);
+        } else if (wait_mode == WAIT_MODE_HYBRID) {
+            ultra_stats_park(state->stats_slot);
+            result = ultra_sem_park(s, clock_id, abstime);
+            if (result == 0 && !shared_core) {
+                ultra_adapt_spin_budget(state, ultra_now_ticks() - start, 0);
+            }
+        } else {
+            // Pure spin mode has nowhere to park, and unlike a condvar wait
+            // sem_wait cannot return empty-handed: spin on to the deadline
+            uint64_t now;
+            while (!got && (now = ultra_now_ticks()) - start < left) {
+                uint64_t phase = left - (now - start);
+                got = ultra_sem_spin(state, s, now, phase < cached_spin_ticks ? phase : cached_spin_ticks,
+                                     &policy);
+            }
+            result = got ? 0 : ETIMEDOUT;
+        }
+    }
+    ultra_stats_wait(state->stats_slot, result == 0, ultra_now_ticks() - start);
+    atomic_fetch_sub_explicit(&state->waiting_threads, 1, MEMORY_ORDER_RELEASE);
+    return result;
+}
+
+// Add a unit; wake one thread only if some are blocked in the kernel
+static int ultra_sem_post(ultra_spin_state_t *state, ultra_sem_t *s) {
+    uint64_t data = atomic_load_explicit(&s->data, memory_order_relaxed);
+
+    do {
+        if ((data & SEM_VALUE_MASK) == SEM_VALUE_MAX) {
+            return EOVERFLOW;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&s->data, &data, data + 1,
+                                                    memory_order_release, memory_order_relaxed));
+
+    // "Empty" here means nobody blocked; a spinner may still take the unit
+    int blocked = (data >> SEM_NWAITERS_SHIFT) != 0;
+    ultra_stats_signal(state->stats_slot, 0, !blocked);
+    ultra_note_signaller(state);
+    if (blocked) {
+        ultra_futex_wake(ultra_sem_futex(s), 1);
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Barriers.
+// glibc's barrier is one counter that every thread increments and one futex
+// that all of them sleep on. An episode costs N transfers of that line, and
+// the last arriver then makes one FUTEX_WAKE for everybody. Ours is a
+// combining tree. Threads arrive at leaves of BARRIER_FANIN slots. The last
+// arriver at a node carries on to its parent, and whoever completes the root
+// is the serial thread. Every other thread waits at the node where it
+// stopped. The release runs back down the tree: each released thread
+// releases the nodes it completed on the way up. Arrival and release each
+// take O(log N) steps on lines shared by at most BARRIER_FANIN threads, and
+// the futex wakeups are spread over the tree.
+//
+// pthread_barrier_wait does not say which thread is which, so leaf slots are
+// claimed anew each episode. A thread starts at the leaf its CPU maps to, so
+// neighbouring CPUs share leaves, and moves on if that leaf is full. Each
+// leaf word carries the episode it is collecting, so a leaf that has filled
+// and been reset is not mistaken for an empty one. Waiting at a node spins
+// for the barrier's adaptive budget, then parks on the node's release word.
+//
+// The tree is allocated at init. pthread_barrier_t keeps a pointer to it in
+// bytes that glibc's barrier leaves unused. Process-shared barriers, and all
+// barriers in 32-bit builds, where the object has no spare room, are glibc's.
+// ---------------------------------------------------------------------------
+#define BARRIER_FANIN         4
+#define BARRIER_MAX_DEPTH     16           // levels of a tree for UINT_MAX threads
+#define BARRIER_MAGIC         0x62617272   // "barr"
+#define BARRIER_ADAPT_SAMPLES 8            // about this many waits per episode feed the history
+
+typedef struct {
+    // Line 0: arrivals
+    atomic_ullong arrived;         // leaves: episode collected << 32 | arrivals; inner nodes: arrivals
+    atomic_uint departed;          // leaves: threads done with the tree, over all episodes
+    uint32_t expected;             // arrivals that complete the node
+    int32_t parent;                // -1 for the root
+    // Line 1: release
+    atomic_uint released __attribute__((aligned(64))); // episode + 1 once released; futex word
+    atomic_int parked;             // waiters in FUTEX_WAIT on released
+} __attribute__((aligned(64))) ultra_barrier_node_t;
+
+_Static_assert(sizeof(ultra_barrier_node_t) == 128, "barrier node must be two cache lines");
+
+typedef struct {
+    ultra_spin_state_t state;      // budget, history, last releaser's CPU and stats slot
+    atomic_uint episode;           // episodes completed
+    uint32_t count;
+    uint32_t nr_leaves;
+    uint32_t adapt_sample;         // each waiter feeds every Nth of its waits into the history
+    long cpus;                     // CPU numbers mapped onto the leaves
+    ultra_barrier_node_t nodes[];  // leaves first, root last
+} ultra_barrier_t;
+
+#if __SIZEOF_POINTER__ == 8
+// Our view of a pthread_barrier_t
+typedef struct {
+    unsigned int glibc[5];         // glibc's struct pthread_barrier, zero on our barriers
+    uint32_t magic;                // BARRIER_MAGIC when tree is ours
+    ultra_barrier_t *tree;
+} ultra_barrier_overlay_t;
+
+_Static_assert(sizeof(ultra_barrier_overlay_t) <= sizeof(pthread_barrier_t),
+               "pthread_barrier_t must hold the tree pointer");
+#endif
+
+static __thread uint32_t barrier_adapt_tick = 0;
+
+static ultra_barrier_t *ultra_barrier_create(const void *object, unsigned int count, const void *site) {
+    uint32_t nr_leaves = (count + BARRIER_FANIN - 1) / BARRIER_FANIN;
+    size_t nr_nodes = nr_leaves;
+
+    for (uint32_t width = nr_leaves; width > 1; nr_nodes += width) {
+        width = (width + BARRIER_FANIN - 1) / BARRIER_FANIN;
+    }
+    size_t bytes = sizeof(ultra_barrier_t) + nr_nodes * sizeof(ultra_barrier_node_t);
+    ultra_barrier_t *b = aligned_alloc(64, bytes);
+    if (b == NULL) {
+        return NULL;
+    }
+    memset(b, 0, bytes);
+
+    // Level by level: node i of a level has parent first + width + i / FANIN
+    uint32_t first = 0, width = nr_leaves, below = count;
+    for (;;) {
+        for (uint32_t i = 0; i < width; i++) {
+            ultra_barrier_node_t *node = &b->nodes[first + i];
+            uint32_t rest = below - i * BARRIER_FANIN;
+            node->expected = rest < BARRIER_FANIN ? rest : BARRIER_FANIN;
+            node->parent = width == 1 ? -1 : (int32_t)(first + width + i / BARRIER_FANIN);
+        }
+        if (width == 1) {
+            break;
+        }
+        first += width;
+        below = width;
+        width = (width + BARRIER_FANIN - 1) / BARRIER_FANIN;
+    }
+
+    ultra_detached_state_init(&b->state, object, site);
+    b->count = count;
+    b->nr_leaves = nr_leaves;
+    b->adapt_sample = count / BARRIER_ADAPT_SAMPLES + 1;
+    b->cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (b->cpus < 1) {
+        b->cpus = 1;
+    }
+    return b;
+}
+
+// Waits for threads still on their way out of the last episode: the serial
+// thread may legally destroy the barrier while the others are returning.
+static void ultra_barrier_free(ultra_barrier_t *b) {
+    uint32_t episode = atomic_load_explicit(&b->episode, memory_order_acquire);
+
+    for (uint32_t i = 0; i < b->nr_leaves; i++) {
+        ultra_barrier_node_t *leaf = &b->nodes[i];
+        while (atomic_load_explicit(&leaf->departed, memory_order_acquire) != leaf->expected * episode) {
+            sched_yield();
+        }
+    }
+    ultra_stats_release(b->state.stats_slot);
+    free(b);
+}
+
+// Claim a slot in a leaf for *episode. Returns the leaf; *last says whether
+// we completed it. If every leaf is already full, we are early for the next
+// episode (more threads than count), and *episode is re-read until it starts.
+static uint32_t ultra_barrier_arrive_leaf(ultra_barrier_t *b, uint32_t *episode, int *last) {
+    int cpu = sched_getcpu();
+    uint32_t leaf = cpu < 0 ? 0
+                  : cpu < b->cpus ? (uint32_t)((uint64_t)cpu * b->nr_leaves / b->cpus)
+                  : (uint32_t)cpu % b->nr_leaves;
+
+    for (uint32_t probes = 0; ; probes++) {
+        if (probes == b->nr_leaves) {
+            probes = 0;
+            sched_yield();
+            *episode = atomic_load_explicit(&b->episode, memory_order_acquire);
+        }
+        ultra_barrier_node_t *node = &b->nodes[leaf];
+        uint64_t word = atomic_load_explicit(&node->arrived, memory_order_relaxed);
+        while ((uint32_t)(word >> 32) == *episode) {
+            int filled = (uint32_t)word + 1 == node->expected;
+            // The last arriver resets the leaf for the next episode
+            uint64_t next = filled ? (uint64_t)(*episode + 1) << 32 : word + 1;
+            if (atomic_compare_exchange_weak_explicit(&node->arrived, &word, next,
+                                                      memory_order_acq_rel, memory_order_relaxed)) {
+                *last = filled;
+                return leaf;
+            }
+        }
+        leaf = leaf + 1 < b->nr_leaves ? leaf + 1 : 0;
+    }
+}
+
+// Arrive at an inner node; 1 if we completed it. Its arrivals are always the
+// winners of its children, so a plain count does, reset by the last one:
+// nobody arrives for the next episode before this one is released.
+static inline int ultra_barrier_arrive_inner(ultra_barrier_node_t *node) {
+    uint64_t arrived = atomic_fetch_add_explicit(&node->arrived, 1, memory_order_acq_rel) + 1;
+
+    if (arrived < node->expected) {
+        return 0;
+    }
+    atomic_store_explicit(&node->arrived, 0, memory_order_relaxed);
+    return 1;
+}
+
+// Same handshake as ultra_core_park: the waiter announces itself in parked
+// before its last look at released, so one of the two sides sees the other
+static inline void ultra_barrier_release(ultra_barrier_node_t *node, uint32_t episode) {
+    atomic_store_explicit(&node->released, episode + 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&node->parked, memory_order_seq_cst) > 0) {
+        ultra_futex_wake(&node->released, INT_MAX);
+    }
+}
+
+// One spin phase on node's release word. Returns 1 once released.
+static int ultra_barrier_spin(ultra_barrier_node_t *node, uint32_t target, uint64_t start, uint64_t budget,
+                              ultra_spin_policy_t *policy) {
+    int released = 0;
+    long iterations = 0;
+    uint64_t deadline = start + budget;
+
+    do {
+        iterations++;
+        uint32_t seen = atomic_load_explicit(&node->released, memory_order_acquire);
+        if (seen == target) {
+            released = 1;
+            break;
+        }
+        ultra_spin_pause(&node->released, seen, deadline, policy);
+    } while (ultra_now_ticks() < deadline);
+
+    ultra_stats_spin(STATS_SLOT_NONE, released, ultra_now_ticks() - start, iterations);
+    return released;
+}
+
+// Wait at node until episode is released there. Returns whether the spin
+// phase caught the release, -1 if there was no spin phase to speak of
+// (shared core), which keeps the wait out of the adaptive history.
+static int ultra_barrier_block(ultra_barrier_t *b, ultra_barrier_node_t *node, uint32_t episode,
+                               uint64_t start) {
+    uint32_t target = episode + 1;
+    int released = 0;
+
+    uint64_t budget = ultra_spin_budget(&b->state);
+    ultra_spin_policy_t policy = ULTRA_SPIN_POLICY_INIT;
+    int shared_core = budget != 0 && ultra_topology_policy(&b->state, &policy);
+    if (budget != 0 && !shared_core && ultra_spin_room(b->count - 1)) {
+        released = ultra_barrier_spin(node, target, start, budget, &policy);
+    }
+    if (released) {
+        return 1;
+    }
+    if (wait_mode == WAIT_MODE_HYBRID) {
+        ultra_stats_park(STATS_SLOT_NONE);
+        atomic_fetch_add_explicit(&node->parked, 1, memory_order_seq_cst);
+        for (;;) {
+            uint32_t seen = atomic_load_explicit(&node->released, memory_order_seq_cst);
+            if (seen == target) {
+                break;
+            }
+            ultra_futex_wait(&node->released, seen, NULL, 0);
+        }
+        atomic_fetch_sub_explicit(&node->parked, 1, memory_order_relaxed);
+    } else {
+        // Pure spin mode has nowhere to park: spin it out
+        while (!ultra_barrier_spin(node, target, ultra_now_ticks(), cached_spin_ticks, &policy)) {
+        }
+    }
+    return shared_core ? -1 : 0;
+}
+
+static int ultra_barrier_wait(ultra_barrier_t *b) {
+    uint32_t episode = atomic_load_explicit(&b->episode, memory_order_acquire);
+    uint32_t won[BARRIER_MAX_DEPTH];
+    int nr_won = 0, last;
+
+    uint32_t leaf = ultra_barrier_arrive_leaf(b, &episode, &last);
+    uint32_t index = leaf;
+    int serial = 0;
+    while (last) {
+        won[nr_won++] = index;
+        int32_t parent = b->nodes[index].parent;
+        if (parent < 0) {
+            serial = 1;
+            break;
+        }
+        index = (uint32_t)parent;
+        last = ultra_barrier_arrive_inner(&b->nodes[index]);
+    }
+
+    int spin_hit = -1;
+    uint64_t start = 0;
+    if (serial) {
+        atomic_store_explicit(&b->episode, episode + 1, memory_order_release);
+    } else {
+        start = ultra_now_ticks();
+        spin_hit = ultra_barrier_block(b, &b->nodes[index], episode, start);
+    }
+    // Pass the release on, biggest subtree first; bookkeeping can wait
+    while (nr_won > 0) {
+        ultra_barrier_release(&b->nodes[won[--nr_won]], episode);
+    }
+
+    if (serial) {
+        ultra_note_signaller(&b->state);
+        ultra_stats_episode(b->state.stats_slot, b->count - 1);
+    } else {
+        uint64_t waited = ultra_now_ticks() - start;
+        if (spin_hit >= 0 && ++barrier_adapt_tick >= b->adapt_sample) {
+            barrier_adapt_tick = 0;
+            ultra_adapt_spin_budget(&b->state, waited, spin_hit);
+        }
+        ultra_stats_wait(STATS_SLOT_NONE, 1, waited);
+    }
+    // Our last touch of the tree, see ultra_barrier_free
+    atomic_fetch_add_explicit(&b->nodes[leaf].departed, 1, memory_order_release);
+    return serial ? PTHREAD_BARRIER_SERIAL_THREAD : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Interposition.
+// The library defines the pthread_cond_* symbols themselves, so loading it
+// with LD_PRELOAD (or linking it ahead of libc) moves unmodified binaries onto
+// the spin condvars. Each condvar is routed once, when it is initialized or
+// first touched, and every later call on it follows that route:
+//
+//   LIBMY_PTHREAD_PROCS       only processes whose comm matches use spin condvars
+//   LIBMY_PTHREAD_DENY_PROCS  matching processes use glibc for everything
+//   LIBMY_PTHREAD_SITES       only condvars first touched from a matching call
+//                             site use spin condvars
+//   LIBMY_PTHREAD_DENY_SITES  condvars first touched from a matching call site
+//                             use glibc
+//
+// Lists are comma separated fnmatch(3) patterns. A call site matches on the
+// calling function's symbol name, "object+0xoffset", or the object's basename
+// (e.g. "mysqld", "*log_write*", "libfoo.so*"). Process-shared condvars always
+// use glibc: the spin state is private to this process.
+// ---------------------------------------------------------------------------
+typedef struct {
+    int (*cond_init)(pthread_cond_t *, const pthread_condattr_t *);
+    int (*cond_destroy)(pthread_cond_t *);
+    int (*cond_wait)(pthread_cond_t *, pthread_mutex_t *);
+    int (*cond_timedwait)(pthread_cond_t *, pthread_mutex_t *, const struct timespec *);
+    int (*cond_clockwait)(pthread_cond_t *, pthread_mutex_t *, clockid_t, const struct timespec *);
+    int (*cond_signal)(pthread_cond_t *);
+    int (*cond_broadcast)(pthread_cond_t *);
+    int (*mutex_lock)(pthread_mutex_t *);
+    int (*mutex_trylock)(pthread_mutex_t *);
+    int (*mutex_unlock)(pthread_mutex_t *);
+    int (*sem_init)(sem_t *, int, unsigned int);
+    int (*sem_destroy)(sem_t *);
+    int (*sem_wait)(sem_t *);
+    int (*sem_timedwait)(sem_t *, const struct timespec *);
+    int (*sem_clockwait)(sem_t *, clockid_t, const struct timespec *);
+    int (*sem_post)(sem_t *);
+    int (*barrier_init)(pthread_barrier_t *, const pthread_barrierattr_t *, unsigned int);
+    int (*barrier_destroy)(pthread_barrier_t *);
+    int (*barrier_wait)(pthread_barrier_t *);
+} real_pthread_t;
+
+static real_pthread_t real_pthread;
+static atomic_int real_pthread_ready = ATOMIC_VAR_INIT(0);
+static int interpose_enabled = 1;
+static char *site_allow = NULL;
+static char *site_deny = NULL;
+
+// glibc keeps the pre-2.3.2 condvar as the oldest pthread_cond_* version, and
+// plain dlsym(RTLD_NEXT) may hand that one back; ask for the current ABI.
+static void *resolve_next(const char *name, const char *version) {
+    void *sym = version != NULL ? dlvsym(RTLD_NEXT, name, version) : NULL;
+    return sym != NULL ? sym : dlsym(RTLD_NEXT, name);
+}
+
+static void resolve_real_pthread(void) {
+    if (atomic_load_explicit(&real_pthread_ready, memory_order_acquire)) {
+        return;
+    }
+    // The mutex calls first: dlsym may allocate, and the allocator may lock
+    init_depth++;
+    real_pthread.mutex_lock = resolve_next("pthread_mutex_lock", NULL);
+    real_pthread.mutex_trylock = resolve_next("pthread_mutex_trylock", NULL);
+    real_pthread.mutex_unlock = resolve_next("pthread_mutex_unlock", NULL);
+    real_pthread.cond_init = resolve_next("pthread_cond_init", "GLIBC_2.3.2");
+    real_pthread.cond_destroy = resolve_next("pthread_cond_destroy", "GLIBC_2.3.2");
+    real_pthread.cond_wait = resolve_next("pthread_cond_wait", "GLIBC_2.3.2");
+    real_pthread.cond_timedwait = resolve_next("pthread_cond_timedwait", "GLIBC_2.3.2");
+    real_pthread.cond_clockwait = resolve_next("pthread_cond_clockwait", NULL);
+    real_pthread.cond_signal = resolve_next("pthread_cond_signal", "GLIBC_2.3.2");
+    real_pthread.cond_broadcast = resolve_next("pthread_cond_broadcast", "GLIBC_2.3.2");
+    real_pthread.sem_init = resolve_next("sem_init", NULL);
+    real_pthread.sem_destroy = resolve_next("sem_destroy", NULL);
+    real_pthread.sem_wait = resolve_next("sem_wait", NULL);
+    real_pthread.sem_timedwait = resolve_next("sem_timedwait", NULL);
+    real_pthread.sem_clockwait = resolve_next("sem_clockwait", NULL);
+    real_pthread.sem_post = resolve_next("sem_post", NULL);
+    real_pthread.barrier_init = resolve_next("pthread_barrier_init", NULL);
+    real_pthread.barrier_destroy = resolve_next("pthread_barrier_destroy", NULL);
+    real_pthread.barrier_wait = resolve_next("pthread_barrier_wait", NULL);
+    init_depth--;
+    atomic_store_explicit(&real_pthread_ready, 1, memory_order_release);
+}
+
+// Does any pattern in the comma separated list match one of the names?
+static int pattern_list_matches(const char *list, const char *const *names, int nnames) {
+    const char *p = list;
+
+    while (*p != '\0') {
+        char pattern[256];
+        size_t len = strcspn(p, ",");
+        if (len > 0 && len < sizeof(pattern)) {
+            memcpy(pattern, p, len);
+            pattern[len] = '\0';
+            for (int i = 0; i < nnames; i++) {
+                if (names[i] != NULL && fnmatch(pattern, names[i], 0) == 0) {
+                    return 1;
+                }
+            }
+        }
+        p += len;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return 0;
+}
+
+static int site_matches(const char *list, void *site) {
+    Dl_info info;
+    char where[512];
+    const char *names[3] = { NULL, NULL, NULL };
+
+    if (site == NULL || dladdr(site, &info) == 0) {
+        return 0;
+    }
+    const char *object = info.dli_fname != NULL ? strrchr(info.dli_fname, '/') : NULL;
+    object = object != NULL ? object + 1 : info.dli_fname;
+
+    names[0] = info.dli_sname;
+    names[1] = object;
+    if (object != NULL) {
+        snprintf(where, sizeof(where), "%s+0x%lx", object,
+                 (unsigned long)((uintptr_t)site - (uintptr_t)info.dli_fbase));
+        names[2] = where;
+    }
+    return pattern_list_matches(list, names, 3);
+}
+
+// Route a condvar being initialized (attr) or first touched (site) to glibc?
+static int route_to_glibc(const pthread_condattr_t *attr, void *site) {
+    int pshared = PTHREAD_PROCESS_PRIVATE;
+
+    if (attr != NULL && pthread_condattr_getpshared(attr, &pshared) == 0 &&
+        pshared == PTHREAD_PROCESS_SHARED) {
+        return 1;
+    }
+    if (site_deny != NULL && site_matches(site_deny, site)) {
+        return 1;
+    }
+    if (site_allow != NULL && !site_matches(site_allow, site)) {
+        return 1;
+    }
+    return 0;
+}
+
+// Process-level allow/deny and call-site lists; part of load_config()
+static void load_interpose_config(void) {
+    char comm[64] = "";
+    FILE *fp = fopen("/proc/self/comm", "r");
+    const char *names[1] = { comm };
+
+    if (fp != NULL) {
+        if (fgets(comm, sizeof(comm), fp) != NULL) {
+            comm[strcspn(comm, "\n")] = '\0';
+        }
+        fclose(fp);
+    }
+
+    const char *procs = getenv("LIBMY_PTHREAD_PROCS");
+    const char *deny_procs = getenv("LIBMY_PTHREAD_DENY_PROCS");
+    if (procs != NULL && *procs != '\0' && !pattern_list_matches(procs, names, 1)) {
+        interpose_enabled = 0;
+    }
+    if (deny_procs != NULL && *deny_procs != '\0' && pattern_list_matches(deny_procs, names, 1)) {
+        interpose_enabled = 0;
+    }
+
+    const char *sites = getenv("LIBMY_PTHREAD_SITES");
+    const char *deny_sites = getenv("LIBMY_PTHREAD_DENY_SITES");
+    if (sites != NULL && *sites != '\0') {
+        site_allow = strdup(sites);
+    }
+    if (deny_sites != NULL && *deny_sites != '\0') {
+        site_deny = strdup(deny_sites);
+    }
+}
+
+// Common entry: make sure config and real symbols are loaded, then say
+// whether this process uses spin condvars at all. Calls made from inside
+// our own initialization go to glibc (see init_depth).
+static inline int ultra_interposing(void) {
+    if (__builtin_expect(init_depth > 0, 0)) {
+        return 0;
+    }
+    if (__builtin_expect(!atomic_load_explicit(&initialized, memory_order_acquire), 0)) {
+        my_pthread_init_spin_states();
+    }
+    if (__builtin_expect(!atomic_load_explicit(&real_pthread_ready, memory_order_acquire), 0)) {
+        resolve_real_pthread();
+    }
+    return interpose_enabled;
+}
+
+static int cond_init_impl(pthread_cond_t *cond, const pthread_condattr_t *attr, void *site) {
+    int interposing = ultra_interposing();
+
+    // Always run glibc's init so the object is valid for either route
+    int result = real_pthread.cond_init(cond, attr);
+    if (result != 0 || !interposing) {
+        return result;
+    }
+    clockid_t clock_id = CLOCK_REALTIME;
+    if (attr != NULL) {
+        pthread_condattr_getclock(attr, &clock_id);
+    }
+    return registry_register(cond, 1, route_to_glibc(attr, site), clock_id, site) != NULL ? 0 : ENOMEM;
+}
+
+static int cond_destroy_impl(pthread_cond_t *cond) {
+    if (ultra_interposing()) {
+        registry_unregister(cond);
+    }
+    return real_pthread.cond_destroy(cond);
+}
+
+static int cond_wait_impl(pthread_cond_t *cond, pthread_mutex_t *mutex, void *site) {
+    if (ultra_interposing()) {
+        ultra_spin_state_t *state = get_ultra_spin_state(cond, site);
+        if (!state_is_passthrough(state)) {
+            ultra_trace_enter(cond, site);
+            ultra_trace_event(TRACE_WAIT_BEGIN, 0);
+            return ultra_cond_wait(state, mutex);
+        }
+    }
+    if (handoff_mode) {
+        companion_forget(mutex); // glibc releases it behind the companion's back
+    }
+    return real_pthread.cond_wait(cond, mutex);
+}
+
+// clock_id < 0 means pthread_cond_timedwait: use the condvar's own clock
+static int cond_clockwait_impl(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t clock_id,
+                               const struct timespec *abstime, void *site) {
+    if (clock_id >= 0 && clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC) {
+        return EINVAL;
+    }
+    if (ultra_interposing()) {
+        ultra_spin_state_t *state = get_ultra_spin_state(cond, site);
+        if (!state_is_passthrough(state)) {
+            ultra_trace_enter(cond, site);
+            ultra_trace_event(TRACE_WAIT_BEGIN, 1);
+            return ultra_cond_timedwait(state, mutex, clock_id >= 0 ? clock_id : state->clock_id, abstime);
+        }
+    }
+    if (handoff_mode) {
+        companion_forget(mutex);
+    }
+    if (clock_id < 0) {
+        return real_pthread.cond_timedwait(cond, mutex, abstime);
+    }
+    return real_pthread.cond_clockwait != NULL
+        ? real_pthread.cond_clockwait(cond, mutex, clock_id, abstime)
+        : ENOSYS;
+}
+
+static int cond_signal_impl(pthread_cond_t *cond, void *site) {
+    if (ultra_interposing()) {
+        ultra_spin_state_t *state = get_ultra_spin_state(cond, site);
+        if (!state_is_passthrough(state)) {
+            ultra_trace_enter(cond, site);
+            return ultra_cond_signal(state);
+        }
+    }
+    return real_pthread.cond_signal(cond);
+}
+
+static int cond_broadcast_impl(pthread_cond_t *cond, void *site) {
+    if (ultra_interposing()) {
+        ultra_spin_state_t *state = get_ultra_spin_state(cond, site);
+        if (!state_is_passthrough(state)) {
+            ultra_trace_enter(cond, site);
+            return ultra_cond_broadcast(state);
+        }
+    }
+    return real_pthread.cond_broadcast(cond);
+}
+
+// Mutexes: the companion lock for the kinds it handles, glibc for the rest
+// (error checking, recursive, robust, priority, process-shared). The
+// explicit my_pthread_mutex_* API always uses it; the interposed symbols
+// follow the process lists and LIBMY_PTHREAD_MUTEX.
+static inline int mutex_routed(pthread_mutex_t *mutex, int explicit_api) {
+    int interposing = ultra_interposing();
+    return companion_kind_ok(mutex) && (explicit_api || (interposing && mutex_mode));
+}
+
+// glibc's mutex calls. Until resolve_real_pthread has found them (an
+// allocator locking from inside its dlsym) the bare lock word stands in;
+// the lock and its unlock both fall inside that window.
+static int real_mutex_lock(pthread_mutex_t *mutex) {
+    if (__builtin_expect(real_pthread.mutex_lock == NULL, 0)) {
+        ultra_core_lock_park((uint32_t *)companion_word(mutex));
+        return 0;
+    }
+    return real_pthread.mutex_lock(mutex);
+}
+
+static int real_mutex_trylock(pthread_mutex_t *mutex) {
+    if (__builtin_expect(real_pthread.mutex_trylock == NULL, 0)) {
+        return ultra_core_lock_try((uint32_t *)companion_word(mutex)) ? 0 : EBUSY;
+    }
+    return real_pthread.mutex_trylock(mutex);
+}
+
+static int real_mutex_unlock(pthread_mutex_t *mutex) {
+    if (__builtin_expect(real_pthread.mutex_unlock == NULL, 0)) {
+        ultra_core_unlock((uint32_t *)companion_word(mutex));
+        return 0;
+    }
+    return real_pthread.mutex_unlock(mutex);
+}
+
+static int mutex_lock_impl(pthread_mutex_t *mutex, int explicit_api) {
+    return mutex_routed(mutex, explicit_api) ? companion_lock(mutex) : real_mutex_lock(mutex);
+}
+
+static int mutex_trylock_impl(pthread_mutex_t *mutex, int explicit_api) {
+    return mutex_routed(mutex, explicit_api) ? companion_trylock(mutex) : real_mutex_trylock(mutex);
+}
+
+static int mutex_unlock_impl(pthread_mutex_t *mutex, int explicit_api) {
+    return mutex_routed(mutex, explicit_api) ? companion_unlock(mutex) : real_mutex_unlock(mutex);
+}
+
+// Semaphores: glibc's layout either way (see "Semaphores"), so the route
+// only decides whose slow path runs. The explicit my_pthread_sem_* API
+// always takes ours; the interposed symbols follow the process and call-site
+// lists and LIBMY_PTHREAD_SEM. Shared semaphores need shared futexes: glibc.
+// Returns the state to use, NULL for glibc.
+static inline ultra_spin_state_t *sem_routed(sem_t *sem, int explicit_api, void *site) {
+#if __SIZEOF_POINTER__ == 8
+    int interposing = ultra_interposing();
+    if (ultra_sem_private(sem) && (explicit_api || (interposing && sem_mode))) {
+        ultra_spin_state_t *state = get_ultra_spin_state((pthread_cond_t *)sem, site);
+        if (explicit_api || !state_is_passthrough(state)) {
+            return state;
+        }
+    }
+#else
+    (void)explicit_api;
+    (void)site;
+    ultra_interposing();
+#endif
+    return NULL;
+}
+
+// sem_* report errors through errno
+static inline int sem_result(int err) {
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static int sem_init_impl(sem_t *sem, int pshared, unsigned int value, int explicit_api, void *site) {
+    int interposing = ultra_interposing();
+
+    int result = real_pthread.sem_init(sem, pshared, value);
+#if __SIZEOF_POINTER__ == 8
+    if (result == 0 && !pshared && (explicit_api || (interposing && sem_mode))) {
+        int passthrough = !explicit_api && route_to_glibc(NULL, site);
+        if (registry_register((pthread_cond_t *)sem, 1, passthrough, CLOCK_REALTIME, site) == NULL) {
+            return sem_result(ENOMEM);
+        }
+    }
+#else
+    (void)interposing;
+    (void)explicit_api;
+    (void)site;
+#endif
+    return result;
+}
+
+static int sem_destroy_impl(sem_t *sem) {
+    if (ultra_interposing() && ultra_sem_private(sem)) {
+        registry_unregister((pthread_cond_t *)sem);
+    }
+    return real_pthread.sem_destroy(sem);
+}
+
+// clock_id < 0 means sem_wait, CLOCK_REALTIME without a clock also sem_timedwait
+static int sem_wait_impl(sem_t *sem, clockid_t clock_id, const struct timespec *abstime,
+                         int explicit_api, void *site) {
+    if (abstime != NULL) {
+        if (clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC) {
+            return sem_result(EINVAL);
+        }
+        if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000L) {
+            return sem_result(EINVAL);
+        }
+    }
+#if __SIZEOF_POINTER__ == 8
+    // Uncontended: the same CAS glibc would do, without a registry lookup
+    if (ultra_sem_private(sem) && ultra_sem_trydec((ultra_sem_t *)sem)) {
+        return 0;
+    }
+#endif
+    ultra_spin_state_t *state = sem_routed(sem, explicit_api, site);
+    if (state != NULL) {
+        ultra_trace_enter(sem, site);
+        ultra_trace_event(TRACE_WAIT_BEGIN, abstime != NULL);
+        return sem_result(ultra_sem_wait(state, (ultra_sem_t *)sem, clock_id, abstime));
+    }
+    if (abstime == NULL) {
+        return real_pthread.sem_wait(sem);
+    }
+    if (clock_id == CLOCK_REALTIME) {
+        return real_pthread.sem_timedwait(sem, abstime);
+    }
+    return real_pthread.sem_clockwait != NULL ? real_pthread.sem_clockwait(sem, clock_id, abstime)
+                                              : sem_result(ENOSYS);
+}
+
+static int sem_post_impl(sem_t *sem, int explicit_api, void *site) {
+    ultra_spin_state_t *state = sem_routed(sem, explicit_api, site);
+    if (state != NULL) {
+        ultra_trace_enter(sem, site);
+        return sem_result(ultra_sem_post(state, (ultra_sem_t *)sem));
+    }
+    return real_pthread.sem_post(sem);
+}
+
+// Barriers: the tree for process-private barriers on 64-bit, glibc for the
+// rest. Like the mutex, the explicit API always uses the tree; the
+// interposed init follows the process and call-site lists and
+// LIBMY_PTHREAD_BARRIER. Wait and destroy follow whatever init chose.
+static int barrier_init_impl(pthread_barrier_t *barrier, const pthread_barrierattr_t *attr,
+                             unsigned int count, int explicit_api, void *site) {
+    int interposing = ultra_interposing();
+
+#if __SIZEOF_POINTER__ == 8
+    ultra_barrier_overlay_t *overlay = (ultra_barrier_overlay_t *)barrier;
+    int pshared = PTHREAD_PROCESS_PRIVATE;
+
+    if (attr != NULL) {
+        pthread_barrierattr_getpshared(attr, &pshared);
+    }
+    memset(barrier, 0, sizeof(*barrier));
+    if (count != 0 && pshared == PTHREAD_PROCESS_PRIVATE &&
+        (explicit_api || (interposing && barrier_mode && !route_to_glibc(NULL, site)))) {
+        overlay->tree = ultra_barrier_create(barrier, count, site);
+        if (overlay->tree == NULL) {
+            return ENOMEM;
+        }
+        overlay->magic = BARRIER_MAGIC;
+        return 0;
+    }
+#else
+    (void)interposing;
+    (void)explicit_api;
+    (void)site;
+#endif
+    return real_pthread.barrier_init(barrier, attr, count);
+}
+
+static inline ultra_barrier_t *barrier_tree(pthread_barrier_t *barrier) {
+#if __SIZEOF_POINTER__ == 8
+    ultra_barrier_overlay_t *overlay = (ultra_barrier_overlay_t *)barrier;
+    if (overlay->magic == BARRIER_MAGIC) {
+        return overlay->tree;
+    }
+#else
+    (void)barrier;
+#endif
+    return NULL;
+}
+
+static int barrier_destroy_impl(pthread_barrier_t *barrier) {
+    ultra_interposing();
+    ultra_barrier_t *tree = barrier_tree(barrier);
+    if (tree != NULL) {
+        ultra_barrier_free(tree);
+        memset(barrier, 0, sizeof(*barrier));
+        return 0;
+    }
+    return real_pthread.barrier_destroy(barrier);
+}
+
+static int barrier_wait_impl(pthread_barrier_t *barrier, void *site) {
+    ultra_barrier_t *tree = barrier_tree(barrier);
+    if (tree != NULL) {
+        ultra_trace_enter(barrier, site);
+        ultra_trace_event(TRACE_WAIT_BEGIN, 0);
+        return ultra_barrier_wait(tree);
+    }
+    ultra_interposing();
+    return real_pthread.barrier_wait(barrier);
+}
+
+#define CALL_SITE __builtin_return_address(0)
+#define CONDVAR_CLOCK ((clockid_t)-1)
+
+// Explicit API
+int my_pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+    return cond_wait_impl(cond, mutex, CALL_SITE);
+}
+
+int my_pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime) {
+    return cond_clockwait_impl(cond, mutex, CONDVAR_CLOCK, abstime, CALL_SITE);
+}
+
+int my_pthread_cond_clockwait(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t clock_id,
+                              const struct timespec *abstime) {
+    return cond_clockwait_impl(cond, mutex, clock_id, abstime, CALL_SITE);
+}
+
+int my_pthread_cond_broadcast(pthread_cond_t *cond) {
+    return cond_broadcast_impl(cond, CALL_SITE);
+}
+
+// Companion mutex, see "Companion mutex and wait morphing"
+int my_pthread_mutex_lock(pthread_mutex_t *mutex) {
+    return mutex_lock_impl(mutex, 1);
+}
+
+int my_pthread_mutex_trylock(pthread_mutex_t *mutex) {
+    return mutex_trylock_impl(mutex, 1);
+}
+
+int my_pthread_mutex_unlock(pthread_mutex_t *mutex) {
+    return mutex_unlock_impl(mutex, 1);
+}
+
+// Eventcount, see "Eventcount"
+void my_pthread_eventcount_init(my_pthread_eventcount_t *ec) {
+    ultra_interposing(); // library state, not routing
+    ultra_detached_state_init(ultra_ec_state(ec), ec, CALL_SITE);
+}
+
+void my_pthread_eventcount_destroy(my_pthread_eventcount_t *ec) {
+    ultra_stats_release(ultra_ec_state(ec)->stats_slot);
+}
+
+my_pthread_eventcount_key_t my_pthread_eventcount_prepare_wait(my_pthread_eventcount_t *ec) {
+    return (my_pthread_eventcount_key_t)ultra_ec_prepare(ultra_ec_state(ec));
+}
+
+void my_pthread_eventcount_cancel_wait(my_pthread_eventcount_t *ec, my_pthread_eventcount_key_t key) {
+    ultra_trace_enter(ec, CALL_SITE);
+    ultra_ec_cancel(ultra_ec_state(ec), (ultra_waiter_t *)key);
+}
+
+void my_pthread_eventcount_commit_wait(my_pthread_eventcount_t *ec, my_pthread_eventcount_key_t key) {
+    ultra_trace_enter(ec, CALL_SITE);
+    ultra_trace_event(TRACE_WAIT_BEGIN, 0);
+    ultra_ec_commit(ultra_ec_state(ec), (ultra_waiter_t *)key);
+}
+
+void my_pthread_eventcount_notify_one(my_pthread_eventcount_t *ec) {
+    if (!ultra_ec_idle(ultra_ec_state(ec))) {
+        ultra_trace_enter(ec, CALL_SITE);
+        ultra_queue_signal(ultra_ec_state(ec));
+    }
+}
+
+void my_pthread_eventcount_notify_all(my_pthread_eventcount_t *ec) {
+    if (!ultra_ec_idle(ultra_ec_state(ec))) {
+        ultra_trace_enter(ec, CALL_SITE);
+        ultra_queue_broadcast(ultra_ec_state(ec));
+    }
+}
+
+// Semaphores and barriers, see "Semaphores" and "Barriers"
+int my_pthread_sem_init(sem_t *sem, int pshared, unsigned int value) {
+    return sem_init_impl(sem, pshared, value, 1, CALL_SITE);
+}
+
+int my_pthread_sem_destroy(sem_t *sem) {
+    return sem_destroy_impl(sem);
+}
+
+int my_pthread_sem_wait(sem_t *sem) {
+    return sem_wait_impl(sem, CLOCK_REALTIME, NULL, 1, CALL_SITE);
+}
+
+int my_pthread_sem_timedwait(sem_t *sem, const struct timespec *abstime) {
+    return sem_wait_impl(sem, CLOCK_REALTIME, abstime, 1, CALL_SITE);
+}
+
+int my_pthread_sem_clockwait(sem_t *sem, clockid_t clock_id, const struct timespec *abstime) {
+    return sem_wait_impl(sem, clock_id, abstime, 1, CALL_SITE);
+}
+
+int my_pthread_sem_post(sem_t *sem) {
+    return sem_post_impl(sem, 1, CALL_SITE);
+}
+
+int my_pthread_barrier_init(pthread_barrier_t *barrier, const pthread_barrierattr_t *attr, unsigned int count) {
+    return barrier_init_impl(barrier, attr, count, 1, CALL_SITE);
+}
+
+int my_pthread_barrier_destroy(pthread_barrier_t *barrier) {
+    return barrier_destroy_impl(barrier);
+}
+
+int my_pthread_barrier_wait(pthread_barrier_t *barrier) {
+    return barrier_wait_impl(barrier, CALL_SITE);
+}
+
+int my_pthread_cond_signal(pthread_cond_t *cond) {
+    return cond_signal_impl(cond, CALL_SITE);
+}
+
+// Initialize a condvar and give it its own spin state. Re-initializing an
+// address that still has a state (memory reused without destroy) replaces it.
+int my_pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr) {
+    return cond_init_impl(cond, attr, CALL_SITE);
+}
+
+// Destroy a condvar and recycle its spin state
+int my_pthread_cond_destroy(pthread_cond_t *cond) {
+    return cond_destroy_impl(cond);
+}
+
+// Interposed pthread symbols
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+    return cond_wait_impl(cond, mutex, CALL_SITE);
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime) {
+    return cond_clockwait_impl(cond, mutex, CONDVAR_CLOCK, abstime, CALL_SITE);
+}
+
+int pthread_cond_clockwait(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t clock_id,
+                           const struct timespec *abstime) {
+    return cond_clockwait_impl(cond, mutex, clock_id, abstime, CALL_SITE);
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond) {
+    return cond_broadcast_impl(cond, CALL_SITE);
+}
+
+int pthread_cond_signal(pthread_cond_t *cond) {
+    return cond_signal_impl(cond, CALL_SITE);
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr) {
+    return cond_init_impl(cond, attr, CALL_SITE);
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond) {
+    return cond_destroy_impl(cond);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+    return mutex_lock_impl(mutex, 0);
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+    return mutex_trylock_impl(mutex, 0);
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+    return mutex_unlock_impl(mutex, 0);
+}
+
+int sem_init(sem_t *sem, int pshared, unsigned int value) {
+    return sem_init_impl(sem, pshared, value, 0, CALL_SITE);
+}
+
+int sem_destroy(sem_t *sem) {
+    return sem_destroy_impl(sem);
+}
+
+int sem_wait(sem_t *sem) {
+    return sem_wait_impl(sem, CLOCK_REALTIME, NULL, 0, CALL_SITE);
+}
+
+int sem_timedwait(sem_t *sem, const struct timespec *abstime) {
+    return sem_wait_impl(sem, CLOCK_REALTIME, abstime, 0, CALL_SITE);
+}
+
+int sem_clockwait(sem_t *sem, clockid_t clock_id, const struct timespec *abstime) {
+    return sem_wait_impl(sem, clock_id, abstime, 0, CALL_SITE);
+}
+
+int sem_post(sem_t *sem) {
+    return sem_post_impl(sem, 0, CALL_SITE);
+}
+
+int pthread_barrier_init(pthread_barrier_t *barrier, const pthread_barrierattr_t *attr, unsigned int count) {
+    return barrier_init_impl(barrier, attr, count, 0, CALL_SITE);
+}
+
+int pthread_barrier_destroy(pthread_barrier_t *barrier) {
+    return barrier_destroy_impl(barrier);
+}
+
+int pthread_barrier_wait(pthread_barrier_t *barrier) {
+    return barrier_wait_impl(barrier, CALL_SITE);
+}
+
+// Library constructor
+__attribute__((constructor))
+static void library_init(void) {
+    openlog("libmy_pthread", LOG_PID, LOG_USER);
+
+    cached_spin_ticks = calculate_spin_ticks();
+
+    syslog(LOG_INFO, "libmy_pthread: ULTRA HIGH PERFORMANCE library loaded");
+    syslog(LOG_INFO, "libmy_pthread: Time base: %s, %.3f GHz", time_source_name(), ticks_per_sec / 1000000000.0);
+    syslog(LOG_INFO, "libmy_pthread: Spin budget: %lu ticks (target: %dμs)", cached_spin_ticks, TARGET_SPIN_TIME_US);
+    syslog(LOG_INFO, "libmy_pthread: Check frequency: EVERY iteration (minimum latency)");
+    syslog(LOG_INFO, "libmy_pthread: Wait strategy: %s", wait_strategy_name());
+    syslog(LOG_INFO, "libmy_pthread: Wait mode: %s", wait_mode == WAIT_MODE_HYBRID ? "spin-then-park" : "pure spin");
+    syslog(LOG_INFO, "libmy_pthread: Waiter queue: %s", queue_mode ? "per-waiter nodes" : "shared wait word");
+    if (stats_region->spinner_limit < 0) {
+        syslog(LOG_INFO, "libmy_pthread: Spinner pool: unlimited");
+    } else {
+        syslog(LOG_INFO, "libmy_pthread: Spinner pool: %d tokens (%s)", stats_region->spinner_limit,
+               spinner_override >= 0 ? "LIBMY_PTHREAD_SPINNERS" : "affinity/cgroup quota, re-read every second");
+    }
+    syslog(LOG_INFO, "libmy_pthread: Topology: %d socket(s), %d NUMA node(s), topology-aware spin %s",
+           nr_sockets, nr_nodes, topology_aware ? "on" : "off");
+    syslog(LOG_INFO, "libmy_pthread: Mutex: %s, %d socket(s)",
+           mutex_mode ? "adaptive spin + NUMA-aware queue" : "glibc", nr_sockets);
+    if (handoff_mode) {
+        syslog(LOG_INFO, "libmy_pthread: Mutex handoff on signal: enabled");
+    }
+    syslog(LOG_INFO, "libmy_pthread: Semaphores: %s, barriers: %s (fan-in %d)",
+           sem_mode ? "spin-then-park" : "glibc", barrier_mode ? "combining tree" : "glibc", BARRIER_FANIN);
+    if (stats_shm_name[0] != '\0') {
+        syslog(LOG_INFO, "libmy_pthread: Live stats: /dev/shm%s", stats_shm_name);
+    }
+    if (trace_enabled) {
+        if (trace_signal > 0) {
+            syslog(LOG_INFO, "libmy_pthread: Tracing: %u events per thread to %s, flushed at exit and on signal %d",
+                   trace_capacity, trace_dir, trace_signal);
+        } else {
+            syslog(LOG_INFO, "libmy_pthread: Tracing: %u events per thread to %s, flushed at exit",
+                   trace_capacity, trace_dir);
+        }
+    }
+    if (adaptive_enabled && wait_mode == WAIT_MODE_HYBRID) {
+        syslog(LOG_INFO, "libmy_pthread: Adaptive spin budget: %lu-%lu ticks",
+               adaptive_min_ticks, adaptive_max_ticks);
+    }
 
     my_pthread_init_spin_states();
 }
 
 // Performance statistics
 void my_pthread_spin_destroy(void) {
-    if (atomic_load(&initialized)) {
-        long total_successful = 0, total_failed = 0;
+    if (atomic_load(&initialized) && stats_region != NULL) {
+        unsigned long long total_successful = 0;
+        unsigned long long total_failed = 0;
 
-        for (int i = 0; i < ULTRA_HASH_SIZE; i++) {
-            total_successful += atomic_load(&spin_states[i].successful_spins);
-            total_failed += atomic_load(&spin_states[i].failed_spins);
+        for (int i = 0; i < STATS_MAX_SHARDS; i++) {
+            total_successful += atomic_load_explicit(&stats_region->shards[i].spin_hits, memory_order_relaxed);
+            total_failed += atomic_load_explicit(&stats_region->shards[i].spin_misses, memory_order_relaxed);
         }
 
         if (total_successful + total_failed > 0) {
-            syslog(LOG_INFO, "libmy_pthread: Success rate: %.1f%% (%ld/%ld)",
+            syslog(LOG_INFO, "libmy_pthread: Success rate: %.1f%% (%llu/%llu)",
                    (double)total_successful * 100.0 / (total_successful + total_failed),
                    total_successful, total_successful + total_failed);
         }
@@ -381,7 +4367,9 @@ void my_pthread_spin_destroy(void) {
 
 __attribute__((destructor))
 static void library_cleanup(void) {
+    ultra_trace_flush();
     my_pthread_spin_destroy();
+    ultra_stats_close();
     syslog(LOG_INFO, "libmy_pthread: ULTRA HIGH PERFORMANCE library unloaded");
     closelog();
 }
@@ -3,6 +3,7 @@
 #define LIBMY_PTHREAD_H
 
 #include <pthread.h>
+#include <semaphore.h>
 #include <time.h>
 #include <errno.h>
 
@@ -11,11 +12,88 @@ extern "C" {
 #endif
 
 // Public API - Override standard pthread condition variable functions
+// The shared object also defines pthread_cond_{init,destroy,wait,timedwait,
+// clockwait,signal,broadcast} itself, so unmodified binaries can use it via
+//   LD_PRELOAD=/path/to/libmy_pthread.so mysqld ...
+// Routing per process / call site is controlled through LIBMY_PTHREAD_PROCS,
+// LIBMY_PTHREAD_DENY_PROCS, LIBMY_PTHREAD_SITES and LIBMY_PTHREAD_DENY_SITES.
+// pthread_mutex_{lock,trylock,unlock} are interposed as well: default and
+// adaptive mutexes get an adaptive-spin, NUMA-aware lock (LIBMY_PTHREAD_MUTEX=0
+// turns that off), every other kind is passed through to glibc.
+// So are sem_{init,destroy,wait,timedwait,clockwait,post}: process-private
+// semaphores spin before they park (LIBMY_PTHREAD_SEM=0 turns that off); and
+// pthread_barrier_{init,destroy,wait}: process-private barriers become a
+// combining tree, O(log N) per arrival (LIBMY_PTHREAD_BARRIER=0 turns that off).
+// At most LIBMY_PTHREAD_SPINNERS threads spin at once (default: usable CPUs
+// minus one, following affinity and cgroup quota); the rest park at once.
+// Condvar waiters spin according to where the last signaller ran: not at
+// all against an SMT sibling, tightly within an LLC, with backoff across
+// sockets (LIBMY_PTHREAD_TOPOLOGY=0 spins the same everywhere).
+// Live counters are published in /dev/shm/libmy_pthread.<pid>; read them
+// with libmy_pthread_stat <pid>. LIBMY_PTHREAD_TRACE=1 (or =<dir>) records
+// every wait and signal per thread, written to <dir>/libmy_pthread.<pid>.<n>.trace
+// at exit and on SIGUSR2 (LIBMY_PTHREAD_TRACE_SIGNAL); libmy_pthread_trace
+// turns the file into Chrome trace JSON.
+// C++ code that wants the wait policy fixed at compile time can use the
+// header-only templates in libmy_pthread.hpp instead.
 int my_pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
 void my_pthread_init_spin_states();
 int my_pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime);
 int my_pthread_cond_broadcast(pthread_cond_t *cond);
 int my_pthread_cond_signal(pthread_cond_t *cond);
+int my_pthread_cond_clockwait(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t clock_id, const struct timespec *abstime);
+int my_pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr);
+int my_pthread_cond_destroy(pthread_cond_t *cond);
+
+// The same mutex, callable directly. It is also the companion for wait
+// morphing (LIBMY_PTHREAD_HANDOFF=1): a signal sent while holding a mutex
+// locked this way hands it straight to the woken waiter on unlock. Works on
+// ordinary pthread_mutex_t objects; a mutex locked with my_pthread_mutex_lock
+// must be unlocked with my_pthread_mutex_unlock.
+int my_pthread_mutex_lock(pthread_mutex_t *mutex);
+int my_pthread_mutex_trylock(pthread_mutex_t *mutex);
+int my_pthread_mutex_unlock(pthread_mutex_t *mutex);
+
+// Eventcount: sleep until a lock-free structure changes, without a mutex.
+// Producers call notify_one/notify_all after publishing; consumers do
+//   while (!try_pop(q, &item)) {
+//       my_pthread_eventcount_key_t key = my_pthread_eventcount_prepare_wait(&ec);
+//       if (try_pop(q, &item)) {
+//           my_pthread_eventcount_cancel_wait(&ec, key);
+//           break;
+//       }
+//       my_pthread_eventcount_commit_wait(&ec, key);
+//   }
+// Every prepare_wait is followed by exactly one cancel_wait or commit_wait
+// on the same thread. commit_wait may return without a notify; re-check.
+// A notify with nobody waiting costs a fence and one load.
+typedef struct {
+    char __opaque[128];
+} __attribute__((aligned(64))) my_pthread_eventcount_t;
+typedef struct my_pthread_eventcount_waiter *my_pthread_eventcount_key_t;
+
+void my_pthread_eventcount_init(my_pthread_eventcount_t *ec);
+void my_pthread_eventcount_destroy(my_pthread_eventcount_t *ec);
+my_pthread_eventcount_key_t my_pthread_eventcount_prepare_wait(my_pthread_eventcount_t *ec);
+void my_pthread_eventcount_cancel_wait(my_pthread_eventcount_t *ec, my_pthread_eventcount_key_t key);
+void my_pthread_eventcount_commit_wait(my_pthread_eventcount_t *ec, my_pthread_eventcount_key_t key);
+void my_pthread_eventcount_notify_one(my_pthread_eventcount_t *ec);
+void my_pthread_eventcount_notify_all(my_pthread_eventcount_t *ec);
+
+// Semaphores and barriers, callable directly: they use the spin paths
+// whatever the routing lists say. Semaphores keep glibc's sem_t layout, so
+// sem_trywait and sem_getvalue work on them unchanged, and they may be
+// mixed with glibc's own calls. A barrier must be initialized, waited on
+// and destroyed through the same library.
+int my_pthread_sem_init(sem_t *sem, int pshared, unsigned int value);
+int my_pthread_sem_destroy(sem_t *sem);
+int my_pthread_sem_wait(sem_t *sem);
+int my_pthread_sem_timedwait(sem_t *sem, const struct timespec *abstime);
+int my_pthread_sem_clockwait(sem_t *sem, clockid_t clock_id, const struct timespec *abstime);
+int my_pthread_sem_post(sem_t *sem);
+int my_pthread_barrier_init(pthread_barrier_t *barrier, const pthread_barrierattr_t *attr, unsigned int count);
+int my_pthread_barrier_destroy(pthread_barrier_t *barrier);
+int my_pthread_barrier_wait(pthread_barrier_t *barrier);
 
 void my_pthread_spin_destroy();
 
@@ -27,6 +105,5 @@ void my_pthread_spin_destroy();
 // Configuration constants
 #define TARGET_SPIN_CYCLES 180000
 #define ADAPTIVE_HASH_SIZE 1024
-#define MAX_SIGNAL_COUNT 1000
 
 #endif /* LIBMY_PTHREAD_H */
@@ -0,0 +1,386 @@
+// libmy_pthread.hpp - header-only C++17 spin condvar and mutex
+//
+// Compile-time counterparts of libmy_pthread's condvar and mutex, for code
+// that wants to pick spin budget, pause instruction, park strategy and
+// statistics per call site instead of through environment variables:
+//
+//   using fast_cv = my_pthread::basic_spin_condvar<my_pthread::wait_policy<20000>>;
+//   my_pthread::spin_mutex m;
+//   fast_cv cv;
+//
+//   std::unique_lock<my_pthread::spin_mutex> lock(m);
+//   cv.wait(lock, [&] { return ready; });
+//
+// basic_spin_condvar models std::condition_variable_any (it works with any
+// BasicLockable) and basic_spin_mutex models Lockable, so both work with
+// std::unique_lock, std::lock_guard and std::scoped_lock. Every policy
+// decision is an `if constexpr`; the hot paths contain no indirect calls and
+// no branches on configuration. The wait/wake protocol, parking and the lock
+// word are the C library's own (libmy_pthread_core.h); nothing here needs
+// libmy_pthread.so at run time.
+#ifndef LIBMY_PTHREAD_HPP
+#define LIBMY_PTHREAD_HPP
+
+#if __cplusplus < 201703L
+#error "libmy_pthread.hpp needs C++17"
+#endif
+
+#include "libmy_pthread_core.h"
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <type_traits>
+
+namespace my_pthread {
+
+// What a spinner does between polls
+enum class pause_kind {
+    barrier, // compiler barrier only
+    pause,   // x86 pause / arm64 yield
+    yield,   // sched_yield()
+};
+
+// What a waiter does once its spin budget is spent
+enum class park_kind {
+    futex,   // sleep in the kernel
+    yield,   // keep polling with sched_yield(), never sleep
+};
+
+// Spin time base
+enum class clock_kind {
+    tsc,       // rdtsc / cntvct_el0, calibrated once per process (assumes invariant TSC)
+    monotonic, // clock_gettime(CLOCK_MONOTONIC)
+};
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+inline constexpr clock_kind default_clock = clock_kind::tsc;
+#else
+inline constexpr clock_kind default_clock = clock_kind::monotonic;
+#endif
+
+// Wait policy: everything a waiter decides, fixed at compile time.
+// SpinNs is the spin budget in nanoseconds before parking, 0 = park at once.
+template <uint64_t SpinNs, pause_kind Pause = pause_kind::pause, park_kind Park = park_kind::futex,
+          clock_kind Clock = default_clock>
+struct wait_policy {
+    static constexpr uint64_t spin_ns = SpinNs;
+    static constexpr pause_kind pause = Pause;
+    static constexpr park_kind park = Park;
+    static constexpr clock_kind clock = Clock;
+};
+
+using default_wait_policy = wait_policy<10000>;  // libmy_pthread's TARGET_SPIN_TIME_US
+using park_wait_policy = wait_policy<0>;         // plain futex condvar/mutex
+using spin_wait_policy = wait_policy<100000, pause_kind::pause, park_kind::yield>;
+
+// Stats policies. The hooks run on slow paths only: after a failed fast
+// path, a spin phase, a park, a wait or a notify.
+struct no_stats {
+    static constexpr void spin(bool, uint64_t) noexcept {}
+    static constexpr void park() noexcept {}
+    static constexpr void wait(bool) noexcept {}
+    static constexpr void notify(bool) noexcept {}
+    static constexpr void contended() noexcept {}
+};
+
+// Per-object counters; spin_ticks is in the policy's time base
+struct counting_stats {
+    std::atomic<uint64_t> spin_hits{0};
+    std::atomic<uint64_t> spin_misses{0};
+    std::atomic<uint64_t> spin_ticks{0};
+    std::atomic<uint64_t> parks{0};
+    std::atomic<uint64_t> waits{0};
+    std::atomic<uint64_t> timeouts{0};
+    std::atomic<uint64_t> notifies{0};
+    std::atomic<uint64_t> empty_notifies{0}; // notifies that found nobody to wake
+    std::atomic<uint64_t> contended_locks{0};
+
+    void spin(bool hit, uint64_t ticks) noexcept {
+        (hit ? spin_hits : spin_misses).fetch_add(1, std::memory_order_relaxed);
+        spin_ticks.fetch_add(ticks, std::memory_order_relaxed);
+    }
+    void park() noexcept { parks.fetch_add(1, std::memory_order_relaxed); }
+    void wait(bool woken) noexcept {
+        waits.fetch_add(1, std::memory_order_relaxed);
+        if (!woken) {
+            timeouts.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    void notify(bool empty) noexcept {
+        notifies.fetch_add(1, std::memory_order_relaxed);
+        if (empty) {
+            empty_notifies.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    void contended() noexcept { contended_locks.fetch_add(1, std::memory_order_relaxed); }
+};
+
+namespace detail {
+
+template <clock_kind Clock>
+struct time_base;
+
+template <>
+struct time_base<clock_kind::monotonic> {
+    static uint64_t now() noexcept { return ultra_core_monotonic_ns(); }
+    static uint64_t from_ns(uint64_t ns) noexcept { return ns; }
+};
+
+template <>
+struct time_base<clock_kind::tsc> {
+    static uint64_t now() noexcept { return ultra_core_read_tsc(); }
+    // Fixed point ticks per ns (32 fractional bits), measured on first use
+    static uint64_t from_ns(uint64_t ns) noexcept {
+        static const uint64_t scale = calibrate();
+        return ns < (UINT64_MAX >> 32) ? (ns * scale) >> 32 : UINT64_MAX / 2;
+    }
+
+private:
+    static uint64_t calibrate() noexcept {
+#if defined(__aarch64__)
+        uint64_t hz;
+        __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(hz));
+#else
+        uint64_t hz = ultra_core_calibrate_tsc(2000000);
+#endif
+        return hz != 0 ? (hz << 32) / 1000000000ULL : 1ULL << 32;
+    }
+};
+
+template <pause_kind Pause>
+inline void relax() noexcept {
+    if constexpr (Pause == pause_kind::pause) {
+        ultra_core_cpu_relax();
+    } else if constexpr (Pause == pause_kind::yield) {
+        sched_yield();
+    } else {
+        __asm__ __volatile__("" ::: "memory");
+    }
+}
+
+template <class Rep, class Period>
+inline struct timespec to_timespec(std::chrono::duration<Rep, Period> d) noexcept {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+    ts.tv_nsec = static_cast<long>(ns % 1000000000);
+    return ts;
+}
+
+inline bool deadline_passed(const struct timespec *abstime, int realtime) noexcept {
+    struct timespec now;
+    clock_gettime(realtime ? CLOCK_REALTIME : CLOCK_MONOTONIC, &now);
+    return now.tv_sec > abstime->tv_sec ||
+           (now.tv_sec == abstime->tv_sec && now.tv_nsec >= abstime->tv_nsec);
+}
+
+} // namespace detail
+
+// Mutex on glibc's 0/1/2 lock word: CAS fast path, a spin phase of
+// WaitPolicy::spin_ns, then the policy's park.
+template <class WaitPolicy = default_wait_policy, class StatsPolicy = no_stats>
+class basic_spin_mutex : private StatsPolicy {
+public:
+    using wait_policy_type = WaitPolicy;
+    using stats_policy_type = StatsPolicy;
+
+    constexpr basic_spin_mutex() noexcept = default;
+    basic_spin_mutex(const basic_spin_mutex &) = delete;
+    basic_spin_mutex &operator=(const basic_spin_mutex &) = delete;
+
+    void lock() noexcept {
+        if (ultra_core_lock_try(&word_)) {
+            return;
+        }
+        lock_slow();
+    }
+
+    bool try_lock() noexcept { return ultra_core_lock_try(&word_); }
+
+    void unlock() noexcept { ultra_core_unlock(&word_); }
+
+    StatsPolicy &stats() noexcept { return *this; }
+
+private:
+    using time_base = detail::time_base<WaitPolicy::clock>;
+
+    void lock_slow() noexcept {
+        stats().contended();
+        if constexpr (WaitPolicy::spin_ns != 0) {
+            uint64_t start = time_base::now();
+            uint64_t deadline = start + time_base::from_ns(WaitPolicy::spin_ns);
+            do {
+                if (__atomic_load_n(&word_, __ATOMIC_RELAXED) == 0 && ultra_core_lock_try(&word_)) {
+                    stats().spin(true, time_base::now() - start);
+                    return;
+                }
+                detail::relax<WaitPolicy::pause>();
+            } while (time_base::now() < deadline);
+            stats().spin(false, time_base::now() - start);
+        }
+        stats().park();
+        if constexpr (WaitPolicy::park == park_kind::futex) {
+            ultra_core_lock_park(&word_);
+        } else {
+            while (!ultra_core_lock_try(&word_)) {
+                sched_yield();
+            }
+        }
+    }
+
+    uint32_t word_ = 0;
+};
+
+// Condvar on libmy_pthread's wait word: register while holding the lock,
+// spin for WaitPolicy::spin_ns, then the policy's park. Wakeups are exact
+// (a signal wakes one registered waiter, a broadcast the ones registered
+// before it); spurious returns only come from wait_until's deadline.
+template <class WaitPolicy = default_wait_policy, class StatsPolicy = no_stats>
+class alignas(64) basic_spin_condvar : private StatsPolicy {
+public:
+    using wait_policy_type = WaitPolicy;
+    using stats_policy_type = StatsPolicy;
+
+    constexpr basic_spin_condvar() noexcept = default;
+    basic_spin_condvar(const basic_spin_condvar &) = delete;
+    basic_spin_condvar &operator=(const basic_spin_condvar &) = delete;
+
+    void notify_one() noexcept {
+        int any = ultra_core_ww_signal(&word_);
+        stats().notify(!any);
+        if constexpr (WaitPolicy::park == park_kind::futex) {
+            if (any) {
+                ultra_core_wake_parked(&seq_, &parked_, 1);
+            }
+        }
+    }
+
+    void notify_all() noexcept {
+        int any = ultra_core_ww_broadcast(&word_);
+        stats().notify(!any);
+        if constexpr (WaitPolicy::park == park_kind::futex) {
+            if (any) {
+                ultra_core_wake_parked(&seq_, &parked_, INT_MAX);
+            }
+        }
+    }
+
+    template <class Lock>
+    void wait(Lock &lock) {
+        uint32_t gen = ultra_core_ww_register(&word_);
+        lock.unlock();
+        block(gen, UINT64_MAX, nullptr, 0);
+        stats().wait(true);
+        lock.lock();
+    }
+
+    template <class Lock, class Predicate>
+    void wait(Lock &lock, Predicate pred) {
+        while (!pred()) {
+            wait(lock);
+        }
+    }
+
+    template <class Lock, class Clock, class Duration>
+    std::cv_status wait_until(Lock &lock, const std::chrono::time_point<Clock, Duration> &deadline) {
+        using std::chrono::steady_clock;
+        using std::chrono::system_clock;
+
+        // The futex takes absolute CLOCK_REALTIME or CLOCK_MONOTONIC deadlines
+        // (libstdc++'s steady_clock); other clocks go through steady_clock
+        auto left = deadline - Clock::now();
+        struct timespec abstime;
+        int realtime = std::is_same_v<Clock, system_clock>;
+        if constexpr (std::is_same_v<Clock, system_clock> || std::is_same_v<Clock, steady_clock>) {
+            abstime = detail::to_timespec(deadline.time_since_epoch());
+        } else {
+            abstime = detail::to_timespec((steady_clock::now() + left).time_since_epoch());
+        }
+        auto left_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+
+        uint32_t gen = ultra_core_ww_register(&word_);
+        lock.unlock();
+        bool woken = left_ns > 0 && block(gen, static_cast<uint64_t>(left_ns), &abstime, realtime);
+        if (!woken) {
+            woken = ultra_core_ww_cancel(&word_, gen); // a signal may have raced with the deadline
+        }
+        stats().wait(woken);
+        lock.lock();
+        return woken || Clock::now() < deadline ? std::cv_status::no_timeout : std::cv_status::timeout;
+    }
+
+    template <class Lock, class Clock, class Duration, class Predicate>
+    bool wait_until(Lock &lock, const std::chrono::time_point<Clock, Duration> &deadline, Predicate pred) {
+        while (!pred()) {
+            if (wait_until(lock, deadline) == std::cv_status::timeout) {
+                return pred();
+            }
+        }
+        return true;
+    }
+
+    template <class Lock, class Rep, class Period>
+    std::cv_status wait_for(Lock &lock, const std::chrono::duration<Rep, Period> &timeout) {
+        return wait_until(lock, std::chrono::steady_clock::now() +
+                                    std::chrono::ceil<std::chrono::steady_clock::duration>(timeout));
+    }
+
+    template <class Lock, class Rep, class Period, class Predicate>
+    bool wait_for(Lock &lock, const std::chrono::duration<Rep, Period> &timeout, Predicate pred) {
+        return wait_until(lock, std::chrono::steady_clock::now() +
+                                    std::chrono::ceil<std::chrono::steady_clock::duration>(timeout),
+                          std::move(pred));
+    }
+
+    StatsPolicy &stats() noexcept { return *this; }
+
+private:
+    using time_base = detail::time_base<WaitPolicy::clock>;
+
+    // Spin for at most max_spin_ns, then park until woken or abstime (NULL:
+    // no deadline) passes. Returns whether we were woken.
+    bool block(uint32_t gen, uint64_t max_spin_ns, const struct timespec *abstime, int realtime) noexcept {
+        if constexpr (WaitPolicy::spin_ns != 0) {
+            uint64_t start = time_base::now();
+            uint64_t deadline = start + time_base::from_ns(std::min(WaitPolicy::spin_ns, max_spin_ns));
+            do {
+                if (ultra_core_ww_try_wake(&word_, gen)) {
+                    stats().spin(true, time_base::now() - start);
+                    return true;
+                }
+                detail::relax<WaitPolicy::pause>();
+            } while (time_base::now() < deadline);
+            stats().spin(false, time_base::now() - start);
+        }
+        stats().park();
+        if constexpr (WaitPolicy::park == park_kind::futex) {
+            return ultra_core_park(&word_, &seq_, &parked_, gen, abstime, realtime) == 0;
+        } else {
+            for (;;) {
+                if (ultra_core_ww_try_wake(&word_, gen)) {
+                    return true;
+                }
+                if (abstime != nullptr && detail::deadline_passed(abstime, realtime)) {
+                    return false;
+                }
+                sched_yield();
+            }
+        }
+    }
+
+    // One cache line: everything waiters and notifiers touch
+    uint64_t word_ = 0;   // wait word, see libmy_pthread_core.h
+    uint32_t seq_ = 0;    // futex word, bumped on every wake of parked waiters
+    int32_t parked_ = 0;  // waiters blocked in FUTEX_WAIT
+};
+
+using spin_mutex = basic_spin_mutex<>;
+using spin_condvar = basic_spin_condvar<>;
+
+} // namespace my_pthread
+
+#endif /* LIBMY_PTHREAD_HPP */
@@ -0,0 +1,263 @@
+// libmy_pthread_core.h - wait/wake algorithms shared by libmy_pthread.c and
+// the C++ templates in libmy_pthread.hpp
+// Everything works on plain integers through the __atomic builtins, so the
+// same code compiles as C and as C++. Nothing here reads configuration,
+// allocates or counts; callers wrap it with their own budgets and stats.
+#ifndef LIBMY_PTHREAD_CORE_H
+#define LIBMY_PTHREAD_CORE_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// Time base
+// ---------------------------------------------------------------------------
+static inline uint64_t ultra_core_monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t ultra_core_read_tsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    // "=A" only means edx:eax on i386; on x86_64 it picks one 64-bit register
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+    uint64_t val;
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(val) :: "memory");
+    return val;
+#else
+    return 0;
+#endif
+}
+
+// Does the counter behind ultra_core_read_tsc() run at a constant rate?
+// x86: CPUID.80000007H:EDX[8]; the arm64 generic timer always does.
+static inline int ultra_core_invariant_tsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007) {
+        return 0;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;
+#elif defined(__aarch64__)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+// One calibration round: counter ticks per second over ~window_ns.
+// Samples are taken back to back so preemption between the clock read and
+// the counter read only shows up as a disagreement between rounds.
+static inline uint64_t ultra_core_calibrate_tsc(uint64_t window_ns) {
+    uint64_t ns_start = ultra_core_monotonic_ns();
+    uint64_t tsc_start = ultra_core_read_tsc();
+    uint64_t ns_end, tsc_end;
+
+    do {
+        ns_end = ultra_core_monotonic_ns();
+        tsc_end = ultra_core_read_tsc();
+    } while (ns_end - ns_start < window_ns);
+
+    if (tsc_end <= tsc_start) {
+        return 0;
+    }
+    return (uint64_t)((double)(tsc_end - tsc_start) * 1e9 / (double)(ns_end - ns_start));
+}
+
+static inline void ultra_core_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Private futexes - none of these words live in shared memory.
+// Absolute deadline on CLOCK_MONOTONIC, or CLOCK_REALTIME when realtime is
+// set; the kernel tracks the deadline (and realtime clock jumps) itself.
+// ---------------------------------------------------------------------------
+static inline long ultra_core_futex_wait(uint32_t *uaddr, uint32_t expected,
+                                         const struct timespec *abstime, int realtime) {
+    int op = FUTEX_WAIT_BITSET_PRIVATE | (realtime ? FUTEX_CLOCK_REALTIME : 0);
+    return syscall(SYS_futex, uaddr, op, expected, abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static inline void ultra_core_futex_wake(uint32_t *uaddr, int count) {
+    syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+// ---------------------------------------------------------------------------
+// Condvar wait word.
+// One CAS-able word carries the whole wake protocol:
+//   bits 40-63  broadcast generation - a waiter registered in generation g is
+//               woken once the word's generation differs from g
+//   bits 20-39  registered waiters not yet woken
+//   bits  0-19  signal credits, never more than registered waiters
+// ---------------------------------------------------------------------------
+#define WW_SIGNALS_BITS  20
+#define WW_WAITERS_SHIFT 20
+#define WW_GEN_SHIFT     40
+#define WW_FIELD_MASK    ((1ULL << 20) - 1)
+#define WW_SIGNAL        1ULL
+#define WW_WAITER        (1ULL << WW_WAITERS_SHIFT)
+#define WW_SIGNALS(w)    ((w) & WW_FIELD_MASK)
+#define WW_WAITERS(w)    (((w) >> WW_WAITERS_SHIFT) & WW_FIELD_MASK)
+#define WW_GEN(w)        ((uint32_t)((w) >> WW_GEN_SHIFT))
+
+// Register the calling thread as a waiter. Must run while the caller still
+// holds the mutex, so a signal issued after the unlock is guaranteed to find
+// it. Returns the broadcast generation the waiter belongs to.
+static inline uint32_t ultra_core_ww_register(uint64_t *ww) {
+    return WW_GEN(__atomic_fetch_add(ww, WW_WAITER, __ATOMIC_SEQ_CST));
+}
+
+// Returns 1 if a broadcast has moved past our generation or a signal credit
+// could be consumed (which also retires us as a waiter).
+static inline int ultra_core_ww_try_wake(uint64_t *ww, uint32_t gen) {
+    uint64_t word = __atomic_load_n(ww, __ATOMIC_SEQ_CST);
+
+    for (;;) {
+        if (WW_GEN(word) != gen) {
+            return 1; // broadcast already retired us
+        }
+        if (WW_SIGNALS(word) == 0) {
+            return 0;
+        }
+        // Consume the credit and leave the waiter count in one step
+        if (__atomic_compare_exchange_n(ww, &word, word - WW_SIGNAL - WW_WAITER, 1,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+}
+
+// Deregister after a timeout or an unsuccessful spin. Returns 1 if we
+// turned out to be woken after all: by a broadcast, or because every
+// remaining waiter is owed a signal - leaving then would strand that credit,
+// so we take it instead.
+static inline int ultra_core_ww_cancel(uint64_t *ww, uint32_t gen) {
+    uint64_t word = __atomic_load_n(ww, __ATOMIC_RELAXED);
+
+    for (;;) {
+        if (WW_GEN(word) != gen) {
+            return 1;
+        }
+        uint64_t next = word - WW_WAITER;
+        int woken = WW_SIGNALS(word) >= WW_WAITERS(word);
+        if (woken) {
+            next -= WW_SIGNAL;
+        }
+        if (__atomic_compare_exchange_n(ww, &word, next, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return woken;
+        }
+    }
+}
+
+// Add one credit if some registered waiter is not already owed one.
+// Returns 0 if there was nobody to signal.
+static inline int ultra_core_ww_signal(uint64_t *ww) {
+    uint64_t word = __atomic_load_n(ww, __ATOMIC_SEQ_CST);
+
+    do {
+        if (WW_SIGNALS(word) >= WW_WAITERS(word)) {
+            return 0; // every waiter already has a wakeup coming
+        }
+    // seq_cst pairs with the parked handshake in ultra_core_park
+    } while (!__atomic_compare_exchange_n(ww, &word, word + WW_SIGNAL, 1,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return 1;
+}
+
+// Wake exactly the waiters registered so far: bumping the generation
+// retires all of them at once and clears their credits, so nothing is left
+// over for later arrivals. Returns 0 if there was nobody to wake.
+static inline int ultra_core_ww_broadcast(uint64_t *ww) {
+    uint64_t word = __atomic_load_n(ww, __ATOMIC_SEQ_CST);
+
+    do {
+        if (WW_WAITERS(word) == 0) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(ww, &word, (uint64_t)(WW_GEN(word) + 1) << WW_GEN_SHIFT, 1,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return 1;
+}
+
+// Park on seq until woken through the wait word.
+// The waiter publishes itself in *parked before sampling *seq, and the
+// signaller publishes its credit before checking *parked, so (both sides
+// being seq_cst) either the waiter sees the credit or the signaller sees
+// the waiter and bumps *seq - no wakeup is lost.
+// Returns 0 once woken, ETIMEDOUT if abstime passed first (NULL blocks
+// indefinitely); the caller still owns the waiter registration then.
+static inline int ultra_core_park(uint64_t *ww, uint32_t *seq, int32_t *parked, uint32_t gen,
+                                  const struct timespec *abstime, int realtime) {
+    int result = ETIMEDOUT;
+
+    __atomic_fetch_add(parked, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        uint32_t seen = __atomic_load_n(seq, __ATOMIC_SEQ_CST);
+        if (ultra_core_ww_try_wake(ww, gen)) {
+            result = 0;
+            break;
+        }
+        if (ultra_core_futex_wait(seq, seen, abstime, realtime) == -1 && errno == ETIMEDOUT) {
+            // One last look: a signal may have raced with the timeout
+            if (ultra_core_ww_try_wake(ww, gen)) {
+                result = 0;
+            }
+            break;
+        }
+    }
+    __atomic_fetch_sub(parked, 1, __ATOMIC_RELAXED);
+
+    return result;
+}
+
+// Wake parked waiters, but only pay for the syscall when someone is parked
+static inline void ultra_core_wake_parked(uint32_t *seq, int32_t *parked, int count) {
+    if (__atomic_load_n(parked, __ATOMIC_SEQ_CST) > 0) {
+        __atomic_fetch_add(seq, 1, __ATOMIC_SEQ_CST);
+        ultra_core_futex_wake(seq, count);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Mutex lock word, glibc's protocol: 0 free, 1 locked, 2 locked with
+// (possible) sleepers. Compatible with pthread_mutex_t's __lock.
+// ---------------------------------------------------------------------------
+static inline int ultra_core_lock_try(uint32_t *word) {
+    uint32_t expected = 0;
+    return __atomic_compare_exchange_n(word, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// Lock, sleeping in the kernel while it is taken
+static inline void ultra_core_lock_park(uint32_t *word) {
+    while (__atomic_exchange_n(word, 2, __ATOMIC_ACQUIRE) != 0) {
+        ultra_core_futex_wait(word, 2, NULL, 0);
+    }
+}
+
+static inline void ultra_core_unlock(uint32_t *word) {
+    if (__atomic_exchange_n(word, 0, __ATOMIC_RELEASE) > 1) {
+        ultra_core_futex_wake(word, 1);
+    }
+}
+
+#endif /* LIBMY_PTHREAD_CORE_H */
@@ -0,0 +1,278 @@
+// libmy_pthread_stat.c - print the live statistics of a process using libmy_pthread
+//
+//   gcc -O2 -o libmy_pthread_stat libmy_pthread_stat.c
+//   libmy_pthread_stat [-n TOP] [-i SECONDS] PID
+//
+// Reads /dev/shm/libmy_pthread.<PID> (see libmy_pthread_stats.h) and prints
+// the process-wide counters, the wait-to-wake and spin-duration histograms,
+// and the TOP condvars by spin time burned. With -i it keeps sampling and
+// prints what happened in each interval instead of totals since start.
+#include "libmy_pthread_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+typedef struct {
+    unsigned long long waits, spin_hits, spin_misses, parks, timeouts;
+    unsigned long long signals, broadcasts, empty_signals, spin_ticks, spin_iterations, spin_denied;
+    unsigned long long topology_waits[4];
+    unsigned long long wake_hist[STATS_HIST_BUCKETS];
+    unsigned long long spin_hist[STATS_HIST_BUCKETS];
+} totals_t;
+
+typedef struct {
+    unsigned long long cond, waits, spin_hits, spin_misses, parks, signals, empty_signals, spin_ticks;
+    char label[STATS_LABEL_LEN];
+} cond_sample_t;
+
+static unsigned long long load(atomic_ullong *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static void sum_shards(ultra_stats_region_t *region, totals_t *t) {
+    memset(t, 0, sizeof(*t));
+    for (int i = 0; i < STATS_MAX_SHARDS; i++) {
+        ultra_stats_shard_t *s = &region->shards[i];
+        t->waits += load(&s->waits);
+        t->spin_hits += load(&s->spin_hits);
+        t->spin_misses += load(&s->spin_misses);
+        t->parks += load(&s->parks);
+        t->timeouts += load(&s->timeouts);
+        t->signals += load(&s->signals);
+        t->broadcasts += load(&s->broadcasts);
+        t->empty_signals += load(&s->empty_signals);
+        t->spin_ticks += load(&s->spin_ticks);
+        t->spin_iterations += load(&s->spin_iterations);
+        t->spin_denied += load(&s->spin_denied);
+        for (int r = 0; r < 4; r++) {
+            t->topology_waits[r] += load(&s->topology_waits[r]);
+        }
+        for (int b = 0; b < STATS_HIST_BUCKETS; b++) {
+            t->wake_hist[b] += load(&s->wake_hist[b]);
+            t->spin_hist[b] += load(&s->spin_hist[b]);
+        }
+    }
+}
+
+static void sample_conds(ultra_stats_region_t *region, cond_sample_t *out) {
+    for (int i = 0; i < STATS_MAX_CONDVARS; i++) {
+        ultra_stats_cond_t *c = &region->conds[i];
+        cond_sample_t *o = &out[i];
+        o->cond = atomic_load_explicit(&c->cond, memory_order_acquire);
+        o->waits = load(&c->waits);
+        o->spin_hits = load(&c->spin_hits);
+        o->spin_misses = load(&c->spin_misses);
+        o->parks = load(&c->parks);
+        o->signals = load(&c->signals);
+        o->empty_signals = load(&c->empty_signals);
+        o->spin_ticks = load(&c->spin_ticks);
+        memcpy(o->label, c->label, sizeof(o->label));
+        o->label[sizeof(o->label) - 1] = '\0';
+    }
+}
+
+// Human-readable duration for a tick count
+static const char *fmt_ticks(unsigned long long ticks, double ticks_per_sec, char *buf, size_t len) {
+    double ns = (double)ticks * 1e9 / ticks_per_sec;
+
+    if (ns < 10) {
+        snprintf(buf, len, "%.1fns", ns);
+    } else if (ns < 1e3) {
+        snprintf(buf, len, "%.0fns", ns);
+    } else if (ns < 1e6) {
+        snprintf(buf, len, "%.1fus", ns / 1e3);
+    } else if (ns < 1e9) {
+        snprintf(buf, len, "%.1fms", ns / 1e6);
+    } else {
+        snprintf(buf, len, "%.2fs", ns / 1e9);
+    }
+    return buf;
+}
+
+static void print_hist(const char *title, const unsigned long long *hist, double ticks_per_sec) {
+    unsigned long long total = 0, peak = 0;
+    int first = -1, last = -1;
+
+    for (int b = 0; b < STATS_HIST_BUCKETS; b++) {
+        total += hist[b];
+        if (hist[b] > peak) {
+            peak = hist[b];
+        }
+        if (hist[b] != 0) {
+            if (first < 0) {
+                first = b;
+            }
+            last = b;
+        }
+    }
+    printf("%s (%llu samples)\n", title, total);
+    for (int b = first; b >= 0 && b <= last; b++) {
+        char lo[16], hi[16];
+        int bar = (int)(hist[b] * 40 / peak);
+        printf("  %8s - %-8s %12llu %5.1f%% %.*s\n",
+               fmt_ticks(1ULL << b, ticks_per_sec, lo, sizeof(lo)),
+               fmt_ticks(2ULL << b, ticks_per_sec, hi, sizeof(hi)),
+               hist[b], 100.0 * hist[b] / total, bar,
+               "########################################");
+    }
+}
+
+// Most spin time first; idle condvars by activity, empty slots last
+static int by_spin_ticks(const void *a, const void *b) {
+    const cond_sample_t *x = a, *y = b;
+
+    if (x->spin_ticks != y->spin_ticks) {
+        return x->spin_ticks < y->spin_ticks ? 1 : -1;
+    }
+    if (x->waits != y->waits) {
+        return x->waits < y->waits ? 1 : -1;
+    }
+    return x->signals < y->signals ? 1 : x->signals > y->signals ? -1 : 0;
+}
+
+static void report(ultra_stats_region_t *region, const totals_t *now, const totals_t *then,
+                   cond_sample_t *conds, const cond_sample_t *prev, int top) {
+    double tps = (double)region->ticks_per_sec;
+    totals_t d = *now;
+    char buf[16];
+
+    if (then != NULL) {
+        unsigned long long *dp = (unsigned long long *)&d;
+        const unsigned long long *tp = (const unsigned long long *)then;
+        for (size_t i = 0; i < sizeof(d) / sizeof(*dp); i++) {
+            dp[i] -= tp[i];
+        }
+        for (int i = 0; i < STATS_MAX_CONDVARS; i++) {
+            // A slot reused by another condvar starts over
+            if (conds[i].cond == prev[i].cond && conds[i].waits >= prev[i].waits) {
+                conds[i].waits -= prev[i].waits;
+                conds[i].spin_hits -= prev[i].spin_hits;
+                conds[i].spin_misses -= prev[i].spin_misses;
+                conds[i].parks -= prev[i].parks;
+                conds[i].signals -= prev[i].signals;
+                conds[i].empty_signals -= prev[i].empty_signals;
+                conds[i].spin_ticks -= prev[i].spin_ticks;
+            }
+        }
+    }
+
+    unsigned long long spins = d.spin_hits + d.spin_misses;
+    printf("pid %d, time base %s\n", region->pid, region->time_source);
+    printf("waits %llu  spin hits %llu (%.1f%%)  spin misses %llu  parks %llu  timeouts %llu\n",
+           d.waits, d.spin_hits, spins ? 100.0 * d.spin_hits / spins : 0.0, d.spin_misses,
+           d.parks, d.timeouts);
+    printf("signals %llu  broadcasts %llu  with no waiter %llu\n",
+           d.signals, d.broadcasts, d.empty_signals);
+    printf("spin CPU burned %s over %llu polls", fmt_ticks(d.spin_ticks, tps, buf, sizeof(buf)),
+           d.spin_iterations);
+    if (d.spin_hits != 0) {
+        printf(", %s per spin hit", fmt_ticks(d.spin_ticks / d.spin_hits, tps, buf, sizeof(buf)));
+    }
+    printf("\n");
+    if (region->spinner_limit < 0) {
+        printf("spinner pool unlimited");
+    } else {
+        printf("spinner pool %d tokens", region->spinner_limit);
+        if (region->spinner_cpus != 0) {
+            printf(" (affinity %d CPUs", region->spinner_cpus);
+            if (region->spinner_quota != 0) {
+                printf(", cgroup quota %d", region->spinner_quota);
+            }
+            printf(")");
+        }
+    }
+    printf(", spins denied %llu\n", d.spin_denied);
+    printf("waiter vs last signaller: same core %llu  same LLC %llu  same socket %llu  remote %llu\n\n",
+           d.topology_waits[0], d.topology_waits[1], d.topology_waits[2], d.topology_waits[3]);
+    print_hist("wait-to-wake latency", d.wake_hist, tps);
+    print_hist("spin duration", d.spin_hist, tps);
+
+    // Free slots sort to the end unless they still hold counts from a
+    // destroyed condvar, which are worth seeing in a delta anyway
+    qsort(conds, STATS_MAX_CONDVARS, sizeof(*conds), by_spin_ticks);
+    printf("\n%-18s %-32s %10s %10s %7s %10s %10s %10s\n",
+           "condvar", "registered at", "spin CPU", "waits", "hit%", "parks", "signals", "no waiter");
+    for (int i = 0; i < STATS_MAX_CONDVARS && i < top; i++) {
+        cond_sample_t *c = &conds[i];
+        unsigned long long n = c->spin_hits + c->spin_misses;
+        if (c->spin_ticks == 0 && c->waits == 0 && c->signals == 0) {
+            break;
+        }
+        printf("%#-18llx %-32.32s %10s %10llu %6.1f%% %10llu %10llu %10llu\n",
+               c->cond, c->label, fmt_ticks(c->spin_ticks, tps, buf, sizeof(buf)), c->waits,
+               n ? 100.0 * c->spin_hits / n : 0.0, c->parks, c->signals, c->empty_signals);
+    }
+    if (atomic_load(&region->overflow_condvars) != 0) {
+        printf("(%u condvars beyond the slot table are counted as 0x0)\n",
+               atomic_load(&region->overflow_condvars));
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-n TOP] [-i SECONDS] PID\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int top = 10, interval = 0, opt;
+
+    while ((opt = getopt(argc, argv, "n:i:h")) != -1) {
+        switch (opt) {
+        case 'n': top = atoi(optarg); break;
+        case 'i': interval = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), STATS_SHM_NAME, atoi(argv[optind]));
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "libmy_pthread_stat: cannot open /dev/shm%s: %m\n", name);
+        return 1;
+    }
+    ultra_stats_region_t *region = mmap(NULL, sizeof(*region), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        fprintf(stderr, "libmy_pthread_stat: cannot map /dev/shm%s: %m\n", name);
+        return 1;
+    }
+    if (region->magic != STATS_MAGIC || region->version != STATS_VERSION) {
+        fprintf(stderr, "libmy_pthread_stat: /dev/shm%s is not a version %d stats segment\n",
+                name, STATS_VERSION);
+        return 1;
+    }
+    // EPERM is a live process of another user
+    if (kill(region->pid, 0) != 0 && errno == ESRCH) {
+        fprintf(stderr, "libmy_pthread_stat: note: process %d has exited, showing its last counters\n",
+                region->pid);
+    }
+
+    static cond_sample_t conds[STATS_MAX_CONDVARS], prev[STATS_MAX_CONDVARS];
+    totals_t now, then;
+
+    if (interval <= 0) {
+        sum_shards(region, &now);
+        sample_conds(region, conds);
+        report(region, &now, NULL, conds, NULL, top);
+        return 0;
+    }
+    for (;;) {
+        sum_shards(region, &then);
+        sample_conds(region, prev);
+        sleep(interval);
+        sum_shards(region, &now);
+        sample_conds(region, conds);
+        printf("\n=== last %d s ===\n", interval);
+        report(region, &now, &then, conds, prev, top);
+        fflush(stdout);
+    }
+}
@@ -0,0 +1,69 @@
+// libmy_pthread_stats.h - layout of the live statistics segment
+// libmy_pthread publishes its counters in /dev/shm/libmy_pthread.<pid> for
+// the lifetime of the process; libmy_pthread_stat reads them from outside.
+#ifndef LIBMY_PTHREAD_STATS_H
+#define LIBMY_PTHREAD_STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define STATS_SHM_NAME      "/libmy_pthread.%d"  // shm_open() name, %d = pid
+#define STATS_MAGIC         0x6d79707468737431ULL // "mypthst1"
+#define STATS_VERSION       3
+#define STATS_MAX_SHARDS    256   // per-thread shards; later threads share them
+#define STATS_MAX_CONDVARS  1024  // per-condvar slots; slot 0 collects the overflow
+#define STATS_HIST_BUCKETS  40    // bucket b counts durations in [2^b, 2^(b+1)) ticks
+#define STATS_LABEL_LEN     64
+
+// Process-wide counters, one shard per thread. Only the owning thread
+// writes a shard (unless there are more threads than shards), so updates
+// stay on a line no other thread touches.
+typedef struct {
+    atomic_ullong waits;           // wait/timedwait calls on spin condvars
+    atomic_ullong spin_hits;       // woken while spinning
+    atomic_ullong spin_misses;     // spin budget ran out
+    atomic_ullong parks;           // waits that blocked in the kernel
+    atomic_ullong timeouts;        // waits that returned without a wakeup
+    atomic_ullong signals;
+    atomic_ullong broadcasts;
+    atomic_ullong empty_signals;   // signals/broadcasts that found nobody to wake
+    atomic_ullong spin_ticks;      // time spent spinning
+    atomic_ullong spin_iterations;
+    atomic_ullong spin_denied;     // spin phases skipped, spinner pool exhausted
+    atomic_ullong topology_waits[4]; // waits with a spin budget, by placement against the
+                                     // last signaller: same core, same LLC, same socket, remote
+    atomic_ullong wake_hist[STATS_HIST_BUCKETS]; // wait-to-wake latency
+    atomic_ullong spin_hist[STATS_HIST_BUCKETS]; // spin duration per wait
+} __attribute__((aligned(64))) ultra_stats_shard_t;
+
+// Per-condvar counters. A slot is claimed when the condvar is registered
+// and cleared for reuse when it is destroyed. Threads fold their counts in
+// every 10 ms or so, so a slot may trail the shards by that much.
+typedef struct {
+    atomic_ullong cond;            // condvar address, 0 = free
+    atomic_ullong waits;
+    atomic_ullong spin_hits;
+    atomic_ullong spin_misses;
+    atomic_ullong parks;
+    atomic_ullong signals;
+    atomic_ullong empty_signals;
+    atomic_ullong spin_ticks;
+    char label[STATS_LABEL_LEN];   // call site that registered it
+} __attribute__((aligned(64))) ultra_stats_cond_t;
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    int32_t pid;
+    uint64_t ticks_per_sec;        // time base of all *_ticks and histograms
+    char time_source[32];
+    atomic_uint next_shard;
+    atomic_uint overflow_condvars; // condvars counted in slot 0
+    int32_t spinner_limit;         // spinner pool size, -1 = unlimited
+    int32_t spinner_cpus;          // CPUs in the affinity mask, 0 = size fixed by env
+    int32_t spinner_quota;         // cgroup CPU quota in CPUs, 0 = none
+    ultra_stats_shard_t shards[STATS_MAX_SHARDS];
+    ultra_stats_cond_t conds[STATS_MAX_CONDVARS];
+} ultra_stats_region_t;
+
+#endif /* LIBMY_PTHREAD_STATS_H */
@@ -0,0 +1,369 @@
+// libmy_pthread_trace.c - convert a libmy_pthread event trace to Chrome trace JSON
+//
+//   gcc -O2 -o libmy_pthread_trace libmy_pthread_trace.c
+//   libmy_pthread_trace [-o OUT.json] FILE.trace
+//
+// Reads a file written by LIBMY_PTHREAD_TRACE (see libmy_pthread_trace.h) and
+// writes JSON for chrome://tracing or ui.perfetto.dev: per thread, a slice
+// for every wait with its spin and park phases nested inside, a slice for
+// every signal and broadcast, and a flow arrow from the signal that woke a
+// waiter to the end of its wait. Call sites are given as object+offset,
+// taken from the process mappings recorded in the file.
+#include "libmy_pthread_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#define UNKNOWN_TID_BASE 1000000000  // pseudo-tids for events of an earlier ring owner
+
+typedef struct {
+    uint64_t start, end, offset;
+    const char *name;
+} mapping_t;
+
+typedef struct {
+    ultra_trace_event_t ev;
+    int32_t tid;
+    uint32_t seq;              // file order, keeps the sort stable
+} event_t;
+
+static mapping_t *mappings;
+static size_t nmappings;
+static event_t *events;
+static size_t nevents, events_cap;
+static uint64_t base_ticks;
+static double ticks_per_us;
+static FILE *out;
+static int first_json = 1;
+
+static void *xrealloc(void *p, size_t n) {
+    p = realloc(p, n);
+    if (p == NULL) {
+        fprintf(stderr, "libmy_pthread_trace: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int by_start(const void *a, const void *b) {
+    const mapping_t *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// /proc/self/maps lines: start-end perms offset dev inode [path]
+static void parse_maps(char *text) {
+    size_t cap = 0;
+
+    for (char *line = strtok(text, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        uint64_t start, end, offset;
+        int path_at = 0;
+        if (sscanf(line, "%" SCNx64 "-%" SCNx64 " %*s %" SCNx64 " %*s %*s %n", &start, &end, &offset, &path_at) != 3 ||
+            path_at == 0 || line[path_at] == '\0') {
+            continue;
+        }
+        if (nmappings == cap) {
+            cap = cap ? cap * 2 : 256;
+            mappings = xrealloc(mappings, cap * sizeof(*mappings));
+        }
+        const char *slash = strrchr(line + path_at, '/');
+        mappings[nmappings++] = (mapping_t){ start, end, offset, slash != NULL ? slash + 1 : line + path_at };
+    }
+    qsort(mappings, nmappings, sizeof(*mappings), by_start);
+}
+
+static const char *symbolize(uint64_t pc, char *buf, size_t len) {
+    size_t lo = 0, hi = nmappings;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (mappings[mid].end <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < nmappings && mappings[lo].start <= pc) {
+        snprintf(buf, len, "%s+0x%" PRIx64, mappings[lo].name, pc - mappings[lo].start + mappings[lo].offset);
+    } else {
+        snprintf(buf, len, "0x%" PRIx64, pc);
+    }
+    return buf;
+}
+
+static void add_event(const ultra_trace_event_t *ev, int32_t tid) {
+    if (nevents == events_cap) {
+        events_cap = events_cap ? events_cap * 2 : 65536;
+        events = xrealloc(events, events_cap * sizeof(*events));
+    }
+    events[nevents] = (event_t){ *ev, tid, (uint32_t)nevents };
+    nevents++;
+}
+
+// Events of one ring, oldest first. They belong to the tid of the last
+// TRACE_THREAD marker before them; events from before the first surviving
+// marker came from an earlier owner whose tid was overwritten.
+static unsigned long long add_ring(const ultra_trace_ring_hdr_t *hdr, const ultra_trace_event_t *ring, int ring_no) {
+    unsigned long long dropped = 0;
+    int32_t tid = hdr->tid;
+
+    for (uint64_t i = 0; i < hdr->count; i++) {
+        if (hdr->first + i < hdr->valid_from) {
+            continue;
+        }
+        if (ring[i].type == TRACE_THREAD) {
+            tid = UNKNOWN_TID_BASE + ring_no; // a marker exists: what precedes it is someone else's
+            break;
+        }
+    }
+    for (uint64_t i = 0; i < hdr->count; i++) {
+        if (hdr->first + i < hdr->valid_from) {
+            dropped++;
+            continue;
+        }
+        if (ring[i].type == TRACE_THREAD) {
+            tid = (int32_t)ring[i].arg;
+            continue;
+        }
+        add_event(&ring[i], tid);
+    }
+    return dropped;
+}
+
+static double ts_us(uint64_t ticks) {
+    return ticks >= base_ticks ? (double)(ticks - base_ticks) / ticks_per_us : 0.0;
+}
+
+static void json_begin(void) {
+    fputs(first_json ? "\n  " : ",\n  ", out);
+    first_json = 0;
+}
+
+static void emit_slice(const char *name, int32_t tid, uint64_t from, uint64_t to,
+                       uint64_t object, uint64_t pc, const char *result) {
+    char sym[256];
+
+    json_begin();
+    fprintf(out, "{\"name\": \"%s\", \"cat\": \"libmy_pthread\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                 "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"object\": \"0x%" PRIx64 "\", \"pc\": \"%s\"",
+            name, tid, ts_us(from), to > from ? ts_us(to) - ts_us(from) : 0.0, object,
+            symbolize(pc, sym, sizeof(sym)));
+    if (result != NULL) {
+        fprintf(out, ", \"result\": \"%s\"", result);
+    }
+    fputs("}}", out);
+}
+
+static void emit_flow(char phase, unsigned long id, int32_t tid, double ts) {
+    json_begin();
+    fprintf(out, "{\"name\": \"wakeup\", \"cat\": \"libmy_pthread\", \"ph\": \"%c\", \"id\": %lu, "
+                 "\"pid\": 1, \"tid\": %d, \"ts\": %.3f%s}",
+            phase, id, tid, ts, phase == 'f' ? ", \"bp\": \"e\"" : "");
+}
+
+// Wait, spin and park slices; events of a thread are contiguous and in order
+static void emit_slices(void) {
+    size_t i = 0;
+
+    while (i < nevents) {
+        int32_t tid = events[i].tid;
+        const ultra_trace_event_t *begin = NULL;
+        uint64_t park_at = 0;
+
+        json_begin();
+        if (tid >= UNKNOWN_TID_BASE) {
+            fprintf(out, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                         "\"args\": {\"name\": \"earlier thread (ring %d)\"}}", tid, tid - UNKNOWN_TID_BASE);
+        } else {
+            fprintf(out, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                         "\"args\": {\"name\": \"tid %d\"}}", tid, tid);
+        }
+        for (; i < nevents && events[i].tid == tid; i++) {
+            const ultra_trace_event_t *ev = &events[i].ev;
+            switch (ev->type) {
+            case TRACE_WAIT_BEGIN:
+                begin = ev;
+                park_at = 0;
+                break;
+            case TRACE_SPIN_HIT:
+            case TRACE_SPIN_MISS:
+                emit_slice(ev->type == TRACE_SPIN_HIT ? "spin (hit)" : "spin (miss)", tid,
+                           ev->ticks - ev->arg, ev->ticks, ev->object, ev->pc, NULL);
+                break;
+            case TRACE_PARK:
+                park_at = ev->ticks;
+                break;
+            case TRACE_WAKE:
+                if (park_at != 0) {
+                    emit_slice("park", tid, park_at, ev->ticks, ev->object, ev->pc, NULL);
+                }
+                if (begin != NULL) {
+                    emit_slice(begin->arg ? "timedwait" : "wait", tid, begin->ticks, ev->ticks,
+                               ev->object, ev->pc, ev->arg ? "woken" : "timeout");
+                }
+                begin = NULL;
+                park_at = 0;
+                break;
+            case TRACE_SIGNAL:
+            case TRACE_BROADCAST:
+                emit_slice(ev->type == TRACE_SIGNAL ? "signal" : "broadcast", tid, ev->ticks, ev->ticks,
+                           ev->object, ev->pc, ev->arg ? "woke a waiter" : "nobody waiting");
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+static int by_time(const void *a, const void *b) {
+    const event_t *x = a, *y = b;
+
+    if (x->ev.ticks != y->ev.ticks) {
+        return x->ev.ticks < y->ev.ticks ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Each successful wakeup gets an arrow from the latest signal or broadcast
+// on the same object that woke somebody
+static unsigned long emit_flows(void) {
+    size_t cap = 1024;
+    unsigned long flows = 0;
+
+    while (cap < nevents * 2) {
+        cap <<= 1;
+    }
+    uint64_t *keys = calloc(cap, sizeof(*keys));
+    size_t *last = calloc(cap, sizeof(*last));
+    if (keys == NULL || last == NULL) {
+        fprintf(stderr, "libmy_pthread_trace: out of memory\n");
+        exit(1);
+    }
+
+    qsort(events, nevents, sizeof(*events), by_time);
+    for (size_t i = 0; i < nevents; i++) {
+        const ultra_trace_event_t *ev = &events[i].ev;
+        int is_signal = (ev->type == TRACE_SIGNAL || ev->type == TRACE_BROADCAST) && ev->arg;
+        if (!is_signal && !(ev->type == TRACE_WAKE && ev->arg)) {
+            continue;
+        }
+        size_t slot = (size_t)((ev->object * 0x9E3779B97F4A7C15ULL) >> 20) & (cap - 1);
+        while (keys[slot] != 0 && keys[slot] != ev->object + 1) {
+            slot = (slot + 1) & (cap - 1);
+        }
+        if (is_signal) {
+            keys[slot] = ev->object + 1;
+            last[slot] = i;
+        } else if (keys[slot] != 0) {
+            const event_t *sig = &events[last[slot]];
+            double wake = ts_us(ev->ticks);
+            flows++;
+            emit_flow('s', flows, sig->tid, ts_us(sig->ev.ticks));
+            // Just inside the wait slice, so the arrow binds to it
+            emit_flow('f', flows, events[i].tid, wake > 0.001 ? wake - 0.001 : wake);
+        }
+    }
+    free(keys);
+    free(last);
+    return flows;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-o OUT.json] FILE.trace\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *out_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:h")) != -1) {
+        switch (opt) {
+        case 'o': out_path = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+    }
+
+    FILE *in = fopen(argv[optind], "rb");
+    if (in == NULL) {
+        fprintf(stderr, "libmy_pthread_trace: cannot open %s: %m\n", argv[optind]);
+        return 1;
+    }
+    ultra_trace_header_t header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != TRACE_MAGIC ||
+        header.version != TRACE_VERSION) {
+        fprintf(stderr, "libmy_pthread_trace: %s is not a version %d trace file\n", argv[optind], TRACE_VERSION);
+        return 1;
+    }
+
+    char *maps = NULL;
+    size_t maps_len = 0;
+    unsigned long long dropped = 0;
+    int nrings = 0;
+    ultra_trace_record_t rec;
+    while (fread(&rec, sizeof(rec), 1, in) == 1) {
+        char *payload = xrealloc(NULL, rec.bytes + 1);
+        if (fread(payload, 1, rec.bytes, in) != rec.bytes) {
+            fprintf(stderr, "libmy_pthread_trace: %s is truncated\n", argv[optind]);
+            free(payload);
+            break;
+        }
+        if (rec.kind == TRACE_REC_MAPS) {
+            maps = xrealloc(maps, maps_len + rec.bytes + 1);
+            memcpy(maps + maps_len, payload, rec.bytes);
+            maps_len += rec.bytes;
+            maps[maps_len] = '\0';
+        } else if (rec.kind == TRACE_REC_RING && rec.bytes >= sizeof(ultra_trace_ring_hdr_t)) {
+            ultra_trace_ring_hdr_t hdr;
+            memcpy(&hdr, payload, sizeof(hdr));
+            if (sizeof(hdr) + hdr.count * sizeof(ultra_trace_event_t) <= rec.bytes) {
+                dropped += add_ring(&hdr, (const ultra_trace_event_t *)(payload + sizeof(hdr)), nrings++);
+            }
+        }
+        free(payload);
+    }
+    fclose(in);
+    if (maps != NULL) {
+        parse_maps(maps);
+    }
+
+    base_ticks = UINT64_MAX;
+    for (size_t i = 0; i < nevents; i++) {
+        if (events[i].ev.ticks < base_ticks) {
+            base_ticks = events[i].ev.ticks;
+        }
+    }
+    ticks_per_us = header.ticks_per_sec / 1e6;
+
+    out = out_path != NULL ? fopen(out_path, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "libmy_pthread_trace: cannot create %s: %m\n", out_path);
+        return 1;
+    }
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"pid\": %d, \"time_source\": \"%.32s\"},\n"
+                 "\"traceEvents\": [", header.pid, header.time_source);
+    json_begin();
+    fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"pid %d\"}}",
+            header.pid);
+    emit_slices();
+    unsigned long flows = emit_flows();
+    fputs("\n]}\n", out);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    fprintf(stderr, "%zu events from %d rings, %lu wakeups linked to their signal", nevents, nrings, flows);
+    if (dropped != 0) {
+        fprintf(stderr, ", %llu dropped as possibly overwritten while copied", dropped);
+    }
+    fputc('\n', stderr);
+    free(events);
+    free(mappings);
+    free(maps);
+    return 0;
+}
@@ -0,0 +1,63 @@
+// libmy_pthread_trace.h - layout of the event trace file
+// With LIBMY_PTHREAD_TRACE set, libmy_pthread records condvar, eventcount,
+// semaphore and barrier events in a ring per thread and writes them to
+// <dir>/libmy_pthread.<pid>.<n>.trace at exit and on LIBMY_PTHREAD_TRACE_SIGNAL;
+// libmy_pthread_trace turns such a file into Chrome trace JSON.
+#ifndef LIBMY_PTHREAD_TRACE_H
+#define LIBMY_PTHREAD_TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC         0x6d79707474726331ULL // "mypttrc1"
+#define TRACE_VERSION       1
+#define TRACE_FILE_NAME     "libmy_pthread."      // + <pid>.<n>.trace
+
+// Event types
+#define TRACE_WAIT_BEGIN    1  // arg: 1 for a timed wait
+#define TRACE_SPIN_HIT      2  // end of a spin phase that caught the wakeup; arg: ticks spun
+#define TRACE_SPIN_MISS     3  // end of a spin phase that ran out; arg: ticks spun
+#define TRACE_PARK          4  // about to block in the kernel
+#define TRACE_WAKE          5  // wait returns; arg: 1 if woken, 0 on timeout
+#define TRACE_SIGNAL        6  // arg: 1 if it woke somebody
+#define TRACE_BROADCAST     7  // arg: 1 if it woke somebody
+#define TRACE_THREAD        8  // ring taken over by a new thread; arg: its tid
+
+typedef struct {
+    uint64_t ticks;        // time base of the file header
+    uint64_t object;       // condvar, eventcount, semaphore or barrier address
+    uint64_t pc;           // caller of the pthread_* / my_pthread_* entry point
+    uint32_t arg;          // see the event types
+    uint16_t type;
+    uint16_t reserved;
+} ultra_trace_event_t;
+
+// The file is a header followed by records up to EOF
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    int32_t pid;
+    uint64_t ticks_per_sec;
+    uint64_t flush_ticks;  // when the file was written
+    char time_source[32];
+} ultra_trace_header_t;
+
+#define TRACE_REC_MAPS      1  // a piece of /proc/self/maps, for symbolizing pcs
+#define TRACE_REC_RING      2  // ultra_trace_ring_hdr_t, then its events oldest first
+
+typedef struct {
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t bytes;        // payload following this header
+} ultra_trace_record_t;
+
+// Rings are copied while their threads keep writing. Events before
+// valid_from may have been overwritten during the copy and must be dropped.
+typedef struct {
+    int32_t tid;           // owner at the flush, or its last owner if the thread exited
+    uint32_t capacity;
+    uint64_t first;        // index of the first event in the record
+    uint64_t count;
+    uint64_t valid_from;
+} ultra_trace_ring_hdr_t;
+
+#endif /* LIBMY_PTHREAD_TRACE_H */
@@ -0,0 +1,1017 @@
+// hugepage_arena.c - hugepage-backed arena allocator (see hugepage_arena.h)
+//
+//   gcc -O2 -fPIC -shared -o libhugepage_arena.so hugepage_arena.c -lpthread
+//   gcc -O2 -fPIC -shared -DHP_INTERPOSE -o libhugepage_arena_preload.so hugepage_arena.c -lpthread -ldl
+//
+// The whole arena lives in one PROT_NONE reservation aligned to 1 GB, cut
+// into 2 MB pages. Each page has a descriptor, so finding the page behind a
+// pointer is a subtraction and a shift, and telling arena pointers from
+// glibc ones is a range check. Pages are committed at the top of the
+// reservation as they are first needed, trying the backings one after
+// another on the same address range: THP and 4 KB pages are mapped over the
+// placeholder in place, hugetlb only once its pool shows free pages (and the
+// hugetlb mmap fails up front when it has none after all, so nothing can
+// SIGBUS later). Freed pages go back to a bitmap of committed free pages and
+// are reused before committing more.
+//
+// Slab pages belong to one thread's arena and one size class. The owner
+// allocates and frees without atomics; other threads push frees onto the
+// page's remote list, which the owner takes over when it runs out of room.
+// An arena whose thread exits is handed, pages and all, to the next new
+// thread.
+#define _GNU_SOURCE
+#include "hugepage_arena.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef HP_INTERPOSE
+#include <dlfcn.h>
+#endif
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+// glibc's allocator, reachable without dlsym even while we interpose malloc
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+#define HP_PAGE_SHIFT   21
+#define HP_PAGE_SIZE    (1UL << HP_PAGE_SHIFT)   // 2 MB: unit of the page pool
+#define HP_GIANT_PAGES  512                      // pool pages per 1 GB hugetlb page
+#define HP_GIANT_SIZE   (1UL << 30)
+#define HP_SLAB_MAX     (1UL << 20)              // larger requests get whole pages
+#define HP_NUM_CLASSES  60                       // 16..128 by 16, then 4 per doubling up to 1 MB
+
+#define HP_PAGE_FREE    0  // uncommitted, or in the pool
+#define HP_PAGE_SLAB    1
+#define HP_PAGE_LARGE   2  // first page of a large allocation
+#define HP_PAGE_TAIL    3  // the rest of it
+
+// Backings, best first
+#define HP_BACK_NONE        0
+#define HP_BACK_HUGETLB_1G  1
+#define HP_BACK_HUGETLB_2M  2
+#define HP_BACK_THP         3
+#define HP_BACK_4K          4
+
+struct hp_arena;
+
+typedef struct hp_page {
+    _Atomic(void *) remote;        // objects freed by other threads
+    void *free;                    // objects freed by the owner
+    char *bump;                    // next never-used object
+    char *end;
+    struct hp_arena *owner;
+    struct hp_page *prev, *next;   // owner's other pages of this class
+    uint32_t size;                 // object size
+    uint32_t live;                 // objects out, less the frees the owner has seen
+    uint32_t npages;               // run length of a large allocation
+    uint8_t kind;
+    uint8_t backing;
+    uint8_t cls;
+    uint8_t touched;               // handed out at least once since it was committed
+} __attribute__((aligned(64))) hp_page_t;
+
+typedef struct hp_arena {
+    hp_page_t *current[HP_NUM_CLASSES];
+    hp_page_t *pages[HP_NUM_CLASSES];  // every other slab page owned, full or not
+    struct hp_arena *next_orphan;
+    struct hp_arena *next_all;
+    // Written by the owning thread only
+    uint64_t mallocs;
+    uint64_t frees;
+    int64_t allocated;
+} hp_arena_t;
+
+// Configuration
+static size_t hp_min_size = 64 * 1024;   // interposer: smaller requests stay with glibc
+static int hp_use_hugetlb = 1;
+static int hp_use_1g = 0;
+static int hp_use_thp = 1;
+
+// The reservation and its page pool
+static char *hp_base;
+static size_t hp_reserved;
+static size_t hp_npages;
+static hp_page_t *hp_desc;
+static uint64_t *hp_free_map;            // committed pages free for reuse
+static size_t hp_free_pages;
+static size_t hp_commit_top;             // pages below this have been committed
+static uint64_t hp_backing_bytes[5];
+static uint64_t hp_in_use_pages;
+static pthread_mutex_t hp_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t hp_class_size[HP_NUM_CLASSES];
+
+// Arenas
+static hp_arena_t *hp_arenas;
+static hp_arena_t *hp_orphans;
+static uint32_t hp_narenas;
+static char *hp_meta_next, *hp_meta_end;
+static pthread_key_t hp_key;
+static __thread hp_arena_t *hp_my_arena;
+
+// Frees by threads without an arena, and requests sent to glibc instead
+static atomic_ullong hp_stray_frees;
+static atomic_llong hp_stray_freed_bytes;
+static atomic_ullong hp_fallbacks;
+
+static pthread_once_t hp_once = PTHREAD_ONCE_INIT;
+static volatile int hp_ready;            // 1 set up, -1 the reservation failed
+
+// ---------------------------------------------------------------------------
+// Setup
+// ---------------------------------------------------------------------------
+static long env_long(const char *name, long def) {
+    const char *val = getenv(name);
+    char *end;
+
+    if (val == NULL || *val == '\0') {
+        return def;
+    }
+    long parsed = strtol(val, &end, 10);
+    return *end == '\0' ? parsed : def;
+}
+
+#define HP_HUGETLB_1G_DIR "/sys/kernel/mm/hugepages/hugepages-1048576kB/"
+#define HP_HUGETLB_2M_DIR "/sys/kernel/mm/hugepages/hugepages-2048kB/"
+
+static long hp_read_long(const char *path) {
+    char buf[32];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    buf[n] = '\0';
+    return strtol(buf, NULL, 10);
+}
+
+// Pages a hugetlb mmap of this size could get right now: the free pool plus
+// whatever overcommit still allows
+static long hp_hugetlb_available(int giant) {
+    const char *dir = giant ? HP_HUGETLB_1G_DIR : HP_HUGETLB_2M_DIR;
+    size_t len = strlen(dir);
+    char path[128];
+    long avail, over, surplus;
+
+    memcpy(path, dir, len);
+    strcpy(path + len, "free_hugepages");
+    avail = hp_read_long(path);
+    strcpy(path + len, "nr_overcommit_hugepages");
+    over = hp_read_long(path);
+    strcpy(path + len, "surplus_hugepages");
+    surplus = hp_read_long(path);
+    return avail + (over > surplus ? over - surplus : 0);
+}
+
+static unsigned hp_size_class(size_t size) {
+    if (size <= 128) {
+        return size == 0 ? 0 : (unsigned)((size - 1) >> 4);
+    }
+    unsigned lg = 63 - __builtin_clzl(size - 1);  // size is in (2^lg, 2^(lg+1)]
+    return 8 + (lg - 7) * 4 + (unsigned)(((size - 1) >> (lg - 2)) & 3);
+}
+
+static void hp_atfork_prepare(void) {
+    pthread_mutex_lock(&hp_lock);
+}
+
+static void hp_atfork_parent(void) {
+    pthread_mutex_unlock(&hp_lock);
+}
+
+// Only the forking thread survives; every other arena is up for adoption
+static void hp_atfork_child(void) {
+    hp_orphans = NULL;
+    for (hp_arena_t *arena = hp_arenas; arena; arena = arena->next_all) {
+        if (arena != hp_my_arena) {
+            arena->next_orphan = hp_orphans;
+            hp_orphans = arena;
+        }
+    }
+    pthread_mutex_unlock(&hp_lock);
+}
+
+static void hp_thread_exit(void *arg) {
+    hp_arena_t *arena = arg;
+
+    hp_my_arena = NULL;
+    pthread_mutex_lock(&hp_lock);
+    arena->next_orphan = hp_orphans;
+    hp_orphans = arena;
+    pthread_mutex_unlock(&hp_lock);
+}
+
+static void hp_exit_stats(void) {
+    if (hp_commit_top > 0) {
+        hp_print_stats(stderr);
+    }
+}
+
+static void hp_init_once(void) {
+    long gb = env_long("HUGEPAGE_ARENA_RESERVE_GB", 64);
+    long giant = env_long("HUGEPAGE_ARENA_1G", -1);
+
+    hp_min_size = (size_t)env_long("HUGEPAGE_ARENA_MIN_SIZE", (long)hp_min_size);
+    hp_use_hugetlb = env_long("HUGEPAGE_ARENA_HUGETLB", 1) != 0;
+    hp_use_thp = env_long("HUGEPAGE_ARENA_THP", 1) != 0;
+    hp_use_1g = hp_use_hugetlb && (giant < 0 ? hp_hugetlb_available(1) > 0 : giant != 0);
+
+    for (unsigned cls = 0; cls < HP_NUM_CLASSES; cls++) {
+        if (cls < 8) {
+            hp_class_size[cls] = (cls + 1) << 4;
+        } else {
+            unsigned lg = 7 + (cls - 8) / 4;
+            hp_class_size[cls] = (1UL << lg) + ((cls - 8) % 4 + 1) * (1UL << (lg - 2));
+        }
+    }
+
+    // Over-reserve by 1 GB so the arena can start on a 1 GB boundary
+    size_t reserved = (size_t)(gb > 0 ? gb : 1) << 30;
+    char *raw = mmap(NULL, reserved + HP_GIANT_SIZE, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) {
+        hp_ready = -1;
+        return;
+    }
+    char *base = (char *)(((uintptr_t)raw + HP_GIANT_SIZE - 1) & ~(HP_GIANT_SIZE - 1));
+    if (base > raw) {
+        munmap(raw, base - raw);
+    }
+    munmap(base + reserved, raw + HP_GIANT_SIZE - base);
+
+    size_t npages = reserved >> HP_PAGE_SHIFT;
+    size_t desc_bytes = npages * sizeof(hp_page_t) + npages / 8;
+    void *meta = mmap(NULL, desc_bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (meta == MAP_FAILED) {
+        munmap(base, reserved);
+        hp_ready = -1;
+        return;
+    }
+    hp_desc = meta;
+    hp_free_map = (uint64_t *)(hp_desc + npages);
+    hp_npages = npages;
+
+    pthread_key_create(&hp_key, hp_thread_exit);
+    pthread_atfork(hp_atfork_prepare, hp_atfork_parent, hp_atfork_child);
+    if (env_long("HUGEPAGE_ARENA_STATS", 0)) {
+        atexit(hp_exit_stats);
+    }
+
+    // Publish the range last: hp_owns() must not match before hp_desc is set
+    hp_base = base;
+    hp_reserved = reserved;
+    hp_ready = 1;
+}
+
+static inline int hp_init(void) {
+    if (__builtin_expect(hp_ready == 0, 0)) {
+        pthread_once(&hp_once, hp_init_once);
+    }
+    return hp_ready > 0;
+}
+
+// ---------------------------------------------------------------------------
+// Page pool (hp_lock held)
+// ---------------------------------------------------------------------------
+static inline int hp_is_free(size_t page) {
+    return (hp_free_map[page >> 6] >> (page & 63)) & 1;
+}
+
+static void hp_mark(size_t first, size_t n, int free) {
+    for (size_t i = first; i < first + n; i++) {
+        if (free) {
+            hp_free_map[i >> 6] |= 1ULL << (i & 63);
+        } else {
+            hp_free_map[i >> 6] &= ~(1ULL << (i & 63));
+        }
+    }
+}
+
+// First run of n free pages starting on a multiple of align
+static size_t hp_find_run(size_t n, size_t align) {
+    size_t i = 0;
+
+    while (i + n <= hp_commit_top) {
+        size_t j = 0;
+        while (j < n && hp_is_free(i + j)) {
+            j++;
+        }
+        if (j == n) {
+            return i;
+        }
+        i += j + 1;
+        if (j == 0 && hp_free_map[(i - 1) >> 6] == 0) {
+            i = ((i - 1) | 63) + 1;  // nothing free in this word
+        }
+        i = (i + align - 1) / align * align;
+    }
+    return SIZE_MAX;
+}
+
+// Map len bytes at addr. MAP_FIXED_NOREPLACE goes into a hole; MAP_FIXED
+// replaces the placeholder in place, so the range is never open to a
+// foreign mmap.
+static int hp_map_at(char *addr, size_t len, int flags) {
+    void *p = mmap(addr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    if (p == MAP_FAILED) {
+        return 0;
+    }
+    if (p != addr) {
+        munmap(p, len);  // pre-4.17 kernels take MAP_FIXED_NOREPLACE as a hint only
+        return 0;
+    }
+    return 1;
+}
+
+// Put the PROT_NONE placeholder back over a hole. 0 if the hole was taken.
+static int hp_placeholder_at(char *addr, size_t len) {
+    void *p = mmap(addr, len, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != MAP_FAILED && p != addr) {
+        munmap(p, len);
+        return 0;
+    }
+    return p == addr;
+}
+
+// hugetlb needs a mapping of its own, and a failed MAP_FIXED mmap may already
+// have torn down what it was meant to replace. So the placeholder is only
+// unmapped when the pool has the pages, the hugetlb mmap goes into the hole
+// with MAP_FIXED_NOREPLACE, and the hole is refilled at once if someone else
+// took the pages in between. -1 if even that failed: the range is lost.
+static int hp_commit_hugetlb(char *addr, size_t len, int giant) {
+    size_t need = len >> (giant ? 30 : HP_PAGE_SHIFT);
+
+    if (hp_hugetlb_available(giant) < (long)need) {
+        return 0;
+    }
+    munmap(addr, len);
+    if (hp_map_at(addr, len, MAP_FIXED_NOREPLACE | MAP_HUGETLB | (giant ? MAP_HUGE_1GB : MAP_HUGE_2MB))) {
+        return 1;
+    }
+    return hp_placeholder_at(addr, len) ? 0 : -1;
+}
+
+// Commit pages [first, first + n) with the best backing on offer. Returns
+// the backing, HP_BACK_NONE, or -1 if the range went to another mapping.
+static int hp_commit(size_t first, size_t n, int giant) {
+    char *addr = hp_base + (first << HP_PAGE_SHIFT);
+    size_t len = n << HP_PAGE_SHIFT;
+    int backing = HP_BACK_NONE;
+    int got;
+
+    if (giant) {
+        if ((got = hp_commit_hugetlb(addr, len, 1)) != 0) {
+            backing = got > 0 ? HP_BACK_HUGETLB_1G : -1;
+        }
+    } else if (hp_use_hugetlb && (got = hp_commit_hugetlb(addr, len, 0)) != 0) {
+        backing = got > 0 ? HP_BACK_HUGETLB_2M : -1;
+    } else if (hp_map_at(addr, len, MAP_FIXED)) {
+        // Must be advised before the first touch, or the faults map 4 KB pages
+        backing = hp_use_thp && madvise(addr, len, MADV_HUGEPAGE) == 0 ? HP_BACK_THP : HP_BACK_4K;
+    } else {
+        // Out of memory; the failed MAP_FIXED may have left a hole
+        hp_placeholder_at(addr, len);
+    }
+    if (backing <= HP_BACK_NONE) {
+        return backing;
+    }
+
+    for (size_t i = first; i < first + n; i++) {
+        hp_desc[i].backing = (uint8_t)backing;
+        hp_desc[i].touched = 0;
+    }
+    hp_mark(first, n, 1);
+    hp_free_pages += n;
+    hp_backing_bytes[backing] += len;
+    return backing;
+}
+
+// Commit at least n more pages at the top of the reservation. A 1 GB page
+// is tried whenever the top sits on a 1 GB boundary.
+static int hp_grow(size_t n) {
+    size_t target = hp_commit_top + n;
+
+    while (hp_commit_top < target) {
+        size_t first = hp_commit_top;
+        if (hp_use_1g && first % HP_GIANT_PAGES == 0 && first + HP_GIANT_PAGES <= hp_npages) {
+            int backing = hp_commit(first, HP_GIANT_PAGES, 1);
+            if (backing != HP_BACK_NONE) {
+                hp_commit_top += HP_GIANT_PAGES;
+                if (backing < 0) {
+                    return -1;  // lost: skipped like any page that cannot be committed
+                }
+                continue;
+            }
+        }
+        size_t chunk = target - first;
+        if (hp_use_1g && first / HP_GIANT_PAGES != (target - 1) / HP_GIANT_PAGES) {
+            chunk = HP_GIANT_PAGES - first % HP_GIANT_PAGES;  // stop at the next 1 GB boundary
+        }
+        if (first + chunk > hp_npages) {
+            return -1;
+        }
+        // Pages that cannot be committed are skipped for good
+        hp_commit_top += chunk;
+        if (hp_commit(first, chunk, 0) <= HP_BACK_NONE) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Take n pages starting on a multiple of align. *fresh is set if none of
+// them has been handed out before, so they still read as zero.
+static size_t hp_pages_get(size_t n, size_t align, int *fresh) {
+    pthread_mutex_lock(&hp_lock);
+    size_t first = hp_free_pages >= n ? hp_find_run(n, align) : SIZE_MAX;
+    if (first == SIZE_MAX) {
+        size_t pad = (align - hp_commit_top % align) % align;
+        if (n > hp_npages || hp_grow(pad + n) < 0 || (first = hp_find_run(n, align)) == SIZE_MAX) {
+            pthread_mutex_unlock(&hp_lock);
+            return SIZE_MAX;
+        }
+    }
+    int untouched = 1;
+    for (size_t i = first; i < first + n; i++) {
+        untouched &= !hp_desc[i].touched;
+        hp_desc[i].touched = 1;
+    }
+    hp_mark(first, n, 0);
+    hp_free_pages -= n;
+    hp_in_use_pages += n;
+    pthread_mutex_unlock(&hp_lock);
+
+    if (fresh) {
+        *fresh = untouched;
+    }
+    return first;
+}
+
+static void hp_pages_put(size_t first, size_t n) {
+    pthread_mutex_lock(&hp_lock);
+    for (size_t i = first; i < first + n; i++) {
+        hp_desc[i].kind = HP_PAGE_FREE;
+    }
+    hp_mark(first, n, 1);
+    hp_free_pages += n;
+    hp_in_use_pages -= n;
+    pthread_mutex_unlock(&hp_lock);
+}
+
+static inline size_t hp_page_index(const void *ptr) {
+    return (size_t)((const char *)ptr - hp_base) >> HP_PAGE_SHIFT;
+}
+
+static inline char *hp_page_addr(size_t index) {
+    return hp_base + (index << HP_PAGE_SHIFT);
+}
+
+// ---------------------------------------------------------------------------
+// Arenas and slabs
+// ---------------------------------------------------------------------------
+static hp_arena_t *hp_thread_arena(void) {
+    hp_arena_t *arena = hp_my_arena;
+    if (__builtin_expect(arena != NULL, 1)) {
+        return arena;
+    }
+
+    pthread_mutex_lock(&hp_lock);
+    arena = hp_orphans;
+    if (arena) {
+        hp_orphans = arena->next_orphan;
+    } else {
+        if (hp_meta_next + sizeof(hp_arena_t) > hp_meta_end) {
+            size_t chunk = 64 * 1024;
+            void *meta = mmap(NULL, chunk, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (meta != MAP_FAILED) {
+                hp_meta_next = meta;
+                hp_meta_end = hp_meta_next + chunk;
+            }
+        }
+        if (hp_meta_next + sizeof(hp_arena_t) <= hp_meta_end) {
+            arena = (hp_arena_t *)hp_meta_next;
+            hp_meta_next += (sizeof(hp_arena_t) + 63) & ~(size_t)63;
+            arena->next_all = hp_arenas;
+            hp_arenas = arena;
+            hp_narenas++;
+        }
+    }
+    pthread_mutex_unlock(&hp_lock);
+
+    if (arena) {
+        hp_my_arena = arena;
+        pthread_setspecific(hp_key, arena);
+    }
+    return arena;
+}
+
+static void hp_list_push(hp_arena_t *arena, hp_page_t *page) {
+    page->prev = NULL;
+    page->next = arena->pages[page->cls];
+    if (page->next) {
+        page->next->prev = page;
+    }
+    arena->pages[page->cls] = page;
+}
+
+static void hp_list_remove(hp_arena_t *arena, hp_page_t *page) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        arena->pages[page->cls] = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+}
+
+static inline void *hp_page_take(hp_page_t *page) {
+    void *obj = page->free;
+
+    if (obj) {
+        page->free = *(void **)obj;
+    } else if (page->bump < page->end) {
+        obj = page->bump;
+        page->bump += page->size;
+    } else {
+        return NULL;
+    }
+    page->live++;
+    return obj;
+}
+
+// Move the objects other threads freed onto the owner's list
+static int hp_page_drain(hp_page_t *page) {
+    void *list = atomic_exchange_explicit(&page->remote, NULL, memory_order_acquire);
+    if (list == NULL) {
+        return 0;
+    }
+    void *tail = list;
+    uint32_t n = 1;
+    while (*(void **)tail) {
+        tail = *(void **)tail;
+        n++;
+    }
+    *(void **)tail = page->free;
+    page->free = list;
+    page->live -= n;
+    return 1;
+}
+
+static void *hp_slab_refill(hp_arena_t *arena, unsigned cls) {
+    hp_page_t *page = arena->current[cls];
+
+    if (page) {
+        if (hp_page_drain(page)) {
+            return hp_page_take(page);
+        }
+        hp_list_push(arena, page);
+        arena->current[cls] = NULL;
+    }
+
+    // One of our other pages that has had objects freed into it. Pages that
+    // other threads emptied completely on the way there go back to the pool.
+    hp_page_t *next;
+    for (page = arena->pages[cls]; page; page = next) {
+        next = page->next;
+        if (page->free || hp_page_drain(page)) {
+            hp_list_remove(arena, page);
+            if (page->live == 0 && next != NULL) {
+                hp_pages_put((size_t)(page - hp_desc), 1);
+                continue;
+            }
+            arena->current[cls] = page;
+            return hp_page_take(page);
+        }
+    }
+
+    size_t index = hp_pages_get(1, 1, NULL);
+    if (index == SIZE_MAX) {
+        return NULL;
+    }
+    size_t size = hp_class_size[cls];
+    page = &hp_desc[index];
+    atomic_store_explicit(&page->remote, NULL, memory_order_relaxed);
+    page->free = NULL;
+    page->bump = hp_page_addr(index);
+    page->end = page->bump + (HP_PAGE_SIZE / size) * size;
+    page->owner = arena;
+    page->prev = page->next = NULL;
+    page->size = (uint32_t)size;
+    page->live = 0;
+    page->cls = (uint8_t)cls;
+    page->kind = HP_PAGE_SLAB;
+    arena->current[cls] = page;
+    return hp_page_take(page);
+}
+
+static inline void hp_count_free(hp_arena_t *arena, size_t bytes) {
+    if (arena) {
+        arena->frees++;
+        arena->allocated -= (int64_t)bytes;
+    } else {
+        atomic_fetch_add_explicit(&hp_stray_frees, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&hp_stray_freed_bytes, (long long)bytes, memory_order_relaxed);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Allocation
+// ---------------------------------------------------------------------------
+static inline size_t hp_pages_for(size_t size) {
+    return (size + HP_PAGE_SIZE - 1) >> HP_PAGE_SHIFT;
+}
+
+// align is a power of two; *zeroed tells calloc it can skip the memset
+static void *hp_alloc(size_t size, size_t align, int *zeroed) {
+    if (!hp_init()) {
+        return NULL;
+    }
+    hp_arena_t *arena = hp_thread_arena();
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    if (align > 16 && size <= HP_SLAB_MAX) {
+        // Slab objects sit at multiples of their class size from a 2 MB
+        // boundary, so a class that is a multiple of align gives aligned objects.
+        // An align above HP_SLAB_MAX makes this a whole-page allocation.
+        size = size < align ? align : size;
+        if (size <= HP_SLAB_MAX && hp_class_size[hp_size_class(size)] % align != 0) {
+            size = 1UL << (64 - __builtin_clzl(size - 1));
+        }
+    }
+
+    void *obj;
+    size_t bytes;
+    if (size <= HP_SLAB_MAX) {
+        unsigned cls = hp_size_class(size);
+        hp_page_t *page = arena->current[cls];
+        obj = page ? hp_page_take(page) : NULL;
+        if (obj == NULL) {
+            obj = hp_slab_refill(arena, cls);
+        }
+        bytes = hp_class_size[cls];
+        if (zeroed) {
+            *zeroed = 0;
+        }
+    } else {
+        size_t n = hp_pages_for(size);
+        size_t index = hp_pages_get(n, align > HP_PAGE_SIZE ? align >> HP_PAGE_SHIFT : 1, zeroed);
+        if (index == SIZE_MAX) {
+            return NULL;
+        }
+        hp_desc[index].kind = HP_PAGE_LARGE;
+        hp_desc[index].npages = (uint32_t)n;
+        for (size_t i = index + 1; i < index + n; i++) {
+            hp_desc[i].kind = HP_PAGE_TAIL;
+        }
+        obj = hp_page_addr(index);
+        bytes = n << HP_PAGE_SHIFT;
+    }
+    if (obj) {
+        arena->mallocs++;
+        arena->allocated += (int64_t)bytes;
+    }
+    return obj;
+}
+
+int hp_owns(const void *ptr) {
+    return (uintptr_t)ptr - (uintptr_t)hp_base < hp_reserved;
+}
+
+static void hp_free_owned(void *ptr) {
+    size_t index = hp_page_index(ptr);
+    hp_page_t *page = &hp_desc[index];
+    hp_arena_t *me = hp_my_arena;
+
+    if (page->kind == HP_PAGE_LARGE) {
+        size_t n = page->npages;
+        hp_count_free(me, n << HP_PAGE_SHIFT);
+        hp_pages_put(index, n);
+        return;
+    }
+
+    hp_count_free(me, page->size);
+    if (page->owner == me) {
+        *(void **)ptr = page->free;
+        page->free = ptr;
+        if (--page->live == 0 && page != me->current[page->cls]) {
+            hp_list_remove(me, page);
+            hp_pages_put(index, 1);
+        }
+        return;
+    }
+    void *head = atomic_load_explicit(&page->remote, memory_order_relaxed);
+    do {
+        *(void **)ptr = head;
+    } while (!atomic_compare_exchange_weak_explicit(&page->remote, &head, ptr,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+static size_t hp_owned_size(void *ptr) {
+    hp_page_t *page = &hp_desc[hp_page_index(ptr)];
+    return page->kind == HP_PAGE_LARGE ? (size_t)page->npages << HP_PAGE_SHIFT : page->size;
+}
+
+// Resize in place if the allocation can stay where it is
+static int hp_resize_owned(void *ptr, size_t size) {
+    size_t index = hp_page_index(ptr);
+    hp_page_t *page = &hp_desc[index];
+
+    if (page->kind == HP_PAGE_SLAB) {
+        return size <= page->size && size > page->size / 2;
+    }
+    size_t n = hp_pages_for(size);
+    if (size <= HP_SLAB_MAX || n > page->npages) {
+        return 0;
+    }
+    if (n < page->npages) {
+        // Give the tail back to the pool
+        size_t tail = page->npages - n;
+        page->npages = (uint32_t)n;
+        hp_pages_put(index + n, tail);
+        if (hp_my_arena) {
+            hp_my_arena->allocated -= (int64_t)(tail << HP_PAGE_SHIFT);
+        } else {
+            atomic_fetch_add_explicit(&hp_stray_freed_bytes, (long long)(tail << HP_PAGE_SHIFT),
+                                      memory_order_relaxed);
+        }
+    }
+    return 1;
+}
+
+static size_t hp_libc_usable_size(void *ptr) {
+#ifdef HP_INTERPOSE
+    static size_t (*libc_usable_size)(void *);
+    if (libc_usable_size == NULL) {
+        libc_usable_size = (size_t (*)(void *))dlsym(RTLD_NEXT, "malloc_usable_size");
+    }
+    return libc_usable_size(ptr);
+#else
+    return malloc_usable_size(ptr);
+#endif
+}
+
+void *hp_malloc(size_t size) {
+    void *ptr = hp_alloc(size, 16, NULL);
+    if (ptr == NULL) {
+        atomic_fetch_add_explicit(&hp_fallbacks, 1, memory_order_relaxed);
+        ptr = __libc_malloc(size);
+    }
+    return ptr;
+}
+
+void *hp_calloc(size_t nmemb, size_t size) {
+    size_t bytes;
+    int zeroed = 0;
+
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *ptr = hp_alloc(bytes, 16, &zeroed);
+    if (ptr == NULL) {
+        atomic_fetch_add_explicit(&hp_fallbacks, 1, memory_order_relaxed);
+        return __libc_calloc(nmemb, size);
+    }
+    if (!zeroed) {
+        memset(ptr, 0, bytes);
+    }
+    return ptr;
+}
+
+int hp_posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = hp_alloc(size, alignment, NULL);
+    if (ptr == NULL) {
+        atomic_fetch_add_explicit(&hp_fallbacks, 1, memory_order_relaxed);
+        ptr = __libc_memalign(alignment, size);
+        if (ptr == NULL) {
+            return ENOMEM;
+        }
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void hp_free(void *ptr) {
+    if (hp_owns(ptr)) {
+        hp_free_owned(ptr);
+    } else {
+        __libc_free(ptr);
+    }
+}
+
+size_t hp_usable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    return hp_owns(ptr) ? hp_owned_size(ptr) : hp_libc_usable_size(ptr);
+}
+
+void *hp_realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return hp_malloc(size);
+    }
+    if (size == 0) {
+        hp_free(ptr);
+        return NULL;
+    }
+    if (hp_owns(ptr) && hp_resize_owned(ptr, size)) {
+        return ptr;
+    }
+    if (!hp_owns(ptr) && !hp_init()) {
+        return __libc_realloc(ptr, size);
+    }
+    size_t old = hp_usable_size(ptr);
+    void *moved = hp_malloc(size);
+    if (moved == NULL) {
+        return NULL;
+    }
+    memcpy(moved, ptr, old < size ? old : size);
+    hp_free(ptr);
+    return moved;
+}
+
+// ---------------------------------------------------------------------------
+// Statistics
+// ---------------------------------------------------------------------------
+// AnonHugePages of the mappings inside the reservation
+static uint64_t hp_thp_backed(void) {
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    char line[256];
+    uintptr_t base = (uintptr_t)hp_base;
+    int inside = 0;
+    uint64_t total = 0;
+
+    if (fp == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long lo, hi, kb;
+        if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+            inside = lo >= base && hi <= base + hp_reserved;
+        } else if (inside && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            total += (uint64_t)kb << 10;
+        }
+    }
+    fclose(fp);
+    return total;
+}
+
+void hp_get_stats(hp_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (hp_ready <= 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&hp_lock);
+    stats->reserved_bytes = hp_reserved;
+    stats->hugetlb_1g_bytes = hp_backing_bytes[HP_BACK_HUGETLB_1G];
+    stats->hugetlb_2m_bytes = hp_backing_bytes[HP_BACK_HUGETLB_2M];
+    stats->thp_bytes = hp_backing_bytes[HP_BACK_THP];
+    stats->small_page_bytes = hp_backing_bytes[HP_BACK_4K];
+    stats->in_use_bytes = hp_in_use_pages << HP_PAGE_SHIFT;
+    stats->arenas = hp_narenas;
+    int64_t allocated = -atomic_load_explicit(&hp_stray_freed_bytes, memory_order_relaxed);
+    for (hp_arena_t *arena = hp_arenas; arena; arena = arena->next_all) {
+        stats->mallocs += __atomic_load_n(&arena->mallocs, __ATOMIC_RELAXED);
+        stats->frees += __atomic_load_n(&arena->frees, __ATOMIC_RELAXED);
+        allocated += __atomic_load_n(&arena->allocated, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&hp_lock);
+
+    stats->allocated_bytes = allocated > 0 ? (uint64_t)allocated : 0;
+    stats->frees += atomic_load_explicit(&hp_stray_frees, memory_order_relaxed);
+    stats->fallbacks = atomic_load_explicit(&hp_fallbacks, memory_order_relaxed);
+    stats->thp_backed_bytes = stats->thp_bytes ? hp_thp_backed() : 0;
+    if (stats->thp_backed_bytes > stats->thp_bytes) {
+        stats->thp_backed_bytes = stats->thp_bytes;
+    }
+    stats->huge_backed_bytes = stats->hugetlb_1g_bytes + stats->hugetlb_2m_bytes + stats->thp_backed_bytes;
+}
+
+static double mib(uint64_t bytes) {
+    return (double)bytes / (1024.0 * 1024.0);
+}
+
+void hp_print_stats(FILE *out) {
+    hp_stats_t s;
+
+    hp_get_stats(&s);
+    uint64_t committed = s.hugetlb_1g_bytes + s.hugetlb_2m_bytes + s.thp_bytes + s.small_page_bytes;
+    fprintf(out, "hugepage_arena[%d]: %.1f MiB committed of %.1f MiB reserved\n",
+            (int)getpid(), mib(committed), mib(s.reserved_bytes));
+    fprintf(out, "  hugetlb 1G %.1f MiB, hugetlb 2M %.1f MiB, THP-advised %.1f MiB (%.1f MiB on huge pages), 4K %.1f MiB\n",
+            mib(s.hugetlb_1g_bytes), mib(s.hugetlb_2m_bytes), mib(s.thp_bytes),
+            mib(s.thp_backed_bytes), mib(s.small_page_bytes));
+    fprintf(out, "  backed by huge pages: %.1f MiB (%.1f%% of committed)\n",
+            mib(s.huge_backed_bytes), committed ? 100.0 * (double)s.huge_backed_bytes / (double)committed : 0.0);
+    fprintf(out, "  in use %.1f MiB, allocated %.1f MiB, mallocs %llu, frees %llu, fallbacks %llu, arenas %u\n",
+            mib(s.in_use_bytes), mib(s.allocated_bytes), (unsigned long long)s.mallocs,
+            (unsigned long long)s.frees, (unsigned long long)s.fallbacks, s.arenas);
+}
+
+// ---------------------------------------------------------------------------
+// malloc interposer (-DHP_INTERPOSE)
+// ---------------------------------------------------------------------------
+#ifdef HP_INTERPOSE
+static inline int hp_route(size_t size) {
+    if (__builtin_expect(hp_ready == 0, 0) && size >= 4096) {
+        hp_init();  // learn HUGEPAGE_ARENA_MIN_SIZE before deciding
+    }
+    return size >= hp_min_size && hp_ready > 0;
+}
+
+void *malloc(size_t size) {
+    return hp_route(size) ? hp_malloc(size) : __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    size_t bytes;
+    if (!__builtin_mul_overflow(nmemb, size, &bytes) && hp_route(bytes)) {
+        return hp_calloc(nmemb, size);
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    if (!hp_owns(ptr) && !hp_route(size)) {
+        return __libc_realloc(ptr, size);
+    }
+    return hp_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    hp_free(ptr);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (hp_route(size)) {
+        return hp_posix_memalign(memptr, alignment, size);
+    }
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = __libc_memalign(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void *memalign(size_t alignment, size_t size) {
+    void *ptr = NULL;
+
+    if (!hp_route(size) || (alignment & (alignment - 1)) != 0) {
+        return __libc_memalign(alignment, size);
+    }
+    int err = hp_posix_memalign(&ptr, alignment < sizeof(void *) ? sizeof(void *) : alignment, size);
+    if (err) {
+        errno = err;
+    }
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+size_t malloc_usable_size(void *ptr) {
+    return hp_usable_size(ptr);
+}
+#endif
@@ -0,0 +1,75 @@
+// hugepage_arena.h - hugepage-backed arena allocator
+// Memory comes from one reserved stretch of address space, committed in
+// 2 MB pages: from the 1 GB hugetlb pool when it has pages free, else the
+// 2 MB hugetlb pool, else anonymous memory advised MADV_HUGEPAGE (THP),
+// else plain 4 KB pages when THP is off. Requests up to 1 MB are served
+// from per-thread, per-size-class slabs of one 2 MB page each; anything
+// larger gets a run of whole pages. Freed memory stays mapped for reuse,
+// and each thread keeps one partly used 2 MB page per size class it uses.
+//
+// Link it and call hp_malloc()/hp_free() directly, or build it with
+// -DHP_INTERPOSE and LD_PRELOAD it: malloc, free, calloc, realloc,
+// posix_memalign, aligned_alloc, memalign and malloc_usable_size then send
+// requests of HUGEPAGE_ARENA_MIN_SIZE bytes or more (default 64 KiB) to the
+// arena and everything else to glibc, e.g.
+//   HUGEPAGE_ARENA_MIN_SIZE=4096 LD_PRELOAD=./libhugepage_arena_preload.so redis-server
+// Pointers from glibc and from the arena can be passed to either free.
+//
+// Environment:
+//   HUGEPAGE_ARENA_RESERVE_GB  address space to reserve (default 64)
+//   HUGEPAGE_ARENA_HUGETLB     0 skips the hugetlb pools
+//   HUGEPAGE_ARENA_1G          1/0 forces 1 GB pages on/off (default: on if
+//                              the 1 GB pool has free pages at startup)
+//   HUGEPAGE_ARENA_THP         0 skips MADV_HUGEPAGE
+//   HUGEPAGE_ARENA_STATS       1 prints hp_print_stats() to stderr at exit
+#ifndef HUGEPAGE_ARENA_H
+#define HUGEPAGE_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Same contracts as their libc namesakes. When the arena cannot supply
+// memory the request falls back to glibc, and hp_free/hp_realloc accept
+// those pointers too.
+void *hp_malloc(size_t size);
+void *hp_calloc(size_t nmemb, size_t size);
+void *hp_realloc(void *ptr, size_t size);
+int hp_posix_memalign(void **memptr, size_t alignment, size_t size);
+void hp_free(void *ptr);
+size_t hp_usable_size(void *ptr);
+
+// Nonzero if ptr was handed out by the arena rather than glibc
+int hp_owns(const void *ptr);
+
+// Counters are summed without stopping other threads, so they are only
+// approximately consistent with each other while allocations are going on.
+typedef struct {
+    uint64_t reserved_bytes;     // address space set aside for the arena
+    uint64_t hugetlb_1g_bytes;   // committed from the 1 GB hugetlb pool
+    uint64_t hugetlb_2m_bytes;   // committed from the 2 MB hugetlb pool
+    uint64_t thp_bytes;          // committed anonymous memory advised MADV_HUGEPAGE
+    uint64_t small_page_bytes;   // committed anonymous memory on 4 KB pages
+    uint64_t thp_backed_bytes;   // part of thp_bytes the kernel has put on huge pages
+    uint64_t huge_backed_bytes;  // hugetlb + thp_backed: what is actually on huge pages
+    uint64_t in_use_bytes;       // committed pages holding slabs or large allocations
+    uint64_t allocated_bytes;    // live allocations, rounded up to their size class
+    uint64_t mallocs;
+    uint64_t frees;
+    uint64_t fallbacks;          // requests the arena could not serve
+    uint32_t arenas;             // per-thread arenas created so far
+} hp_stats_t;
+
+// thp_backed_bytes comes from /proc/self/smaps, so this is not cheap
+void hp_get_stats(hp_stats_t *stats);
+void hp_print_stats(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HUGEPAGE_ARENA_H */
@@ -28,6 +28,31 @@ void print_hugepages_free() {
     fclose(fp);
 }
 
+// Function to print AnonHugePages of the mapping that starts at addr, from
+// /proc/self/smaps: how much of it THP really backs with huge pages
+void print_anon_huge_pages(void *addr) {
+    FILE *fp;
+    char line[256];
+    int inside = 0;
+
+    fp = fopen("/proc/self/smaps", "r");
+    if (fp == NULL) {
+        perror("Error opening /proc/self/smaps");
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long start, end;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            inside = start == (unsigned long)addr;
+        } else if (inside && strstr(line, "AnonHugePages:") != NULL) {
+            printf("Mapping %s", line);
+            break;
+        }
+    }
+    fclose(fp);
+}
+
 int main() {
     void *addr;
     int ret;
@@ -49,15 +74,12 @@ int main() {
     }
     printf("\nAllocated %lu bytes of memory at address %p\n", (unsigned long)MEMORY_SIZE, addr);
 
-    // Write to the allocated memory to ensure pages are faulted in (important for THP)
-    // Accessing the memory forces the kernel to allocate physical pages.
-    printf("Writing to allocated memory to fault in pages...\n");
-    memset(addr, 0, MEMORY_SIZE);
-    printf("Memory written.\n");
-
     // 3. Advise the kernel to use huge pages for this memory region
     // MADV_HUGEPAGE: Request that the specified pages be backed by huge pages.
     // This is a hint; the kernel may or may not fulfill the request.
+    // It has to come before the first write: pages faulted in earlier are
+    // 4 KB pages and stay that way until khugepaged (or MADV_COLLAPSE, see
+    // thp_inspect.c) gets to them.
     ret = madvise(addr, MEMORY_SIZE, MADV_HUGEPAGE);
     if (ret == -1) {
         perror("madvise(MADV_HUGEPAGE) failed. THP might not be enabled or available.");
@@ -67,10 +89,19 @@ int main() {
         printf("madvise(MADV_HUGEPAGE) successful. Kernel will attempt to use huge pages.\n");
     }
 
+    // Write to the allocated memory to ensure pages are faulted in (important for THP)
+    // Accessing the memory forces the kernel to allocate physical pages.
+    printf("Writing to allocated memory to fault in pages...\n");
+    memset(addr, 0, MEMORY_SIZE);
+    printf("Memory written.\n");
+
     // 4. Pause and allow user to check system status
-    printf("\n--- After allocation and madvise ---\n");
-    printf("Please check 'HugePages_Free' in /proc/meminfo in another terminal.\n");
-    printf("Example command: 'cat /proc/meminfo | grep HugePages_Free'\n");
+    // THP does not come out of the HugePages_* pool; it shows up as AnonHugePages.
+    // Only the 2 MB-aligned part of the mapping can be covered.
+    printf("\n--- After madvise and allocation ---\n");
+    print_anon_huge_pages(addr);
+    printf("Please check 'AnonHugePages' in /proc/meminfo in another terminal.\n");
+    printf("Example command: 'cat /proc/meminfo | grep AnonHugePages'\n");
     printf("Press Enter to unmap the memory and exit...\n");
     getchar(); // Wait for user input
 
@@ -0,0 +1,593 @@
+// prefault.c - parallel, NUMA-aware prefaulting (see prefault.h)
+//
+//   gcc -O2 -c prefault.c                                  # the module
+//   gcc -O2 -DPREFAULT_MAIN -o prefault prefault.c -lpthread  # the command below
+//   prefault [-s SIZE] [-p first-touch|interleave|bind] [-m touch|populate|map]
+//            [-N NODES] [-t THREADS_PER_NODE] [-c CHUNK] [-H thp|2m|1g]
+//
+// The command maps SIZE (default 1G; K/M/G suffixes) and prefaults it as
+// told, e.g. -N 0,1 -p interleave -m populate -H 2m. -t 1 -N 0 -m touch is
+// the single-threaded memset of hugepage_demo.c, for comparison.
+//
+// Work is cut into chunks. With first-touch and bind every node gets a
+// contiguous share and only that node's workers fault it, so each page is
+// zeroed by a CPU next to it. Interleaved pages are spread per page by the
+// kernel, so all workers pull from one shared pool of chunks instead.
+#define _GNU_SOURCE
+#include "prefault.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_MASK
+#define MAP_HUGE_MASK 0x3f
+#endif
+
+// Memory policies from <numaif.h>, without libnuma
+#define PREFAULT_MPOL_BIND        2
+#define PREFAULT_MPOL_INTERLEAVE  3
+#define PREFAULT_MASK_LONGS       (PREFAULT_MAX_NODES / (8 * sizeof(unsigned long)))
+
+#define PREFAULT_SMALL_PAGE       4096UL
+#define PREFAULT_MAX_PER_NODE     8      // default cap: zeroing bandwidth flattens out well before
+#define PREFAULT_SAMPLE_BATCH     1024
+
+typedef struct {
+    size_t first;                        // first chunk of the share
+    size_t count;
+    atomic_size_t next;                  // chunks handed out so far
+} prefault_share_t;
+
+typedef struct {
+    char *addr;
+    size_t len;
+    size_t chunk;
+    int map_flags;                       // PREFAULT_MAP_POPULATE re-maps with these
+    prefault_policy_t policy;
+    unsigned long mask[PREFAULT_MASK_LONGS];
+    atomic_int method;
+    atomic_int error;
+    prefault_share_t shares[PREFAULT_MAX_NODES];
+} prefault_job_t;
+
+typedef struct {
+    prefault_job_t *job;
+    prefault_share_t *share;
+    pthread_t thread;
+} prefault_worker_t;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// ---------------------------------------------------------------------------
+// Topology
+// ---------------------------------------------------------------------------
+// "0-3,8,10-11" into flags[0..max)
+static int parse_list(const char *s, unsigned char *flags, int max) {
+    memset(flags, 0, (size_t)max);
+    while (*s && *s != '\n') {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s) {
+            return -1;
+        }
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+        }
+        for (long i = lo; i <= hi && i < max; i++) {
+            if (i >= 0) {
+                flags[i] = 1;
+            }
+        }
+        s = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
+static int read_list(const char *path, unsigned char *flags, int max) {
+    char buf[4096];
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL) {
+        return -1;
+    }
+    char *line = fgets(buf, sizeof(buf), fp);
+    fclose(fp);
+    return line ? parse_list(line, flags, max) : -1;
+}
+
+static int online_nodes(int *nodes) {
+    unsigned char flags[PREFAULT_MAX_NODES];
+    int n = 0;
+
+    if (read_list("/sys/devices/system/node/online", flags, PREFAULT_MAX_NODES) != 0) {
+        nodes[0] = 0;
+        return 1;
+    }
+    for (int i = 0; i < PREFAULT_MAX_NODES; i++) {
+        if (flags[i]) {
+            nodes[n++] = i;
+        }
+    }
+    return n;
+}
+
+// CPUs of the node this process may run on. Memory-only nodes have none;
+// their workers run unpinned.
+static int node_cpus(int node, cpu_set_t *set) {
+    unsigned char flags[CPU_SETSIZE];
+    char path[96];
+    cpu_set_t allowed;
+
+    CPU_ZERO(set);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (read_list(path, flags, CPU_SETSIZE) != 0) {
+        *set = allowed;  // no NUMA in sysfs: everything is node 0
+        return CPU_COUNT(set);
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (flags[cpu] && CPU_ISSET(cpu, &allowed)) {
+            CPU_SET(cpu, set);
+        }
+    }
+    return CPU_COUNT(set);
+}
+
+// Base page size of a mapping made with these mmap flags
+static size_t map_page_size(int flags) {
+    if (!(flags & MAP_HUGETLB)) {
+        return PREFAULT_SMALL_PAGE;
+    }
+    int shift = (flags >> MAP_HUGE_SHIFT) & MAP_HUGE_MASK;
+    if (shift) {
+        return 1UL << shift;
+    }
+    unsigned long kb = 2048;  // the default hugetlb size
+    FILE *fp = fopen("/proc/meminfo", "r");
+    char line[128];
+    if (fp) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+                break;
+            }
+        }
+        fclose(fp);
+    }
+    return kb << 10;
+}
+
+// ---------------------------------------------------------------------------
+// Workers
+// ---------------------------------------------------------------------------
+static void touch_range(char *p, size_t len) {
+    for (size_t off = 0; off < len; off += PREFAULT_SMALL_PAGE) {
+        volatile char *c = p + off;
+        *c = *c;  // a write fault, without changing what is there
+    }
+}
+
+static void job_fail(prefault_job_t *job, int err) {
+    int none = 0;
+    atomic_compare_exchange_strong(&job->error, &none, err);
+}
+
+static int fault_chunk(prefault_job_t *job, char *p, size_t len) {
+    switch (atomic_load_explicit(&job->method, memory_order_relaxed)) {
+    case PREFAULT_MAP_POPULATE:
+        if (mmap(p, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_POPULATE | job->map_flags,
+                 -1, 0) == MAP_FAILED) {
+            return errno;
+        }
+        return 0;
+    case PREFAULT_POPULATE_WRITE:
+        if (madvise(p, len, MADV_POPULATE_WRITE) == 0) {
+            return 0;
+        }
+        if (errno != EINVAL) {
+            return errno;
+        }
+        // Kernel before 5.14: every worker switches to touching
+        atomic_store_explicit(&job->method, PREFAULT_TOUCH, memory_order_relaxed);
+        // fall through
+    default:
+        touch_range(p, len);
+        return 0;
+    }
+}
+
+static void *prefault_worker(void *arg) {
+    prefault_worker_t *worker = arg;
+    prefault_job_t *job = worker->job;
+    prefault_share_t *share = worker->share;
+
+    // A fresh MAP_POPULATE mapping replaces the mbind()ed one, so the
+    // placement has to come from this thread's own policy instead
+    if (atomic_load(&job->method) == PREFAULT_MAP_POPULATE && job->policy != PREFAULT_FIRST_TOUCH) {
+        int mode = job->policy == PREFAULT_BIND ? PREFAULT_MPOL_BIND : PREFAULT_MPOL_INTERLEAVE;
+        if (syscall(SYS_set_mempolicy, mode, job->mask, PREFAULT_MAX_NODES + 1) != 0 && errno != ENOSYS) {
+            job_fail(job, errno);
+            return NULL;
+        }
+    }
+
+    while (atomic_load_explicit(&job->error, memory_order_relaxed) == 0) {
+        size_t i = atomic_fetch_add_explicit(&share->next, 1, memory_order_relaxed);
+        if (i >= share->count) {
+            break;
+        }
+        size_t off = (share->first + i) * job->chunk;
+        size_t len = job->len - off < job->chunk ? job->len - off : job->chunk;
+        int err = fault_chunk(job, job->addr + off, len);
+        if (err) {
+            job_fail(job, err);
+        }
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Entry points
+// ---------------------------------------------------------------------------
+void prefault_opts_init(prefault_opts_t *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->policy = PREFAULT_FIRST_TOUCH;
+    opts->method = PREFAULT_POPULATE_WRITE;
+    opts->chunk = 64UL << 20;
+    opts->sample = 2UL << 20;
+}
+
+static int prefault_run(char *addr, size_t len, int map_flags, const prefault_opts_t *opts,
+                        prefault_report_t *report) {
+    prefault_job_t *job = calloc(1, sizeof(*job));
+    int nodes[PREFAULT_MAX_NODES];
+    int nr_nodes = opts->nr_nodes;
+    int total_nodes = online_nodes(nodes);
+    size_t page = map_page_size(map_flags);
+
+    if (job == NULL) {
+        return ENOMEM;
+    }
+    if (nr_nodes < 0 || nr_nodes > PREFAULT_MAX_NODES) {
+        free(job);
+        return EINVAL;
+    }
+    if (nr_nodes > 0) {
+        memcpy(nodes, opts->nodes, sizeof(int) * (size_t)nr_nodes);
+    } else {
+        nr_nodes = total_nodes;
+    }
+    for (int i = 0; i < nr_nodes; i++) {
+        if (nodes[i] < 0 || nodes[i] >= PREFAULT_MAX_NODES) {
+            free(job);
+            return EINVAL;
+        }
+        job->mask[nodes[i] / (8 * sizeof(unsigned long))] |= 1UL << (nodes[i] % (8 * sizeof(unsigned long)));
+    }
+
+    job->addr = addr;
+    job->len = len;
+    job->chunk = (opts->chunk ? opts->chunk : 64UL << 20) + page - 1;
+    job->chunk -= job->chunk % page;
+    job->map_flags = map_flags & ~MAP_POPULATE;
+    job->policy = opts->policy;
+    atomic_init(&job->method, opts->method);
+    atomic_init(&job->error, 0);
+
+    // Work split: one shared pool for interleave, else a contiguous share per node
+    size_t chunks = (len + job->chunk - 1) / job->chunk;
+    int nr_shares = opts->policy == PREFAULT_INTERLEAVE ? 1 : nr_nodes;
+    for (int s = 0; s < nr_shares; s++) {
+        job->shares[s].first = chunks * (size_t)s / (size_t)nr_shares;
+        job->shares[s].count = chunks * (size_t)(s + 1) / (size_t)nr_shares - job->shares[s].first;
+        atomic_init(&job->shares[s].next, 0);
+    }
+
+    double start = now_sec();
+
+    // The range keeps its policy for faults after the prefault too. ENOSYS
+    // means a kernel without NUMA, where there is nothing to place.
+    if (opts->policy != PREFAULT_FIRST_TOUCH && opts->method != PREFAULT_MAP_POPULATE) {
+        int mode = opts->policy == PREFAULT_BIND ? PREFAULT_MPOL_BIND : PREFAULT_MPOL_INTERLEAVE;
+        if (syscall(SYS_mbind, addr, len, mode, job->mask, PREFAULT_MAX_NODES + 1, 0) != 0 && errno != ENOSYS) {
+            int err = errno;
+            free(job);
+            return err;
+        }
+    }
+
+    prefault_worker_t *workers = calloc((size_t)nr_nodes * PREFAULT_MAX_PER_NODE * 4, sizeof(*workers));
+    int nr_workers = 0;
+    if (workers == NULL) {
+        free(job);
+        return ENOMEM;
+    }
+    for (int n = 0; n < nr_nodes; n++) {
+        cpu_set_t cpus;
+        pthread_attr_t attr;
+        int ncpus = node_cpus(nodes[n], &cpus);
+        int count = opts->threads_per_node > 0 ? opts->threads_per_node :
+                    ncpus < PREFAULT_MAX_PER_NODE ? (ncpus ? ncpus : 1) : PREFAULT_MAX_PER_NODE;
+        if (count > PREFAULT_MAX_PER_NODE * 4) {
+            count = PREFAULT_MAX_PER_NODE * 4;
+        }
+
+        pthread_attr_init(&attr);
+        if (ncpus > 0) {
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+        for (int t = 0; t < count; t++) {
+            prefault_worker_t *worker = &workers[nr_workers];
+            worker->job = job;
+            worker->share = &job->shares[nr_shares == 1 ? 0 : n];
+            if (pthread_create(&worker->thread, &attr, prefault_worker, worker) == 0) {
+                nr_workers++;
+            }
+        }
+        pthread_attr_destroy(&attr);
+    }
+    if (nr_workers == 0) {
+        // Could not start anyone: do it here
+        prefault_worker_t self = { job, &job->shares[0], 0 };
+        for (int s = 0; s < nr_shares; s++) {
+            self.share = &job->shares[s];
+            prefault_worker(&self);
+        }
+    }
+    for (int i = 0; i < nr_workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    double seconds = now_sec() - start;
+    int err = atomic_load(&job->error);
+    report->bytes = len;
+    report->seconds = seconds;
+    report->gb_per_sec = seconds > 0 ? (double)len / seconds / 1e9 : 0;
+    report->threads = nr_workers ? nr_workers : 1;
+    report->method = (prefault_method_t)atomic_load(&job->method);
+    report->error = err;
+
+    free(workers);
+    free(job);
+    if (err == 0 && opts->sample) {
+        prefault_placement(addr, len, opts->sample, report);
+    }
+    return err;
+}
+
+int prefault_range(void *addr, size_t len, const prefault_opts_t *opts, prefault_report_t *report) {
+    prefault_opts_t range_opts = *opts;
+    prefault_report_t scratch;
+
+    if (report == NULL) {
+        report = &scratch;
+    }
+    memset(report, 0, sizeof(*report));
+    // Re-mapping would throw away what the range holds
+    if (range_opts.method == PREFAULT_MAP_POPULATE) {
+        range_opts.method = PREFAULT_POPULATE_WRITE;
+    }
+    // mbind wants page-aligned ranges
+    uintptr_t start = (uintptr_t)addr & ~(PREFAULT_SMALL_PAGE - 1);
+    size_t span = ((uintptr_t)addr + len - start + PREFAULT_SMALL_PAGE - 1) & ~(PREFAULT_SMALL_PAGE - 1);
+
+    int err = prefault_run((char *)start, span, 0, &range_opts, report);
+    if (err) {
+        report->error = err;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+void *prefault_map(size_t len, int flags, const prefault_opts_t *opts, prefault_report_t *report) {
+    prefault_report_t scratch;
+    size_t page = map_page_size(flags);
+
+    if (report == NULL) {
+        report = &scratch;
+    }
+    memset(report, 0, sizeof(*report));
+    len = (len + page - 1) / page * page;
+    flags &= ~(MAP_SHARED | MAP_POPULATE | MAP_FIXED);
+    char *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    if (addr == MAP_FAILED) {
+        report->error = errno;
+        return MAP_FAILED;
+    }
+    int err = prefault_run(addr, len, flags, opts, report);
+    if (err) {
+        munmap(addr, len);
+        report->error = err;
+        errno = err;
+        return MAP_FAILED;
+    }
+    return addr;
+}
+
+int prefault_placement(void *addr, size_t len, size_t sample, prefault_report_t *report) {
+    void *pages[PREFAULT_SAMPLE_BATCH];
+    int status[PREFAULT_SAMPLE_BATCH];
+    uintptr_t base = (uintptr_t)addr & ~(PREFAULT_SMALL_PAGE - 1);
+    size_t samples = (len + sample - 1) / sample;
+
+    memset(report->node_bytes, 0, sizeof(report->node_bytes));
+    report->unplaced_bytes = 0;
+    for (size_t first = 0; first < samples; first += PREFAULT_SAMPLE_BATCH) {
+        size_t count = samples - first < PREFAULT_SAMPLE_BATCH ? samples - first : PREFAULT_SAMPLE_BATCH;
+        for (size_t i = 0; i < count; i++) {
+            pages[i] = (void *)((base + (first + i) * sample) & ~(PREFAULT_SMALL_PAGE - 1));
+        }
+        // With no target nodes move_pages only reports where each page is
+        if (syscall(SYS_move_pages, 0, count, pages, NULL, status, 0) != 0) {
+            return -1;
+        }
+        for (size_t i = 0; i < count; i++) {
+            size_t off = (first + i) * sample;
+            size_t bytes = len - off < sample ? len - off : sample;
+            if (status[i] >= 0 && status[i] < PREFAULT_MAX_NODES) {
+                report->node_bytes[status[i]] += bytes;
+            } else {
+                report->unplaced_bytes += bytes;
+            }
+        }
+    }
+    return 0;
+}
+
+static const char *method_name(prefault_method_t method) {
+    switch (method) {
+    case PREFAULT_TOUCH:          return "touch";
+    case PREFAULT_POPULATE_WRITE: return "MADV_POPULATE_WRITE";
+    case PREFAULT_MAP_POPULATE:   return "MAP_POPULATE";
+    }
+    return "?";
+}
+
+void prefault_print_report(FILE *out, const prefault_report_t *report) {
+    double mib = (double)report->bytes / (1024.0 * 1024.0);
+
+    if (report->threads == 0) {
+        fprintf(out, "prefault: failed: %s\n", strerror(report->error));
+        return;
+    }
+    fprintf(out, "prefault: %.1f MiB in %.3f s (%.2f GB/s), %d threads, %s\n",
+            mib, report->seconds, report->gb_per_sec, report->threads, method_name(report->method));
+    if (report->error) {
+        fprintf(out, "  failed: %s\n", strerror(report->error));
+    }
+    for (int n = 0; n < PREFAULT_MAX_NODES; n++) {
+        if (report->node_bytes[n]) {
+            fprintf(out, "  node %d: %.1f MiB (%.1f%%)\n", n, (double)report->node_bytes[n] / (1024.0 * 1024.0),
+                    100.0 * (double)report->node_bytes[n] / (double)report->bytes);
+        }
+    }
+    if (report->unplaced_bytes) {
+        fprintf(out, "  not placed: %.1f MiB\n", (double)report->unplaced_bytes / (1024.0 * 1024.0));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Command-line driver (-DPREFAULT_MAIN)
+// ---------------------------------------------------------------------------
+#ifdef PREFAULT_MAIN
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+static size_t parse_size(const char *s) {
+    char *end;
+    unsigned long long val = strtoull(s, &end, 10);
+
+    switch (*end) {
+    case 'k': case 'K': val <<= 10; break;
+    case 'm': case 'M': val <<= 20; break;
+    case 'g': case 'G': val <<= 30; break;
+    }
+    return (size_t)val;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: prefault [-s SIZE] [-p first-touch|interleave|bind] [-m touch|populate|map]\n"
+                    "                [-N NODES] [-t THREADS_PER_NODE] [-c CHUNK] [-H thp|2m|1g]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    prefault_opts_t opts;
+    prefault_report_t report;
+    size_t size = 1UL << 30;
+    int flags = 0, thp = 0, opt;
+
+    prefault_opts_init(&opts);
+    while ((opt = getopt(argc, argv, "s:p:m:N:t:c:H:")) != -1) {
+        switch (opt) {
+        case 's': size = parse_size(optarg); break;
+        case 'c': opts.chunk = parse_size(optarg); break;
+        case 't': opts.threads_per_node = atoi(optarg); break;
+        case 'p':
+            if (strcmp(optarg, "first-touch") == 0) opts.policy = PREFAULT_FIRST_TOUCH;
+            else if (strcmp(optarg, "interleave") == 0) opts.policy = PREFAULT_INTERLEAVE;
+            else if (strcmp(optarg, "bind") == 0) opts.policy = PREFAULT_BIND;
+            else usage();
+            break;
+        case 'm':
+            if (strcmp(optarg, "touch") == 0) opts.method = PREFAULT_TOUCH;
+            else if (strcmp(optarg, "populate") == 0) opts.method = PREFAULT_POPULATE_WRITE;
+            else if (strcmp(optarg, "map") == 0) opts.method = PREFAULT_MAP_POPULATE;
+            else usage();
+            break;
+        case 'N': {
+            unsigned char nodes[PREFAULT_MAX_NODES];
+            if (parse_list(optarg, nodes, PREFAULT_MAX_NODES) != 0) {
+                usage();
+            }
+            opts.nr_nodes = 0;
+            for (int n = 0; n < PREFAULT_MAX_NODES; n++) {
+                if (nodes[n]) {
+                    opts.nodes[opts.nr_nodes++] = n;
+                }
+            }
+            break;
+        }
+        case 'H':
+            if (strcmp(optarg, "thp") == 0) thp = 1;
+            else if (strcmp(optarg, "2m") == 0) flags = MAP_HUGETLB | MAP_HUGE_2MB;
+            else if (strcmp(optarg, "1g") == 0) flags = MAP_HUGETLB | MAP_HUGE_1GB;
+            else usage();
+            break;
+        default:
+            usage();
+        }
+    }
+    if (size == 0) {
+        usage();
+    }
+
+    void *addr;
+    if (thp) {
+        // THP has to be advised before the first fault, so map first and
+        // prefault the range in place
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED || madvise(addr, size, MADV_HUGEPAGE) != 0) {
+            perror("mmap/madvise");
+            return 1;
+        }
+        if (prefault_range(addr, size, &opts, &report) != 0) {
+            prefault_print_report(stdout, &report);
+            return 1;
+        }
+    } else {
+        addr = prefault_map(size, flags, &opts, &report);
+        if (addr == MAP_FAILED) {
+            prefault_print_report(stdout, &report);
+            return 1;
+        }
+    }
+    prefault_print_report(stdout, &report);
+    return 0;
+}
+#endif
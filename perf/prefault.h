@@ -0,0 +1,79 @@
+// prefault.h - fault large mappings in from many threads, on chosen NUMA nodes
+// A single-threaded memset of tens of GB at startup takes minutes and puts
+// every page on the node of the thread doing it. prefault_range() splits the
+// range into chunks and has worker threads, pinned to the CPUs of the target
+// nodes, fault them in parallel, after setting the placement with mbind().
+// prefault_map() does the same for a fresh mapping and can also populate it
+// with MAP_POPULATE. Both report throughput and, sampled with move_pages(),
+// where the pages ended up.
+//
+// No libnuma needed: policies go through the raw syscalls and the topology
+// comes from /sys/devices/system/node. Without NUMA every CPU counts as
+// node 0 and the placement options make no difference.
+#ifndef PREFAULT_H
+#define PREFAULT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PREFAULT_MAX_NODES 64
+
+typedef enum {
+    PREFAULT_FIRST_TOUCH,    // no policy: each node's worker faults its own contiguous share
+    PREFAULT_INTERLEAVE,     // mbind(MPOL_INTERLEAVE): pages round-robin over the nodes
+    PREFAULT_BIND,           // mbind(MPOL_BIND): only the nodes, each worker's share on its own
+} prefault_policy_t;
+
+typedef enum {
+    PREFAULT_TOUCH,           // read and write back one byte per 4 KB page
+    PREFAULT_POPULATE_WRITE,  // madvise(MADV_POPULATE_WRITE), Linux 5.14+; else falls back to TOUCH
+    PREFAULT_MAP_POPULATE,    // prefault_map() only: workers re-map their chunks with MAP_POPULATE
+} prefault_method_t;
+
+typedef struct {
+    prefault_policy_t policy;
+    prefault_method_t method;
+    int nodes[PREFAULT_MAX_NODES];  // target nodes
+    int nr_nodes;                   // 0: every online node; at most PREFAULT_MAX_NODES
+    int threads_per_node;           // 0: one per usable CPU of the node, at most 8
+    size_t chunk;                   // unit of work handed to a worker (default 64 MB)
+    size_t sample;                  // placement samples one page per this many bytes
+                                    // (default 2 MB); 0 skips the placement report
+} prefault_opts_t;
+
+typedef struct {
+    size_t bytes;
+    double seconds;                 // mbind, thread start-up and faulting, not the sampling
+    double gb_per_sec;
+    int threads;
+    prefault_method_t method;       // what ran after fallbacks
+    uint64_t node_bytes[PREFAULT_MAX_NODES];  // estimated from the samples
+    uint64_t unplaced_bytes;        // samples move_pages found no page for
+    int error;                      // errno of the first failure, 0 if none
+} prefault_report_t;
+
+void prefault_opts_init(prefault_opts_t *opts);
+
+// Fault in [addr, addr + len) with the contents preserved. The range must
+// be mapped writable. Returns 0, or -1 with errno set (also in report->error).
+int prefault_range(void *addr, size_t len, const prefault_opts_t *opts, prefault_report_t *report);
+
+// mmap a private anonymous region of len bytes (plus flags such as
+// MAP_HUGETLB | MAP_HUGE_1GB) and prefault it. Returns MAP_FAILED on error.
+void *prefault_map(size_t len, int flags, const prefault_opts_t *opts, prefault_report_t *report);
+
+// Just the placement part: sample the range with move_pages() into report
+int prefault_placement(void *addr, size_t len, size_t sample, prefault_report_t *report);
+
+void prefault_print_report(FILE *out, const prefault_report_t *report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PREFAULT_H */
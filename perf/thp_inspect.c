@@ -0,0 +1,460 @@
+// thp_inspect.c - THP coverage and MADV_COLLAPSE (see thp_inspect.h)
+//
+//   gcc -O2 -c thp_inspect.c                                      # the module
+//   gcc -O2 -DTHP_INSPECT_MAIN -o thp_inspect thp_inspect.c       # the command below
+//   thp_inspect -p PID [-n TOP] [-w SECONDS] [-c]
+//   thp_inspect -p PID -r START-END [-c]
+//
+// The first form lists PID's TOP (default 10) hottest anonymous mappings
+// with their THP coverage. Hotness is the smaps Referenced count, which
+// accumulates until the bits are cleared; -w clears them through
+// /proc/PID/clear_refs and waits SECONDS first, so only what was touched in
+// that window counts. The second form reports one range (hex addresses).
+// -c collapses what was listed and reports how much got promoted and how
+// long it took. Run as root for page-exact numbers from kpageflags.
+#define _GNU_SOURCE
+#include "thp_inspect.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_process_madvise
+#define SYS_process_madvise 440
+#endif
+
+#define THP_SMALL_PAGE   4096UL
+#define THP_PMD_SIZE     (2UL << 20)
+
+// /proc/<pid>/pagemap entries and /proc/kpageflags bits
+#define PM_PRESENT       (1ULL << 63)
+#define PM_PFN_MASK      ((1ULL << 55) - 1)
+#define KPF_HUGE         17  // hugetlb
+#define KPF_THP          22
+
+#define PAGEMAP_BATCH    512
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void proc_path(char *buf, size_t len, pid_t pid, const char *file) {
+    if (pid == 0) {
+        snprintf(buf, len, "/proc/self/%s", file);
+    } else {
+        snprintf(buf, len, "/proc/%d/%s", (int)pid, file);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// smaps
+// ---------------------------------------------------------------------------
+typedef int (*smaps_fn)(const thp_mapping_t *map, void *arg);
+
+// Calls fn for every mapping; a nonzero return stops the walk
+static int smaps_foreach(pid_t pid, smaps_fn fn, void *arg) {
+    char path[64], line[512];
+    thp_mapping_t map;
+    int have = 0;
+
+    proc_path(path, sizeof(path), pid, "smaps");
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long lo, hi, kb;
+        char perms[8];
+        int name = 0;
+
+        if (sscanf(line, "%lx-%lx %7s %*s %*s %*s %n", &lo, &hi, perms, &name) >= 3 && name > 0) {
+            if (have && fn(&map, arg)) {
+                have = 0;
+                break;
+            }
+            memset(&map, 0, sizeof(map));
+            memcpy(map.perms, perms, sizeof(perms));
+            map.start = lo;
+            map.end = hi;
+            map.thp_eligible = -1;
+            snprintf(map.path, sizeof(map.path), "%s", line + name);
+            map.path[strcspn(map.path, "\n")] = '\0';
+            have = 1;
+        } else if (sscanf(line, "Rss: %lu kB", &kb) == 1) {
+            map.rss_bytes = (uint64_t)kb << 10;
+        } else if (sscanf(line, "Referenced: %lu kB", &kb) == 1) {
+            map.referenced_bytes = (uint64_t)kb << 10;
+        } else if (sscanf(line, "Anonymous: %lu kB", &kb) == 1) {
+            map.anonymous_bytes = (uint64_t)kb << 10;
+        } else if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            map.anon_huge_bytes = (uint64_t)kb << 10;
+        } else if (sscanf(line, "Shared_Hugetlb: %lu kB", &kb) == 1 ||
+                   sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1) {
+            map.hugetlb_bytes += (uint64_t)kb << 10;
+        } else if (sscanf(line, "THPeligible: %lu", &kb) == 1) {
+            map.thp_eligible = (int)kb;
+        }
+    }
+    if (have) {
+        fn(&map, arg);
+    }
+    fclose(fp);
+    return 0;
+}
+
+typedef struct {
+    uintptr_t start, end;
+    thp_coverage_t *cov;
+} smaps_range_t;
+
+// Mappings only partly inside the range count in proportion
+static int smaps_add_overlap(const thp_mapping_t *map, void *arg) {
+    smaps_range_t *range = arg;
+    uintptr_t lo = map->start > range->start ? map->start : range->start;
+    uintptr_t hi = map->end < range->end ? map->end : range->end;
+
+    if (lo < hi) {
+        double share = (double)(hi - lo) / (double)(map->end - map->start);
+        range->cov->resident_bytes += (uint64_t)((double)map->rss_bytes * share);
+        range->cov->thp_bytes += (uint64_t)((double)map->anon_huge_bytes * share);
+        range->cov->hugetlb_bytes += (uint64_t)((double)map->hugetlb_bytes * share);
+    }
+    return map->start >= range->end;
+}
+
+// ---------------------------------------------------------------------------
+// pagemap + kpageflags
+// ---------------------------------------------------------------------------
+// Flags of a run of consecutive frames, read in one go
+static void count_frames(int kpageflags, uint64_t first_pfn, size_t count, thp_coverage_t *cov) {
+    uint64_t flags[PAGEMAP_BATCH];
+    ssize_t got = pread(kpageflags, flags, count * sizeof(uint64_t), (off_t)(first_pfn * sizeof(uint64_t)));
+
+    for (size_t i = 0; got > 0 && i < (size_t)got / sizeof(uint64_t); i++) {
+        if (flags[i] & (1ULL << KPF_HUGE)) {
+            cov->hugetlb_bytes += THP_SMALL_PAGE;
+        } else if (flags[i] & (1ULL << KPF_THP)) {
+            cov->thp_bytes += THP_SMALL_PAGE;
+        }
+    }
+}
+
+// Returns -1 if frame numbers are hidden from us, so smaps has to do
+static int pagemap_coverage(pid_t pid, uintptr_t start, uintptr_t end, thp_coverage_t *cov) {
+    uint64_t entries[PAGEMAP_BATCH];
+    char path[64];
+
+    int kpageflags = open("/proc/kpageflags", O_RDONLY);
+    if (kpageflags < 0) {
+        return -1;
+    }
+    proc_path(path, sizeof(path), pid, "pagemap");
+    int pagemap = open(path, O_RDONLY);
+    if (pagemap < 0) {
+        close(kpageflags);
+        return -1;
+    }
+
+    int result = 0;
+    for (uintptr_t addr = start; addr < end && result == 0;) {
+        size_t n = (end - addr) / THP_SMALL_PAGE;
+        n = n < PAGEMAP_BATCH ? n : PAGEMAP_BATCH;
+        ssize_t got = pread(pagemap, entries, n * sizeof(uint64_t), (off_t)(addr / THP_SMALL_PAGE * sizeof(uint64_t)));
+        if (got <= 0) {
+            result = -1;
+            break;
+        }
+        n = (size_t)got / sizeof(uint64_t);
+
+        // Group present pages into runs of consecutive frames
+        size_t run = 0;
+        uint64_t run_pfn = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t pfn = entries[i] & PM_PFN_MASK;
+            if (!(entries[i] & PM_PRESENT)) {
+                continue;
+            }
+            if (pfn == 0) {
+                result = -1;  // no CAP_SYS_ADMIN: present, but frames read as 0
+                break;
+            }
+            cov->resident_bytes += THP_SMALL_PAGE;
+            if (run && pfn == run_pfn + run) {
+                run++;
+                continue;
+            }
+            if (run) {
+                count_frames(kpageflags, run_pfn, run, cov);
+            }
+            run_pfn = pfn;
+            run = 1;
+        }
+        if (run && result == 0) {
+            count_frames(kpageflags, run_pfn, run, cov);
+        }
+        addr += n * THP_SMALL_PAGE;
+    }
+    close(pagemap);
+    close(kpageflags);
+    return result;
+}
+
+int thp_coverage(pid_t pid, uintptr_t start, uintptr_t end, thp_coverage_t *cov) {
+    start &= ~(THP_SMALL_PAGE - 1);
+    end = (end + THP_SMALL_PAGE - 1) & ~(THP_SMALL_PAGE - 1);
+    memset(cov, 0, sizeof(*cov));
+    if (end <= start) {
+        errno = EINVAL;
+        return -1;
+    }
+    cov->bytes = end - start;
+
+    cov->source = THP_SOURCE_PAGEMAP;
+    if (pagemap_coverage(pid, start, end, cov) == 0) {
+        return 0;
+    }
+    memset(cov, 0, sizeof(*cov));
+    cov->bytes = end - start;
+    cov->source = THP_SOURCE_SMAPS;
+    smaps_range_t range = { start, end, cov };
+    return smaps_foreach(pid, smaps_add_overlap, &range);
+}
+
+// ---------------------------------------------------------------------------
+// Hot mappings
+// ---------------------------------------------------------------------------
+typedef struct {
+    thp_mapping_t *maps;
+    int count, capacity;
+} mapping_list_t;
+
+static int collect_anonymous(const thp_mapping_t *map, void *arg) {
+    mapping_list_t *list = arg;
+
+    if (map->perms[1] != 'w' || map->anonymous_bytes == 0 ||
+        (map->path[0] != '\0' && strcmp(map->path, "[heap]") != 0)) {
+        return 0;
+    }
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        thp_mapping_t *maps = realloc(list->maps, sizeof(*maps) * (size_t)capacity);
+        if (maps == NULL) {
+            return 1;
+        }
+        list->maps = maps;
+        list->capacity = capacity;
+    }
+    list->maps[list->count++] = *map;
+    return 0;
+}
+
+static int hotter_first(const void *a, const void *b) {
+    const thp_mapping_t *x = a, *y = b;
+
+    if (x->referenced_bytes != y->referenced_bytes) {
+        return x->referenced_bytes < y->referenced_bytes ? 1 : -1;
+    }
+    return x->rss_bytes < y->rss_bytes ? 1 : x->rss_bytes > y->rss_bytes ? -1 : 0;
+}
+
+int thp_hot_mappings(pid_t pid, thp_mapping_t *maps, int max) {
+    mapping_list_t list = { NULL, 0, 0 };
+
+    if (smaps_foreach(pid, collect_anonymous, &list) != 0) {
+        return -1;
+    }
+    qsort(list.maps, (size_t)list.count, sizeof(*list.maps), hotter_first);
+    int count = list.count < max ? list.count : max;
+    if (count > 0) {
+        memcpy(maps, list.maps, sizeof(*maps) * (size_t)count);
+    }
+    free(list.maps);
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// MADV_COLLAPSE
+// ---------------------------------------------------------------------------
+int thp_collapse(pid_t pid, uintptr_t start, uintptr_t end, thp_collapse_t *result) {
+    uintptr_t first = (start + THP_PMD_SIZE - 1) & ~(THP_PMD_SIZE - 1);
+    uintptr_t last = end & ~(THP_PMD_SIZE - 1);
+    thp_coverage_t cov;
+    int pidfd = -1;
+
+    memset(result, 0, sizeof(*result));
+    if (last <= first) {
+        result->error = EINVAL;  // not a single whole 2 MB block
+        errno = EINVAL;
+        return -1;
+    }
+    result->bytes = last - first;
+    if (thp_coverage(pid, first, last, &cov) == 0) {
+        result->thp_before = cov.thp_bytes;
+    }
+    if (pid != 0 && pid != getpid()) {
+        pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+        if (pidfd < 0) {
+            result->error = errno;
+            result->failed_bytes = result->bytes;
+            return -1;
+        }
+    }
+
+    // One block per call, so a refused block does not hide how the rest went
+    double begin = now_sec();
+    for (uintptr_t block = first; block < last; block += THP_PMD_SIZE) {
+        int rc;
+        if (pidfd < 0) {
+            rc = madvise((void *)block, THP_PMD_SIZE, MADV_COLLAPSE);
+        } else {
+            struct iovec iov = { (void *)block, THP_PMD_SIZE };
+            rc = syscall(SYS_process_madvise, pidfd, &iov, 1, MADV_COLLAPSE, 0) < 0 ? -1 : 0;
+        }
+        if (rc == 0) {
+            continue;
+        }
+        int err = errno;
+        if (result->error == 0) {
+            result->error = err;
+        }
+        if (err == ENOSYS || err == EPERM || err == ESRCH || err == EBADF) {
+            result->failed_bytes += last - block;  // the rest would go the same way
+            break;
+        }
+        result->failed_bytes += THP_PMD_SIZE;
+    }
+    result->seconds = now_sec() - begin;
+
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+    if (thp_coverage(pid, first, last, &cov) == 0) {
+        result->thp_after = cov.thp_bytes;
+    }
+    if (result->error) {
+        errno = result->error;
+        return -1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Command-line driver (-DTHP_INSPECT_MAIN)
+// ---------------------------------------------------------------------------
+#ifdef THP_INSPECT_MAIN
+static double mib(uint64_t bytes) {
+    return (double)bytes / (1024.0 * 1024.0);
+}
+
+static void print_collapse(pid_t pid, uintptr_t start, uintptr_t end) {
+    thp_collapse_t res;
+
+    thp_collapse(pid, start, end, &res);
+    if (res.bytes == 0) {
+        printf("    collapse: no whole 2 MB block\n");
+        return;
+    }
+    printf("    collapse: %.1f MiB tried in %.3f s, THP %.1f -> %.1f MiB",
+           mib(res.bytes), res.seconds, mib(res.thp_before), mib(res.thp_after));
+    if (res.failed_bytes) {
+        printf(", %.1f MiB refused (%s)", mib(res.failed_bytes), strerror(res.error));
+    } else if (res.error) {
+        printf(" (%s)", strerror(res.error));
+    }
+    printf("\n");
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: thp_inspect -p PID [-n TOP] [-w SECONDS] [-c]\n"
+                    "       thp_inspect -p PID -r START-END [-c]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    pid_t pid = 0;
+    int top = 10, wait = 0, collapse = 0, opt;
+    uintptr_t start = 0, end = 0;
+
+    while ((opt = getopt(argc, argv, "p:n:w:cr:")) != -1) {
+        switch (opt) {
+        case 'p': pid = atoi(optarg); break;
+        case 'n': top = atoi(optarg); break;
+        case 'w': wait = atoi(optarg); break;
+        case 'c': collapse = 1; break;
+        case 'r':
+            if (sscanf(optarg, "%lx-%lx", &start, &end) != 2 || end <= start) {
+                usage();
+            }
+            break;
+        default:
+            usage();
+        }
+    }
+    if (pid <= 0 || top <= 0) {
+        usage();
+    }
+
+    if (end) {
+        thp_coverage_t cov;
+        if (thp_coverage(pid, start, end, &cov) != 0) {
+            perror("thp_inspect");
+            return 1;
+        }
+        printf("%lx-%lx: %.1f MiB, resident %.1f MiB, THP %.1f MiB (%.1f%% of resident), hugetlb %.1f MiB [%s]\n",
+               start, end, mib(cov.bytes), mib(cov.resident_bytes), mib(cov.thp_bytes),
+               cov.resident_bytes ? 100.0 * (double)cov.thp_bytes / (double)cov.resident_bytes : 0.0,
+               mib(cov.hugetlb_bytes), cov.source == THP_SOURCE_PAGEMAP ? "kpageflags" : "smaps");
+        if (collapse) {
+            print_collapse(pid, start, end);
+        }
+        return 0;
+    }
+
+    if (wait > 0) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/clear_refs", (int)pid);
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL || fputs("1", fp) < 0 || fclose(fp) != 0) {
+            perror(path);
+            return 1;
+        }
+        sleep((unsigned)wait);
+    }
+
+    thp_mapping_t *maps = calloc((size_t)top, sizeof(*maps));
+    int count = maps ? thp_hot_mappings(pid, maps, top) : -1;
+    if (count < 0) {
+        perror("thp_inspect");
+        return 1;
+    }
+    printf("%-27s %10s %10s %10s %10s %6s  %s\n", "mapping", "size MiB", "ref MiB", "rss MiB", "THP MiB", "THP%", "");
+    for (int i = 0; i < count; i++) {
+        thp_mapping_t *m = &maps[i];
+        char range[40];
+        snprintf(range, sizeof(range), "%lx-%lx", (unsigned long)m->start, (unsigned long)m->end);
+        printf("%-27s %10.1f %10.1f %10.1f %10.1f %5.1f%%  %s%s\n", range, mib(m->end - m->start),
+               mib(m->referenced_bytes), mib(m->rss_bytes), mib(m->anon_huge_bytes),
+               m->rss_bytes ? 100.0 * (double)m->anon_huge_bytes / (double)m->rss_bytes : 0.0,
+               m->path, m->thp_eligible == 0 ? " (not THP-eligible)" : "");
+        if (collapse) {
+            print_collapse(pid, m->start, m->end);
+        }
+    }
+    free(maps);
+    return 0;
+}
+#endif
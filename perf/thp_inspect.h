@@ -0,0 +1,71 @@
+// thp_inspect.h - how much of a range is on transparent huge pages, and
+// promoting it with MADV_COLLAPSE
+// Coverage comes from /proc/<pid>/pagemap and /proc/kpageflags where the
+// caller may read page frame numbers (CAP_SYS_ADMIN), page by page;
+// otherwise from the AnonHugePages lines of /proc/<pid>/smaps, which are per
+// mapping and are prorated for mappings the range only partly covers.
+// MADV_COLLAPSE (Linux 6.1+) builds the huge pages synchronously in the
+// calling thread instead of waiting for khugepaged; another process is
+// collapsed through process_madvise(), which needs ptrace access and
+// CAP_SYS_NICE over it. pid 0 means the calling process throughout.
+#ifndef THP_INSPECT_H
+#define THP_INSPECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define THP_SOURCE_PAGEMAP  1
+#define THP_SOURCE_SMAPS    2
+
+typedef struct {
+    uint64_t bytes;            // size of the range
+    uint64_t resident_bytes;
+    uint64_t thp_bytes;        // resident on transparent huge pages
+    uint64_t hugetlb_bytes;    // resident on hugetlb pages (pagemap only)
+    int source;                // THP_SOURCE_*
+} thp_coverage_t;
+
+// Coverage of [start, end). Returns 0, or -1 with errno set.
+int thp_coverage(pid_t pid, uintptr_t start, uintptr_t end, thp_coverage_t *cov);
+
+// One mapping of /proc/<pid>/smaps
+typedef struct {
+    uintptr_t start, end;
+    char perms[8];
+    char path[256];            // empty for anonymous memory
+    uint64_t rss_bytes;
+    uint64_t referenced_bytes; // touched since the referenced bits were last cleared
+    uint64_t anonymous_bytes;
+    uint64_t anon_huge_bytes;
+    uint64_t hugetlb_bytes;
+    int thp_eligible;          // -1 if the kernel does not say
+} thp_mapping_t;
+
+// The process's anonymous, writable mappings, hottest first (by Referenced,
+// then Rss). Fills up to max entries and returns how many, or -1 with errno.
+int thp_hot_mappings(pid_t pid, thp_mapping_t *maps, int max);
+
+typedef struct {
+    uint64_t bytes;            // 2 MB-aligned part of the range that was tried
+    uint64_t thp_before;       // coverage of that part, before and after
+    uint64_t thp_after;
+    uint64_t failed_bytes;     // 2 MB blocks MADV_COLLAPSE refused
+    double seconds;            // spent in MADV_COLLAPSE
+    int error;                 // first errno MADV_COLLAPSE returned, 0 if none
+} thp_collapse_t;
+
+// Collapse every 2 MB block fully inside [start, end). Returns 0 if all of
+// them were collapsed, -1 with errno set if any failed or nothing could be
+// tried (result still filled in).
+int thp_collapse(pid_t pid, uintptr_t start, uintptr_t end, thp_collapse_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* THP_INSPECT_H */
@@ -0,0 +1,622 @@
+// tlb_bench.c - what page size does to memory access cost
+//
+//   gcc -O2 -o tlb_bench tlb_bench.c
+//   tlb_bench [-b 4k,thp,2m,1g] [-p seq,rand,chase] [-s MIN] [-S MAX]
+//             [-n ACCESSES] [-r REPEATS] [-o OUT.json]
+//
+// For every backing and working-set size (doubling from -s to -S, default
+// 1M to 64G; sizes take K/M/G suffixes) it maps a fresh region, times the
+// first touch, then runs each access pattern:
+//   seq    streaming 8-byte reads over the whole set
+//   rand   independent 8-byte reads at random offsets
+//   chase  dependent loads along a random cycle through every cache line
+// and reports ns per access plus dTLB load and miss counts from
+// perf_event_open. Counters that cannot be opened (no PMU in the guest,
+// perf_event_paranoid too high) are reported as null and everything else
+// still runs. Results go to stdout (or -o) as JSON, progress to stderr.
+//
+// Backings: 4k is anonymous memory with MADV_NOHUGEPAGE, thp is 2 MB-aligned
+// anonymous memory with MADV_HUGEPAGE, 2m and 1g come from the hugetlb pools
+// (reserve them first, e.g. sysctl vm.nr_hugepages=N or hugepagesz=1G
+// hugepages=N on the kernel command line). Sizes that do not fit into
+// MemAvailable, or that the hugetlb pool cannot supply, are recorded as
+// skipped. For thp the bytes the kernel really put on huge pages are read
+// back from /proc/self/smaps.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/perf_event.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define SMALL_PAGE  4096UL
+#define LINE_SIZE   64UL
+
+enum { BACK_4K, BACK_THP, BACK_2M, BACK_1G, NUM_BACKINGS };
+static const char *backing_names[NUM_BACKINGS] = { "4k", "thp", "2m", "1g" };
+static const size_t backing_page[NUM_BACKINGS] = { 4096UL, 2UL << 20, 2UL << 20, 1UL << 30 };
+
+enum { PAT_SEQ, PAT_RAND, PAT_CHASE, NUM_PATTERNS };
+static const char *pattern_names[NUM_PATTERNS] = { "seq", "rand", "chase" };
+
+static volatile uint64_t sink;  // keeps the loads from being optimized away
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Uniform in [0, n) without a division
+static inline uint64_t below(uint64_t *state, uint64_t n) {
+    return (uint64_t)(((unsigned __int128)xorshift64(state) * n) >> 64);
+}
+
+// ---------------------------------------------------------------------------
+// Counters
+// ---------------------------------------------------------------------------
+#define CTR_DTLB_LOADS   0
+#define CTR_DTLB_MISSES  1
+#define CTR_CYCLES       2
+#define NUM_COUNTERS     3
+static const char *counter_names[NUM_COUNTERS] = { "dtlb_loads", "dtlb_load_misses", "cycles" };
+
+typedef struct {
+    int fd[NUM_COUNTERS];
+    uint64_t value[NUM_COUNTERS];
+    int valid[NUM_COUNTERS];
+} counters_t;
+
+static int counter_errno;  // why the first counter that failed to open did
+
+static int perf_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;  // allowed at perf_event_paranoid 2
+    attr.exclude_hv = 1;
+    int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0 && counter_errno == 0) {
+        counter_errno = errno;
+    }
+    return fd;
+}
+
+static void counters_open(counters_t *c) {
+    uint64_t dtlb_read = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8);
+
+    c->fd[CTR_DTLB_LOADS] = perf_open(PERF_TYPE_HW_CACHE, dtlb_read | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16));
+    c->fd[CTR_DTLB_MISSES] = perf_open(PERF_TYPE_HW_CACHE, dtlb_read | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    c->fd[CTR_CYCLES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+}
+
+static void counters_start(counters_t *c) {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (c->fd[i] >= 0) {
+            ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+static void counters_stop(counters_t *c) {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        c->valid[i] = 0;
+        if (c->fd[i] >= 0) {
+            ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+            c->valid[i] = read(c->fd[i], &c->value[i], sizeof(c->value[i])) == sizeof(c->value[i]);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// System state
+// ---------------------------------------------------------------------------
+static long read_long(const char *path) {
+    FILE *fp = fopen(path, "r");
+    long val = -1;
+
+    if (fp) {
+        if (fscanf(fp, "%ld", &val) != 1) {
+            val = -1;
+        }
+        fclose(fp);
+    }
+    return val;
+}
+
+static uint64_t mem_available(void) {
+    FILE *fp = fopen("/proc/meminfo", "r");
+    char line[256];
+    unsigned long kb = 0;
+
+    if (fp == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "MemAvailable: %lu kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(fp);
+    return (uint64_t)kb << 10;
+}
+
+// AnonHugePages of the mapping that starts at addr
+static uint64_t thp_backed(void *addr) {
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    char line[256];
+    int inside = 0;
+    uint64_t total = 0;
+
+    if (fp == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long lo, hi, kb;
+        if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+            inside = lo == (uintptr_t)addr;
+        } else if (inside && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            total = (uint64_t)kb << 10;
+            break;
+        }
+    }
+    fclose(fp);
+    return total;
+}
+
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', out);
+        }
+        if ((unsigned char)*s >= 0x20) {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void print_host(FILE *out) {
+    char model[256] = "unknown";
+    char thp[128] = "unknown";
+    char line[256];
+    struct utsname uts;
+    FILE *fp;
+
+    if ((fp = fopen("/proc/cpuinfo", "r")) != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            char *colon = strchr(line, ':');
+            if (colon && strncmp(line, "model name", 10) == 0) {
+                snprintf(model, sizeof(model), "%s", colon + 2);
+                model[strcspn(model, "\n")] = '\0';
+                break;
+            }
+        }
+        fclose(fp);
+    }
+    if ((fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r")) != NULL) {
+        if (fgets(thp, sizeof(thp), fp) != NULL) {
+            thp[strcspn(thp, "\n")] = '\0';
+        }
+        fclose(fp);
+    }
+    uname(&uts);
+
+    fprintf(out, "  \"host\": {\"cpu\": ");
+    json_string(out, model);
+    fprintf(out, ", \"kernel\": ");
+    json_string(out, uts.release);
+    fprintf(out, ", \"cpus\": %ld, \"thp_enabled\": ", sysconf(_SC_NPROCESSORS_ONLN));
+    json_string(out, thp);
+    fprintf(out, ",\n           \"hugetlb_2m\": {\"total\": %ld, \"free\": %ld}, \"hugetlb_1g\": {\"total\": %ld, \"free\": %ld}},\n",
+            read_long("/sys/kernel/mm/hugepages/hugepages-2048kB/nr_hugepages"),
+            read_long("/sys/kernel/mm/hugepages/hugepages-2048kB/free_hugepages"),
+            read_long("/sys/kernel/mm/hugepages/hugepages-1048576kB/nr_hugepages"),
+            read_long("/sys/kernel/mm/hugepages/hugepages-1048576kB/free_hugepages"));
+}
+
+// ---------------------------------------------------------------------------
+// Mapping and first touch
+// ---------------------------------------------------------------------------
+typedef struct {
+    char *addr;       // working set starts here
+    void *map;        // what to munmap
+    size_t map_len;
+    size_t mapped;    // bytes of the working set's backing, rounded to its page size
+} region_t;
+
+static int region_map(region_t *r, int backing, size_t size) {
+    size_t page = backing_page[backing];
+    size_t len = (size + page - 1) / page * page;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    memset(r, 0, sizeof(*r));
+    r->mapped = len;
+    if (backing == BACK_2M || backing == BACK_1G) {
+        flags |= MAP_HUGETLB | (backing == BACK_2M ? MAP_HUGE_2MB : MAP_HUGE_1GB);
+        r->map = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (r->map == MAP_FAILED) {
+            return -1;
+        }
+        r->addr = r->map;
+        r->map_len = len;
+        return 0;
+    }
+
+    // Over-map so the working set can start on a 2 MB boundary; otherwise
+    // THP could not cover its first and last pages
+    size_t align = backing == BACK_THP ? page : SMALL_PAGE;
+    r->map_len = len + align;
+    r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (r->map == MAP_FAILED) {
+        return -1;
+    }
+    r->addr = (char *)(((uintptr_t)r->map + align - 1) & ~(align - 1));
+    // Advice goes in before the first touch, or the faults decide the page size
+    if (madvise(r->addr, len, backing == BACK_THP ? MADV_HUGEPAGE : MADV_NOHUGEPAGE) != 0) {
+        int err = errno;
+        munmap(r->map, r->map_len);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t minor_faults(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t)ru.ru_minflt + (uint64_t)ru.ru_majflt;
+}
+
+// ---------------------------------------------------------------------------
+// Patterns. Each returns the number of 8-byte loads it made.
+// ---------------------------------------------------------------------------
+static uint64_t run_seq(char *buf, size_t size, uint64_t accesses) {
+    const uint64_t *words = (const uint64_t *)buf;
+    size_t n = size / sizeof(uint64_t);
+    uint64_t sum = 0, done = 0;
+
+    // Whole passes only, at least one
+    do {
+        for (size_t i = 0; i < n; i += 4) {
+            sum += words[i] + words[i + 1] + words[i + 2] + words[i + 3];
+        }
+        done += n;
+    } while (done < accesses);
+    sink = sum;
+    return done;
+}
+
+static uint64_t run_rand(char *buf, size_t size, uint64_t accesses) {
+    const uint64_t *words = (const uint64_t *)buf;
+    size_t n = size / sizeof(uint64_t);
+    uint64_t state = 0x9e3779b97f4a7c15ULL, sum = 0;
+
+    for (uint64_t i = 0; i < accesses; i++) {
+        sum += words[below(&state, n)];
+    }
+    sink = sum;
+    return accesses;
+}
+
+// One random cycle through every cache line (Sattolo's algorithm), stored
+// as absolute pointers in each line's first word
+static void build_chase(char *buf, size_t size) {
+    size_t lines = size / LINE_SIZE;
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+
+    for (size_t i = 0; i < lines; i++) {
+        *(uint64_t *)(buf + i * LINE_SIZE) = i;
+    }
+    for (size_t i = lines - 1; i > 0; i--) {
+        size_t j = below(&state, i);
+        uint64_t *a = (uint64_t *)(buf + i * LINE_SIZE);
+        uint64_t *b = (uint64_t *)(buf + j * LINE_SIZE);
+        uint64_t tmp = *a;
+        *a = *b;
+        *b = tmp;
+    }
+    for (size_t i = 0; i < lines; i++) {
+        uint64_t *slot = (uint64_t *)(buf + i * LINE_SIZE);
+        *slot = (uint64_t)(uintptr_t)(buf + *slot * LINE_SIZE);
+    }
+}
+
+static uint64_t run_chase(char *buf, size_t size, uint64_t accesses) {
+    void **p = (void **)buf;
+
+    (void)size;
+    for (uint64_t i = 0; i < accesses; i++) {
+        p = (void **)*p;
+    }
+    sink = (uint64_t)(uintptr_t)p;
+    return accesses;
+}
+
+// ---------------------------------------------------------------------------
+// Driver
+// ---------------------------------------------------------------------------
+typedef struct {
+    int backings[NUM_BACKINGS];
+    int patterns[NUM_PATTERNS];
+    size_t min_size, max_size;
+    uint64_t accesses;
+    int repeats;
+} config_t;
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_counter(FILE *out, const char *name, const counters_t *c, int i) {
+    if (c->valid[i]) {
+        fprintf(out, ", \"%s\": %llu", name, (unsigned long long)c->value[i]);
+    } else {
+        fprintf(out, ", \"%s\": null", name);
+    }
+}
+
+// Runs one pattern config->repeats times and prints its JSON object.
+// ns/access is the median over the repeats; the counters belong to the run
+// that produced it.
+static void run_pattern(FILE *out, const config_t *config, int pattern, char *buf, size_t size) {
+    double ns[64];
+    counters_t runs[64], c;
+    uint64_t loads = 0;
+    int repeats = config->repeats;
+
+    counters_open(&c);
+    if (pattern == PAT_CHASE) {
+        build_chase(buf, size);
+    }
+    // Warm-up so the first timed run does not pay for cold caches alone
+    switch (pattern) {
+    case PAT_SEQ:   run_seq(buf, size, 0); break;
+    case PAT_RAND:  run_rand(buf, size, config->accesses / 8 + 1); break;
+    case PAT_CHASE: run_chase(buf, size, config->accesses / 8 + 1); break;
+    }
+
+    for (int r = 0; r < repeats; r++) {
+        runs[r] = c;
+        counters_start(&runs[r]);
+        uint64_t start = now_ns();
+        switch (pattern) {
+        case PAT_SEQ:   loads = run_seq(buf, size, config->accesses); break;
+        case PAT_RAND:  loads = run_rand(buf, size, config->accesses); break;
+        case PAT_CHASE: loads = run_chase(buf, size, config->accesses); break;
+        }
+        ns[r] = (double)(now_ns() - start) / (double)loads;
+        counters_stop(&runs[r]);
+    }
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (c.fd[i] >= 0) {
+            close(c.fd[i]);
+        }
+    }
+
+    double sorted[64];
+    memcpy(sorted, ns, sizeof(double) * repeats);
+    qsort(sorted, repeats, sizeof(double), cmp_double);
+    double median = sorted[repeats / 2];
+    int pick = 0;
+    for (int r = 0; r < repeats; r++) {
+        if (ns[r] == median) {
+            pick = r;
+        }
+    }
+
+    fprintf(out, "\"%s\": {\"accesses\": %llu, \"ns_per_access\": %.3f, \"ns_per_access_min\": %.3f",
+            pattern_names[pattern], (unsigned long long)loads, median, sorted[0]);
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        print_counter(out, counter_names[i], &runs[pick], i);
+    }
+    if (runs[pick].valid[CTR_DTLB_MISSES]) {
+        fprintf(out, ", \"dtlb_misses_per_1k_accesses\": %.3f",
+                1000.0 * (double)runs[pick].value[CTR_DTLB_MISSES] / (double)loads);
+    } else {
+        fprintf(out, ", \"dtlb_misses_per_1k_accesses\": null");
+    }
+    fprintf(out, "}");
+}
+
+static void run_one(FILE *out, const config_t *config, int backing, size_t size, int *first) {
+    region_t r;
+
+    fprintf(out, "%s    {\"backing\": \"%s\", \"size\": %zu", *first ? "" : ",\n",
+            backing_names[backing], size);
+    *first = 0;
+
+    size_t page = backing_page[backing];
+    size_t need = (size + page - 1) / page * page;
+    if ((backing == BACK_4K || backing == BACK_THP) && need > mem_available() / 10 * 9) {
+        fprintf(out, ", \"status\": \"skipped\", \"reason\": \"exceeds MemAvailable\"}");
+        return;
+    }
+    if (region_map(&r, backing, size) != 0) {
+        int hugetlb = backing == BACK_2M || backing == BACK_1G;
+        fprintf(out, ", \"status\": \"skipped\", \"reason\": ");
+        json_string(out, hugetlb && errno == ENOMEM ? "not enough free hugetlb pages" : strerror(errno));
+        fprintf(out, "}");
+        return;
+    }
+    fprintf(stderr, "tlb_bench: %s %zu bytes\n", backing_names[backing], size);
+
+    // First touch: one write per 4 KB page, so every backing is faulted in
+    // by the same loop and the difference is the number and cost of faults
+    uint64_t faults = minor_faults();
+    uint64_t start = now_ns();
+    for (size_t off = 0; off < r.mapped; off += SMALL_PAGE) {
+        r.addr[off] = 1;
+    }
+    uint64_t touch_ns = now_ns() - start;
+    faults = minor_faults() - faults;
+
+    uint64_t huge = backing == BACK_THP ? thp_backed(r.addr) :
+                    backing == BACK_4K ? 0 : r.mapped;
+    fprintf(out, ", \"status\": \"ok\", \"mapped\": %zu, \"huge_backed\": %llu",
+            r.mapped, (unsigned long long)huge);
+    fprintf(out, ",\n     \"first_touch_ns\": %llu, \"first_touch_ns_per_mb\": %.1f, \"page_faults\": %llu",
+            (unsigned long long)touch_ns, (double)touch_ns / ((double)r.mapped / (1 << 20)),
+            (unsigned long long)faults);
+
+    for (int p = 0; p < NUM_PATTERNS; p++) {
+        if (config->patterns[p]) {
+            fprintf(out, ",\n     ");
+            run_pattern(out, config, p, r.addr, size);
+        }
+    }
+    fprintf(out, "}");
+    munmap(r.map, r.map_len);
+}
+
+static size_t parse_size(const char *s) {
+    char *end;
+    unsigned long long val = strtoull(s, &end, 10);
+
+    switch (*end) {
+    case 'k': case 'K': val <<= 10; break;
+    case 'm': case 'M': val <<= 20; break;
+    case 'g': case 'G': val <<= 30; break;
+    }
+    return (size_t)val;
+}
+
+// Comma-separated names into flags; returns -1 on an unknown name
+static int parse_list(char *arg, const char **names, int count, int *flags) {
+    memset(flags, 0, sizeof(int) * count);
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        int found = 0;
+        for (int i = 0; i < count; i++) {
+            if (strcmp(tok, names[i]) == 0) {
+                flags[i] = found = 1;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "tlb_bench: unknown name '%s'\n", tok);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: tlb_bench [-b 4k,thp,2m,1g] [-p seq,rand,chase] [-s MIN] [-S MAX]\n"
+                    "                 [-n ACCESSES] [-r REPEATS] [-o OUT.json]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    config_t config = {
+        .backings = { 1, 1, 1, 1 },
+        .patterns = { 1, 1, 1 },
+        .min_size = 1UL << 20,
+        .max_size = 64UL << 30,
+        .accesses = 1ULL << 24,
+        .repeats = 3,
+    };
+    FILE *out = stdout;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:p:s:S:n:r:o:")) != -1) {
+        switch (opt) {
+        case 'b':
+            if (parse_list(optarg, backing_names, NUM_BACKINGS, config.backings) != 0) {
+                usage();
+            }
+            break;
+        case 'p':
+            if (parse_list(optarg, pattern_names, NUM_PATTERNS, config.patterns) != 0) {
+                usage();
+            }
+            break;
+        case 's': config.min_size = parse_size(optarg); break;
+        case 'S': config.max_size = parse_size(optarg); break;
+        case 'n': config.accesses = strtoull(optarg, NULL, 10); break;
+        case 'r': config.repeats = atoi(optarg); break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (out == NULL) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage();
+        }
+    }
+    if (config.min_size < SMALL_PAGE || config.max_size < config.min_size ||
+        config.repeats < 1 || config.repeats > 64 || config.accesses == 0) {
+        usage();
+    }
+    config.min_size &= ~(LINE_SIZE - 1);
+
+    counters_t probe;
+    counters_open(&probe);
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (probe.fd[i] >= 0) {
+            close(probe.fd[i]);
+        }
+    }
+
+    fprintf(out, "{\n");
+    print_host(out);
+    fprintf(out, "  \"config\": {\"accesses\": %llu, \"repeats\": %d, \"counters\": ",
+            (unsigned long long)config.accesses, config.repeats);
+    if (counter_errno) {
+        char why[160];
+        snprintf(why, sizeof(why), "unavailable: %s", strerror(counter_errno));
+        json_string(out, why);
+    } else {
+        json_string(out, "ok");
+    }
+    fprintf(out, "},\n  \"results\": [\n");
+
+    int first = 1;
+    for (int b = 0; b < NUM_BACKINGS; b++) {
+        if (!config.backings[b]) {
+            continue;
+        }
+        for (size_t size = config.min_size; size <= config.max_size; size *= 2) {
+            run_one(out, &config, b, size, &first);
+            fflush(out);
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}